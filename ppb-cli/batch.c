@@ -0,0 +1,505 @@
+// Read-ahead for uploading many files.
+//
+// Every file costs open, fstat, read and close. One at a time that is four
+// system calls and four waits per file, which dominates once files are
+// small. With io_uring the opens of a whole window of files are queued
+// together, then a read of each into a buffer big enough for most files,
+// then the closes, and one io_uring_enter() submits what is queued and
+// collects what has finished. The size is only asked for when that first
+// read fills its buffer: a statx through the ring is always handed to a
+// kernel worker thread, which costs more than it saves. Without io_uring a
+// pool of threads keeps a window of files in flight instead.
+
+#define _GNU_SOURCE
+
+#include "batch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define HAVE_URING 1
+#endif
+#endif
+
+#define THREADS 8
+
+#ifdef HAVE_URING
+#define RING_ENTRIES 1024       // one per file in the window, with room to spare
+#define FIRST_READ (64 * 1024)  // read before knowing the size; larger files finish synchronously
+
+enum { OP_OPEN, OP_READ, OP_CLOSE };
+
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sqe_tail;          // queued locally, not yet visible to the kernel
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+} Ring;
+
+// A file in flight
+typedef struct {
+    size_t index;
+    int fd;
+    int error;
+    char *data;
+    size_t size;
+} Slot;
+#endif
+
+struct BatchReader {
+    const char *const *paths;
+    size_t count;
+    size_t max_size;
+    size_t next;                // first file not started
+    size_t returned;
+    size_t in_flight;
+
+    BatchFile ready[BATCH_WINDOW];
+    size_t ready_head;
+    size_t ready_len;
+    size_t ready_bytes;
+    int failed;
+
+    int uring;
+#ifdef HAVE_URING
+    Ring ring;
+    Slot slots[BATCH_WINDOW];
+    size_t free_slots[BATCH_WINDOW];
+    size_t free_count;
+#endif
+
+    pthread_t threads[THREADS];
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // room for another file, or stopping
+    pthread_cond_t done;        // a file is ready
+    int stopping;
+};
+
+static int has_room(const BatchReader *r)
+{
+    return r->next < r->count && r->in_flight + r->ready_len < BATCH_WINDOW &&
+           r->ready_bytes < BATCH_READY_BYTES;
+}
+
+static void push_ready(BatchReader *r, BatchFile file)
+{
+    r->ready[(r->ready_head + r->ready_len) % BATCH_WINDOW] = file;
+    r->ready_len++;
+    r->ready_bytes += file.size;
+}
+
+static void pop_ready(BatchReader *r, BatchFile *out)
+{
+    *out = r->ready[r->ready_head];
+    r->ready_head = (r->ready_head + 1) % BATCH_WINDOW;
+    r->ready_len--;
+    r->ready_bytes -= out->size;
+    r->returned++;
+}
+
+// Thread pool
+
+static void read_file(const char *path, size_t max_size, BatchFile *file)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        file->error = errno;
+    } else if (S_ISDIR(st.st_mode)) {
+        file->error = EISDIR;
+    } else if ((size_t)st.st_size > max_size) {
+        file->error = EFBIG;
+    } else if (!(file->data = malloc((size_t)st.st_size + 1))) {
+        file->error = ENOMEM;
+    }
+    while (!file->error && file->size < (size_t)st.st_size) {
+        ssize_t n = read(fd, file->data + file->size, (size_t)st.st_size - file->size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) file->error = errno;
+        if (n <= 0) break;
+        file->size += (size_t)n;
+    }
+    if (fd >= 0) close(fd);
+    if (file->error) {
+        free(file->data);
+        file->data = NULL;
+        file->size = 0;
+    }
+}
+
+static void *worker(void *arg)
+{
+    BatchReader *r = arg;
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (!r->stopping && r->next < r->count && !has_room(r))
+            pthread_cond_wait(&r->work, &r->lock);
+        if (r->stopping || r->next >= r->count) break;
+        BatchFile file = { .index = r->next++ };
+        r->in_flight++;
+        pthread_mutex_unlock(&r->lock);
+
+        read_file(r->paths[file.index], r->max_size, &file);
+
+        pthread_mutex_lock(&r->lock);
+        r->in_flight--;
+        push_ready(r, file);
+        pthread_cond_signal(&r->done);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+static int start_threads(BatchReader *r)
+{
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->work, NULL);
+    pthread_cond_init(&r->done, NULL);
+    for (int i = 0; i < THREADS; i++) {
+        if (pthread_create(&r->threads[i], NULL, worker, r) != 0) break;
+        r->thread_count++;
+    }
+    return r->thread_count ? 0 : -1;
+}
+
+static int next_threaded(BatchReader *r, BatchFile *out)
+{
+    pthread_mutex_lock(&r->lock);
+    while (!r->ready_len && r->returned < r->count)
+        pthread_cond_wait(&r->done, &r->lock);
+    int got = r->ready_len > 0;
+    if (got) {
+        pop_ready(r, out);
+        pthread_cond_signal(&r->work);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return got;
+}
+
+// io_uring
+
+#ifdef HAVE_URING
+static int ring_setup(Ring *ring)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if (ring->fd < 0) return -1;
+
+    ring->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_map_len > ring->sq_map_len) ring->sq_map_len = ring->cq_map_len;
+
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) goto failed;
+    ring->cq_map = single ? ring->sq_map
+                          : mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) goto failed;
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto failed;
+
+    char *sq = ring->sq_map;
+    char *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // Opening through the ring needs 5.6 or later
+    size_t probe_len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_len);
+    int supported = probe && syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    const int ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+    for (size_t i = 0; supported && i < sizeof(ops) / sizeof(ops[0]); i++)
+        supported = ops[i] < probe->ops_len && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!supported) goto failed;
+    return 0;
+
+failed:
+    if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_map && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_len);
+    if (ring->sq_map && ring->sq_map != MAP_FAILED) munmap(ring->sq_map, ring->sq_map_len);
+    close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    return -1;
+}
+
+static void ring_teardown(Ring *ring)
+{
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_len);
+    munmap(ring->sq_map, ring->sq_map_len);
+    close(ring->fd);
+}
+
+// Submit what is queued; with wait, also block until something completes
+static int ring_enter(Ring *ring, int wait)
+{
+    unsigned submit = ring->sqe_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    for (;;) {
+        long rc = syscall(__NR_io_uring_enter, ring->fd, submit, wait ? 1 : 0,
+                          wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (rc >= 0) return 0;
+        if (errno == EINTR) continue;
+        // Out of resources for now: reap completions and come back
+        if (errno == EAGAIN || errno == EBUSY) return 0;
+        return -1;
+    }
+}
+
+static struct io_uring_sqe *ring_sqe(Ring *ring)
+{
+    if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries &&
+        ring_enter(ring, 0) != 0)
+        return NULL;
+    if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+        return NULL;
+    unsigned idx = ring->sqe_tail++ & *ring->sq_mask;
+    ring->sq_array[idx] = idx;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static int queue(BatchReader *r, size_t slot, int op, int fd, const void *addr, unsigned len)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&r->ring);
+    if (!sqe) return -1;
+    static const int opcodes[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+    sqe->opcode = (uint8_t)opcodes[op];
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    if (op == OP_OPEN) sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->user_data = (uint64_t)slot << 2 | (uint64_t)op;
+    return 0;
+}
+
+static int start_file(BatchReader *r)
+{
+    size_t s = r->free_slots[--r->free_count];
+    Slot *slot = &r->slots[s];
+    memset(slot, 0, sizeof(*slot));
+    slot->index = r->next++;
+    slot->fd = -1;
+    r->in_flight++;
+    return queue(r, s, OP_OPEN, AT_FDCWD, r->paths[slot->index], 0);
+}
+
+static void finish_file(BatchReader *r, size_t s)
+{
+    Slot *slot = &r->slots[s];
+    BatchFile file = { .index = slot->index, .data = slot->data, .size = slot->size, .error = slot->error };
+    if (file.error) {
+        free(file.data);
+        file.data = NULL;
+        file.size = 0;
+    }
+    push_ready(r, file);
+    r->in_flight--;
+    r->free_slots[r->free_count++] = s;
+}
+
+// The first read filled its buffer: the rest, with ordinary calls
+static void read_rest(BatchReader *r, Slot *slot)
+{
+    struct stat st;
+    if (fstat(slot->fd, &st) != 0) {
+        slot->error = errno;
+        return;
+    }
+    if ((size_t)st.st_size > r->max_size) {
+        slot->error = EFBIG;
+        return;
+    }
+    for (;;) {
+        size_t cap = (size_t)st.st_size > slot->size ? (size_t)st.st_size : slot->size * 2;
+        char *data = realloc(slot->data, cap + 1);
+        if (!data) {
+            slot->error = ENOMEM;
+            return;
+        }
+        slot->data = data;
+        ssize_t n = pread(slot->fd, slot->data + slot->size, cap - slot->size, (off_t)slot->size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            slot->error = errno;
+            return;
+        }
+        if (n == 0) return;
+        slot->size += (size_t)n;
+        if (slot->size > r->max_size) {
+            slot->error = EFBIG;
+            return;
+        }
+    }
+}
+
+static int complete(BatchReader *r, size_t s, int op, int res)
+{
+    Slot *slot = &r->slots[s];
+    if (op == OP_OPEN) {
+        if (res < 0) {
+            slot->error = -res;
+            finish_file(r, s);
+            return 0;
+        }
+        slot->fd = res;
+        if (!(slot->data = malloc(FIRST_READ + 1))) {
+            slot->error = ENOMEM;
+            close(slot->fd);
+            finish_file(r, s);
+            return 0;
+        }
+        return queue(r, s, OP_READ, slot->fd, slot->data, FIRST_READ);
+    }
+    if (op == OP_READ) {
+        if (res < 0) {
+            slot->error = -res;
+        } else {
+            slot->size = (size_t)res;
+            if (slot->size == FIRST_READ) {
+                read_rest(r, slot);
+            } else if (slot->size > r->max_size) {
+                slot->error = EFBIG;
+            } else {
+                char *data = realloc(slot->data, slot->size + 1);   // give back the rest of the buffer
+                if (data) slot->data = data;
+            }
+        }
+        return queue(r, s, OP_CLOSE, slot->fd, NULL, 0);
+    }
+    finish_file(r, s);
+    return 0;
+}
+
+static int reap(BatchReader *r)
+{
+    Ring *ring = &r->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    int rc = 0;
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        if (complete(r, (size_t)(cqe->user_data >> 2), (int)(cqe->user_data & 3), cqe->res) != 0) rc = -1;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return rc;
+}
+
+static int next_uring(BatchReader *r, BatchFile *out)
+{
+    while (!r->ready_len) {
+        if (r->returned == r->count || r->failed) return r->failed ? -1 : 0;
+        while (has_room(r))
+            if (start_file(r) != 0) r->failed = 1;
+        if (r->failed || ring_enter(&r->ring, 1) != 0 || reap(r) != 0) r->failed = 1;
+    }
+    pop_ready(r, out);
+    return 1;
+}
+#endif
+
+BatchReader *batch_reader_new(const char *const *paths, size_t count, size_t max_size, int use_uring)
+{
+    BatchReader *r = calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    r->paths = paths;
+    r->count = count;
+    r->max_size = max_size;
+#ifdef HAVE_URING
+    if (use_uring && ring_setup(&r->ring) == 0) {
+        r->uring = 1;
+        for (size_t i = 0; i < BATCH_WINDOW; i++) r->free_slots[i] = BATCH_WINDOW - 1 - i;
+        r->free_count = BATCH_WINDOW;
+        return r;
+    }
+#else
+    (void)use_uring;
+#endif
+    if (start_threads(r) != 0) {
+        batch_reader_free(r);
+        return NULL;
+    }
+    return r;
+}
+
+int batch_reader_next(BatchReader *reader, BatchFile *out)
+{
+#ifdef HAVE_URING
+    if (reader->uring) return next_uring(reader, out);
+#endif
+    return next_threaded(reader, out);
+}
+
+const char *batch_reader_backend(const BatchReader *reader)
+{
+    return reader->uring ? "io_uring" : "threads";
+}
+
+void batch_reader_free(BatchReader *reader)
+{
+    if (!reader) return;
+#ifdef HAVE_URING
+    if (reader->uring) {
+        // The kernel may still write into slots; let what is in flight land
+        while (reader->in_flight && !reader->failed)
+            if (ring_enter(&reader->ring, 1) != 0 || reap(reader) != 0) reader->failed = 1;
+        ring_teardown(&reader->ring);
+    }
+#endif
+    if (reader->thread_count) {
+        pthread_mutex_lock(&reader->lock);
+        reader->stopping = 1;
+        pthread_cond_broadcast(&reader->work);
+        pthread_mutex_unlock(&reader->lock);
+        for (int i = 0; i < reader->thread_count; i++) pthread_join(reader->threads[i], NULL);
+        pthread_mutex_destroy(&reader->lock);
+        pthread_cond_destroy(&reader->work);
+        pthread_cond_destroy(&reader->done);
+    }
+    while (reader->ready_len) {
+        BatchFile file;
+        pop_ready(reader, &file);
+        free(file.data);
+    }
+    free(reader);
+}
@@ -0,0 +1,37 @@
+#ifndef PPB_BATCH_H
+#define PPB_BATCH_H
+
+#include <stddef.h>
+
+// Reads many small files ahead of the uploads that send them. On Linux the
+// opens, stats, reads and closes of a whole window of files go to the
+// kernel through io_uring, a few system calls per batch instead of four per
+// file; elsewhere, or where io_uring is unavailable, a pool of threads does
+// the same with ordinary calls. Files come back in completion order.
+
+#define BATCH_WINDOW 256                 // files open or read ahead at once
+#define BATCH_READY_BYTES (64 * 1024 * 1024) // read but not yet taken, before pausing
+
+typedef struct {
+    size_t index;               // into the paths given
+    char *data;                 // the whole file, caller frees; NULL on error
+    size_t size;
+    int error;                  // errno, 0 on success
+} BatchFile;
+
+typedef struct BatchReader BatchReader;
+
+// paths must outlive the reader. Files over max_size fail with EFBIG.
+// With use_uring 0 the thread pool is used even where io_uring works.
+BatchReader *batch_reader_new(const char *const *paths, size_t count, size_t max_size, int use_uring);
+
+// The next file read; 1 if one was returned, 0 once all have been, -1 if
+// the reader itself broke down
+int batch_reader_next(BatchReader *reader, BatchFile *out);
+
+// "io_uring" or "threads"
+const char *batch_reader_backend(const BatchReader *reader);
+
+void batch_reader_free(BatchReader *reader);
+
+#endif
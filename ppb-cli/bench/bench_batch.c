@@ -0,0 +1,154 @@
+// Files per second through the batch reader, against one file at a time.
+//
+// Builds a tree of small files (100 directories of equal share, 200 B to
+// 4 KB each), then reads all of them with a plain open/fstat/read/close
+// loop, with the thread pool and with io_uring. The tree stays in the page
+// cache after the first pass, so this measures system call overhead. With
+// --cold the page cache is dropped before every pass (root only), so the
+// reads go to the disk and the reader's overlapping of them shows.
+//
+// Usage: bench/bench_batch [--cold] [FILES] [DIR]
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+
+#define DIRS 100
+#define MAX_SIZE (100 * 1024 * 1024)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int drop_caches(void)
+{
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    int ok = fd >= 0 && write(fd, "3", 1) == 1;
+    if (fd >= 0) close(fd);
+    return ok ? 0 : -1;
+}
+
+static char **make_tree(const char *root, size_t files)
+{
+    char **paths = calloc(files, sizeof(*paths));
+    char block[4096];
+    for (size_t i = 0; i < sizeof(block); i++) block[i] = (char)('a' + i % 26);
+    if (!paths || (mkdir(root, 0700) != 0 && errno != EEXIST)) return NULL;
+
+    unsigned seed = 1;
+    for (size_t i = 0; i < files; i++) {
+        char dir[600];
+        snprintf(dir, sizeof(dir), "%s/%03d", root, (int)(i % DIRS));
+        if (i < DIRS) mkdir(dir, 0700);
+        paths[i] = malloc(strlen(dir) + 32);
+        sprintf(paths[i], "%s/%zu.txt", dir, i);
+        seed = seed * 1103515245u + 12345u;
+        size_t size = 200 + (seed >> 8) % (sizeof(block) - 200);
+        int fd = open(paths[i], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0 || write(fd, block, size) != (ssize_t)size) {
+            perror(paths[i]);
+            return NULL;
+        }
+        close(fd);
+    }
+    return paths;
+}
+
+static double run_sequential(char **paths, size_t files, size_t *bytes)
+{
+    double start = now();
+    *bytes = 0;
+    for (size_t i = 0; i < files; i++) {
+        int fd = open(paths[i], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) continue;
+        char *data = malloc((size_t)st.st_size + 1);
+        ssize_t n = read(fd, data, (size_t)st.st_size);
+        close(fd);
+        if (n > 0) *bytes += (size_t)n;
+        free(data);
+    }
+    return now() - start;
+}
+
+static double run_reader(char **paths, size_t files, int use_uring, size_t *bytes, const char **backend)
+{
+    double start = now();
+    BatchReader *reader = batch_reader_new((const char *const *)paths, files, MAX_SIZE, use_uring);
+    if (!reader) return -1;
+    *backend = batch_reader_backend(reader);
+    *bytes = 0;
+    BatchFile file;
+    while (batch_reader_next(reader, &file) > 0) {
+        *bytes += file.size;
+        free(file.data);
+    }
+    batch_reader_free(reader);
+    return now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    int cold = argc > 1 && strcmp(argv[1], "--cold") == 0;
+    if (cold) {
+        argc--;
+        argv++;
+    }
+    size_t files = argc > 1 ? (size_t)atol(argv[1]) : 100000;
+    char root[512];
+    snprintf(root, sizeof(root), "%s", argc > 2 ? argv[2] : "/tmp/ppb-bench-batch");
+    char **paths = make_tree(root, files);
+    if (!paths) return 1;
+    if (cold && drop_caches() != 0) {
+        fprintf(stderr, "--cold needs to write /proc/sys/vm/drop_caches: %s\n", strerror(errno));
+        return 1;
+    }
+
+    const char *names[] = { "sequential", "threads", "io_uring" };
+    double best[3] = { 1e9, 1e9, 1e9 };
+    const char *backend = "threads";
+    size_t bytes[3] = { 0, 0, 0 };
+    if (!cold) run_sequential(paths, files, &bytes[0]);    // warm the page cache
+    for (int round = 0; round < 3; round++) {
+        if (cold) drop_caches();
+        double t = run_sequential(paths, files, &bytes[0]);
+        if (t < best[0]) best[0] = t;
+        if (cold) drop_caches();
+        t = run_reader(paths, files, 0, &bytes[1], &backend);
+        if (t >= 0 && t < best[1]) best[1] = t;
+        if (cold) drop_caches();
+        t = run_reader(paths, files, 1, &bytes[2], &backend);
+        if (t >= 0 && t < best[2]) best[2] = t;
+    }
+    if (strcmp(backend, "io_uring") != 0) names[2] = "io_uring (unavailable, threads)";
+
+    for (int i = 0; i < 3; i++)
+        printf("%-32s %10.0f files/s  %8.1f MB/s\n", names[i], (double)files / best[i],
+               (double)bytes[i] / best[i] / (1 << 20));
+
+    for (size_t i = 0; i < files; i++) {
+        unlink(paths[i]);
+        free(paths[i]);
+    }
+    for (int d = 0; d < DIRS; d++) {
+        char dir[600];
+        snprintf(dir, sizeof(dir), "%s/%03d", root, d);
+        rmdir(dir);
+    }
+    rmdir(root);
+    free(paths);
+    return 0;
+}
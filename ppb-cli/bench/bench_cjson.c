@@ -0,0 +1,107 @@
+// Parsing wide JSON documents of which only a few values are wanted.
+//
+// Builds an object of MEMBERS members, a mix of plain strings, strings with
+// escapes and numbers, the way a server response or a config with many
+// entries looks, and reads three of them back: once through a full parse,
+// once through a lazy one. A last pass reads every value from a lazy parse,
+// which is the most a caller can end up paying for the deferral.
+//
+// Usage: bench/bench_cjson [MEMBERS] [ROUNDS]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cJSON.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char *make_document(size_t members, size_t *len)
+{
+    char *doc = malloc(members * 96 + 64);
+    if (!doc) return NULL;
+    size_t n = (size_t)sprintf(doc, "{\"url\":\"https://paste.example/abc123\"");
+    unsigned seed = 1;
+    for (size_t i = 0; i < members; i++) {
+        seed = seed * 1103515245u + 12345u;
+        switch ((seed >> 16) % 3) {
+        case 0:
+            n += (size_t)sprintf(doc + n, ",\"field_%zu\":\"value %u for a plain string field\"", i, seed);
+            break;
+        case 1:
+            n += (size_t)sprintf(doc + n, ",\"field_%zu\":\"line\\none\\t\\\"quoted\\\" caf\\u00e9 %u\"", i, seed);
+            break;
+        default:
+            n += (size_t)sprintf(doc + n, ",\"field_%zu\":%u.%03u", i, seed % 100000, seed % 1000);
+            break;
+        }
+    }
+    n += (size_t)sprintf(doc + n, ",\"size\":4096,\"checksum\":\"9f86d081884c7d65\"}");
+    *len = n;
+    return doc;
+}
+
+// What a caller like finish_batch_leg or checksum_matches reads
+static int read_few(const cJSON *root)
+{
+    const char *url = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(root, "url"));
+    const char *sum = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(root, "checksum"));
+    double size = cJSON_GetNumberValue(cJSON_GetObjectItemCaseSensitive(root, "size"));
+    return url && sum && size == 4096;
+}
+
+static int read_all(const cJSON *root)
+{
+    int ok = 1;
+    for (const cJSON *c = root->child; c; c = c->next)
+        ok &= cJSON_IsNumber(c) ? cJSON_GetNumberValue(c) >= 0 : cJSON_GetStringValue(c) != NULL;
+    return ok;
+}
+
+static double run(const char *doc, size_t len, int rounds, int lazy, int (*reader)(const cJSON *))
+{
+    double best = 1e9;
+    for (int r = 0; r < rounds; r++) {
+        double start = now();
+        cJSON *root = lazy ? cJSON_ParseLazy(doc, len) : cJSON_Parse(doc);
+        int ok = root && reader(root);
+        cJSON_Delete(root);
+        double t = now() - start;
+        if (!ok) {
+            fprintf(stderr, "parse or read failed\n");
+            exit(1);
+        }
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    size_t members = argc > 1 ? (size_t)atol(argv[1]) : 10000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 50;
+    size_t len;
+    char *doc = make_document(members, &len);
+    if (!doc) return 1;
+
+    double full = run(doc, len, rounds, 0, read_few);
+    double lazy = run(doc, len, rounds, 1, read_few);
+    double lazy_all = run(doc, len, rounds, 1, read_all);
+    double mb = (double)len / (1 << 20);
+
+    printf("%zu members, %.1f KB\n", members + 3, (double)len / 1024);
+    printf("full parse, 3 values read   %9.1f us  %7.0f MB/s\n", full * 1e6, mb / full);
+    printf("lazy parse, 3 values read   %9.1f us  %7.0f MB/s  (%.1fx)\n", lazy * 1e6, mb / lazy, full / lazy);
+    printf("lazy parse, all values read %9.1f us  %7.0f MB/s  (%.1fx)\n", lazy_all * 1e6, mb / lazy_all,
+           full / lazy_all);
+    free(doc);
+    return 0;
+}
@@ -0,0 +1,127 @@
+"""Time to first byte of put for tiny pastes: config parsed from JSON vs
+loaded from its snapshot.
+
+Starts a sink that notes when the first byte of each request arrives, then
+runs `put --config <file> < tiny` repeatedly and reports how long after the
+process was spawned the server heard from it. The config is the default one
+("small") or one with many servers, groups and redact rules ("large").
+PPB_CONFIG_SNAPSHOT=0 forces the JSON path.
+
+Usage:
+    python bench/bench_startup.py [--put ./put] [--runs 200] [--servers 500]
+        [--out startup.json]
+"""
+
+import argparse
+import json
+import os
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from pathlib import Path
+
+CLI_DIR = Path(__file__).resolve().parent.parent
+
+
+class Sink:
+    """Answers every request with a canned upload response."""
+
+    def __init__(self) -> None:
+        self.listener = socket.create_server(("127.0.0.1", 0))
+        self.url = f"http://127.0.0.1:{self.listener.getsockname()[1]}/upload"
+        self.first_byte = None
+        self.arrived = threading.Event()
+        threading.Thread(target=self.serve, daemon=True).start()
+
+    def serve(self) -> None:
+        while True:
+            conn, _ = self.listener.accept()
+            threading.Thread(target=self.handle, args=(conn,), daemon=True).start()
+
+    def handle(self, conn) -> None:
+        with conn, conn.makefile("rb") as reader:
+            first = reader.read(1)
+            self.first_byte = time.perf_counter()
+            self.arrived.set()
+            if not first:
+                return
+            headers = {}
+            reader.readline()  # rest of the request line
+            while (line := reader.readline()) not in (b"\r\n", b""):
+                name, _, value = line.decode().partition(":")
+                headers[name.strip().lower()] = value.strip()
+            reader.read(int(headers.get("content-length", 0)))
+            body = b'{"url": "http://127.0.0.1/raw/0"}'
+            conn.sendall(
+                b"HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                b"Content-Length: %d\r\nConnection: close\r\n\r\n%s" % (len(body), body)
+            )
+
+
+def write_config(path: Path, url: str, servers: int) -> None:
+    config = {
+        "default_server": url,
+        "default_token": "bench",
+        "servers": {"local": {"url": "http://127.0.0.1:5000", "token": ""}},
+    }
+    if servers:
+        config["servers"].update(
+            {f"host{i}": {"url": f"https://ppb{i}.example.com/upload", "token": f"tok{i:032}"} for i in range(servers)}
+        )
+        config["groups"] = {f"g{i}": [f"host{j}" for j in range(i, i + 8)] for i in range(0, servers - 8, 8)}
+        config["redact"] = {
+            "enabled": False,
+            "rules": [{"name": f"rule{i}", "anchor": f"key{i}_", "min": 16} for i in range(64)],
+        }
+        config["compact"] = {"enabled": False, "keep": "both"}
+    path.write_text(json.dumps(config, indent=2))
+
+
+def time_to_first_byte(put: str, config: Path, paste: Path, sink: Sink, env: dict) -> float:
+    sink.arrived.clear()
+    with open(paste, "rb") as f:
+        start = time.perf_counter()
+        result = subprocess.run([put, "--config", str(config)], stdin=f, env=env, capture_output=True)
+    if result.returncode != 0 or not sink.arrived.wait(5):
+        raise RuntimeError(f"put failed: {result.stderr.decode().strip()}")
+    return sink.first_byte - start
+
+
+def main(argv=None) -> int:
+    parser = argparse.ArgumentParser(description="put startup latency")
+    parser.add_argument("--put", default=str(CLI_DIR / "put"), help="put binary to run")
+    parser.add_argument("--runs", type=int, default=200, help="runs per case")
+    parser.add_argument("--servers", type=int, default=500, help="servers in the large config")
+    parser.add_argument("--out", help="write the JSON results here as well")
+    args = parser.parse_args(argv)
+
+    sink = Sink()
+    results = {}
+    with tempfile.TemporaryDirectory(prefix="ppb-startup-") as workdir:
+        workdir = Path(workdir)
+        paste = workdir / "paste"
+        paste.write_bytes(b"hello\n")
+        for size, servers in (("small", 0), ("large", args.servers)):
+            config = workdir / f"{size}.json"
+            write_config(config, sink.url, servers)
+            for mode, snapshot in (("json", "0"), ("snapshot", "1")):
+                env = dict(os.environ, PPB_CONFIG_SNAPSHOT=snapshot)
+                time_to_first_byte(args.put, config, paste, sink, env)  # warm up, and write the snapshot
+                samples = sorted(time_to_first_byte(args.put, config, paste, sink, env) for _ in range(args.runs))
+                median = statistics.median(samples) * 1000
+                p90 = samples[int(len(samples) * 0.9)] * 1000
+                name = f"{size}/{mode}"
+                results[name] = {"median_ms": median, "p90_ms": p90, "config_bytes": config.stat().st_size}
+                print(f"{name:16} {config.stat().st_size:8} B config  median {median:7.3f} ms  p90 {p90:7.3f} ms")
+
+    if args.out:
+        Path(args.out).write_text(json.dumps(results, indent=2) + "\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
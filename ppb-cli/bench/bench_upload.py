@@ -0,0 +1,155 @@
+"""Upload throughput of put: direct (splice/sendfile) path vs the curl path.
+
+Starts a sink that speaks just enough HTTP/1.1 to take an upload (Content-Length
+or chunked, Expect: 100-continue) and discards the body, so the numbers
+measure the client rather than ppb-server's hashing and storage. Each input
+size is sent as a regular file (`put < file`) and through a pipe
+(`cat file | put --no-spool`, so the pipe is streamed), over TCP loopback and a Unix socket.
+
+Usage:
+    python bench/bench_upload.py [--put ./put] [--sizes 1073741824,4294967296]
+        [--repeat 3] [--dir /var/tmp] [--out upload.json]
+"""
+
+import argparse
+import json
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from pathlib import Path
+
+CLI_DIR = Path(__file__).resolve().parent.parent
+DEFAULT_SIZES = "1073741824,4294967296"
+BLOCK = 1 << 20
+
+
+def read_body(conn, reader, headers: dict) -> int:
+    """Consume a request body; returns its size."""
+    buf = bytearray(BLOCK)
+    view = memoryview(buf)
+    if headers.get("transfer-encoding", "").lower() == "chunked":
+        total = 0
+        while True:
+            size = int(reader.readline().split(b";")[0], 16)
+            if size == 0:
+                reader.readline()
+                return total
+            left = size
+            while left:
+                n = reader.readinto(view[: min(left, BLOCK)])
+                if not n:
+                    raise ConnectionError("body ended early")
+                left -= n
+            reader.readline()
+            total += size
+    left = int(headers.get("content-length", 0))
+    total = left
+    while left:
+        n = reader.readinto(view[: min(left, BLOCK)])
+        if not n:
+            raise ConnectionError("body ended early")
+        left -= n
+    return total
+
+
+def handle(conn) -> None:
+    with conn, conn.makefile("rb", buffering=BLOCK) as reader:
+        reader.readline()  # request line
+        headers = {}
+        while (line := reader.readline()) not in (b"\r\n", b""):
+            name, _, value = line.decode().partition(":")
+            headers[name.strip().lower()] = value.strip()
+        if headers.get("expect", "").lower() == "100-continue":
+            conn.sendall(b"HTTP/1.1 100 Continue\r\n\r\n")
+        received = read_body(conn, reader, headers)
+        body = json.dumps({"received": received}).encode()
+        conn.sendall(
+            b"HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+            b"Content-Length: %d\r\nConnection: close\r\n\r\n%s" % (len(body), body)
+        )
+
+
+def serve(listener) -> None:
+    while True:
+        conn, _ = listener.accept()
+        threading.Thread(target=handle, args=(conn,), daemon=True).start()
+
+
+def start_sinks(workdir: Path) -> tuple[str, str]:
+    """Start TCP and Unix socket sinks; returns (url, socket path)."""
+    tcp = socket.create_server(("127.0.0.1", 0))
+    unix_path = str(workdir / "sink.sock")
+    unix = socket.socket(socket.AF_UNIX)
+    unix.bind(unix_path)
+    unix.listen()
+    for listener in (tcp, unix):
+        threading.Thread(target=serve, args=(listener,), daemon=True).start()
+    return f"http://127.0.0.1:{tcp.getsockname()[1]}/upload", unix_path
+
+
+def make_input(path: Path, size: int) -> None:
+    block = os.urandom(BLOCK)
+    with open(path, "wb") as f:
+        for _ in range(size // BLOCK):
+            f.write(block)
+        f.write(block[: size % BLOCK])
+
+
+def run_put(put: str, args: list[str], source: Path, piped: bool) -> tuple[float, int]:
+    start = time.perf_counter()
+    with open(source, "rb") as f:
+        if piped:
+            cat = subprocess.Popen(["cat"], stdin=f, stdout=subprocess.PIPE)
+            result = subprocess.run([put, *args, "--no-spool"], stdin=cat.stdout, capture_output=True)
+            cat.stdout.close()
+            cat.wait()
+        else:
+            result = subprocess.run([put, *args], stdin=f, capture_output=True)
+    elapsed = time.perf_counter() - start
+    if result.returncode != 0:
+        raise RuntimeError(f"put failed: {result.stderr.decode().strip()}")
+    return elapsed, json.loads(result.stdout)["received"]
+
+
+def main(argv=None) -> int:
+    parser = argparse.ArgumentParser(description="put upload throughput")
+    parser.add_argument("--put", default=str(CLI_DIR / "put"), help="put binary to run")
+    parser.add_argument("--sizes", default=DEFAULT_SIZES, help="input sizes in bytes")
+    parser.add_argument("--repeat", type=int, default=3, help="runs per case; the best is kept")
+    parser.add_argument("--dir", help="where to create the input files (default: temp dir)")
+    parser.add_argument("--out", help="write the JSON results here as well")
+    args = parser.parse_args(argv)
+
+    results = {}
+    with tempfile.TemporaryDirectory(prefix="ppb-upload-", dir=args.dir) as workdir:
+        workdir = Path(workdir)
+        url, unix_path = start_sinks(workdir)
+        for size in [int(item) for item in args.sizes.split(",") if item]:
+            source = workdir / "input"
+            make_input(source, size)
+            for transport, extra in (("tcp", []), ("unix", ["--unix-socket", unix_path])):
+                for piped in (False, True):
+                    for path, flags in (("direct", []), ("curl", ["--no-splice"])):
+                        name = f"{transport}/{'pipe' if piped else 'file'}/{path}/{size}"
+                        put_args = ["--url", url, "--token", "bench", *extra, *flags]
+                        best = None
+                        for _ in range(args.repeat):
+                            elapsed, received = run_put(args.put, put_args, source, piped)
+                            if received != size:
+                                raise RuntimeError(f"{name}: sink received {received} bytes")
+                            best = elapsed if best is None else min(best, elapsed)
+                        results[name] = {"seconds": best, "mb_per_s": size / best / 2**20}
+                        print(f"{name:40} {best:8.3f} s  {size / best / 2**20:10.1f} MB/s")
+            source.unlink()
+
+    if args.out:
+        Path(args.out).write_text(json.dumps(results, indent=2) + "\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,276 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "compact.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define READ_CHUNK (256 * 1024)
+#define MARKER_MAX 64
+
+struct Compactor {
+    CompactKeep keep;
+    int fuzzy;
+
+    // Input: [line, len) is the current, unfinished line
+    char *in;
+    size_t cap;
+    size_t line;
+    size_t len;
+    int passthrough;            // inside an over-long line, sending it as is
+
+    // Current run of alike lines; run == 0 when there is none
+    unsigned long run;
+    char *first;
+    size_t first_len;
+    uint64_t first_hash;
+    char *last;
+    size_t last_len;
+
+    char *out;
+    size_t out_head;
+    size_t out_len;
+    size_t out_cap;
+
+    int finished;
+    unsigned long dropped;
+};
+
+Compactor *compactor_new(CompactKeep keep, int fuzzy)
+{
+    Compactor *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->keep = keep;
+    c->fuzzy = fuzzy;
+    c->cap = COMPACT_LINE_MAX + READ_CHUNK;
+    c->in = malloc(c->cap);
+    c->first = malloc(COMPACT_LINE_MAX);
+    c->last = malloc(COMPACT_LINE_MAX);
+    if (!c->in || !c->first || !c->last) {
+        compactor_free(c);
+        return NULL;
+    }
+    return c;
+}
+
+void compactor_free(Compactor *c)
+{
+    if (!c) return;
+    free(c->in);
+    free(c->first);
+    free(c->last);
+    free(c->out);
+    free(c);
+}
+
+int compact_keep_parse(const char *name, CompactKeep *keep)
+{
+    if (strcmp(name, "first") == 0) *keep = COMPACT_KEEP_FIRST;
+    else if (strcmp(name, "last") == 0) *keep = COMPACT_KEEP_LAST;
+    else if (strcmp(name, "both") == 0) *keep = COMPACT_KEEP_BOTH;
+    else return -1;
+    return 0;
+}
+
+static int is_digit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+// FNV-1a over the line; in fuzzy mode each run of digits hashes as one '0'
+static uint64_t line_hash(const Compactor *c, const char *p, size_t n)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char ch = (unsigned char)p[i];
+        if (c->fuzzy && is_digit((char)ch)) {
+            while (i + 1 < n && is_digit(p[i + 1])) i++;
+            ch = '0';
+        }
+        h = (h ^ ch) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static int lines_alike(const Compactor *c, const char *a, size_t an, const char *b, size_t bn)
+{
+    if (!c->fuzzy) return an == bn && memcmp(a, b, an) == 0;
+    size_t i = 0, j = 0;
+    while (i < an && j < bn) {
+        if (is_digit(a[i]) && is_digit(b[j])) {
+            while (i < an && is_digit(a[i])) i++;
+            while (j < bn && is_digit(b[j])) j++;
+        } else if (a[i++] != b[j++]) {
+            return 0;
+        }
+    }
+    return i == an && j == bn;
+}
+
+static int emit(Compactor *c, const char *p, size_t n)
+{
+    if (c->out_len + n > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : READ_CHUNK;
+        while (cap < c->out_len + n) cap *= 2;
+        char *out = realloc(c->out, cap);
+        if (!out) return -1;
+        c->out = out;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, p, n);
+    c->out_len += n;
+    return 0;
+}
+
+// Stand in for n lines of the run. Exact repeats are copies of the first
+// line, so a few short ones are written as they were when that is no
+// longer than the marker.
+static int emit_marker(Compactor *c, const char *fmt, unsigned long n)
+{
+    char marker[MARKER_MAX];
+    int len = snprintf(marker, sizeof(marker), fmt, n);
+    if (!c->fuzzy && n * c->first_len <= (size_t)len) {
+        for (unsigned long i = 0; i < n; i++) {
+            if (emit(c, c->first, c->first_len) != 0) return -1;
+        }
+        return 0;
+    }
+    c->dropped += n;
+    return emit(c, marker, (size_t)len);
+}
+
+// Write out what is left of the current run
+static int end_run(Compactor *c)
+{
+    unsigned long run = c->run;
+    if (run == 0) return 0;
+    c->run = 0;
+
+    int rc = 0;
+    switch (c->keep) {
+    case COMPACT_KEEP_FIRST:
+        if (run > 1) rc = emit_marker(c, "[ppb: last line repeated %lu more times]\n", run - 1);
+        break;
+    case COMPACT_KEEP_LAST:
+        if (run > 1) rc = emit_marker(c, "[ppb: %lu similar lines omitted]\n", run - 1);
+        if (rc == 0) rc = emit(c, c->last, c->last_len);
+        break;
+    case COMPACT_KEEP_BOTH:
+        if (run > 2) rc = emit_marker(c, "[ppb: %lu similar lines omitted]\n", run - 2);
+        if (rc == 0 && run > 1) rc = emit(c, c->last, c->last_len);
+        break;
+    }
+    return rc;
+}
+
+// One complete line, terminator included
+static int take_line(Compactor *c, const char *p, size_t n)
+{
+    if (n > COMPACT_LINE_MAX) {
+        if (end_run(c) != 0) return -1;
+        return emit(c, p, n);
+    }
+
+    uint64_t hash = line_hash(c, p, n);
+    if (c->run > 0 && hash == c->first_hash && lines_alike(c, c->first, c->first_len, p, n)) {
+        c->run++;
+        if (c->keep != COMPACT_KEEP_FIRST) {
+            memcpy(c->last, p, n);
+            c->last_len = n;
+        }
+        return 0;
+    }
+
+    if (end_run(c) != 0) return -1;
+    c->run = 1;
+    memcpy(c->first, p, n);
+    c->first_len = n;
+    c->first_hash = hash;
+    if (c->keep == COMPACT_KEEP_LAST) {
+        memcpy(c->last, p, n);
+        c->last_len = n;
+        return 0;
+    }
+    return emit(c, p, n);
+}
+
+char *compactor_buffer(Compactor *c, size_t *cap)
+{
+    *cap = c->cap - c->len;
+    if (*cap > READ_CHUNK) *cap = READ_CHUNK;
+    return c->in + c->len;
+}
+
+int compactor_commit(Compactor *c, size_t len)
+{
+    size_t from = c->len;
+    c->len += len;
+
+    while (from < c->len) {
+        const char *nl = memchr(c->in + from, '\n', c->len - from);
+        size_t end = nl ? (size_t)(nl - c->in) + 1 : c->len;
+        if (c->passthrough) {
+            // The rest of an over-long line goes out as it comes
+            if (emit(c, c->in + from, end - from) != 0) return -1;
+            if (nl) c->passthrough = 0;
+            c->line = end;
+        } else if (nl) {
+            if (take_line(c, c->in + c->line, end - c->line) != 0) return -1;
+            c->line = end;
+        }
+        from = end;
+    }
+
+    if (c->len - c->line > COMPACT_LINE_MAX) {
+        // Too long to hold: it ends any run and is never compacted
+        if (end_run(c) != 0 || emit(c, c->in + c->line, c->len - c->line) != 0) return -1;
+        c->passthrough = 1;
+        c->line = c->len;
+    }
+
+    // Keep only the unfinished line, at the start
+    memmove(c->in, c->in + c->line, c->len - c->line);
+    c->len -= c->line;
+    c->line = 0;
+    return 0;
+}
+
+int compactor_finish(Compactor *c)
+{
+    // A last line without a newline differs from the same line with one
+    if (c->len > 0) {
+        int rc = c->passthrough ? emit(c, c->in, c->len) : take_line(c, c->in, c->len);
+        if (rc != 0) return -1;
+        c->len = 0;
+    }
+    if (end_run(c) != 0) return -1;
+    c->finished = 1;
+    return 0;
+}
+
+int compactor_finished(const Compactor *c)
+{
+    return c->finished;
+}
+
+const char *compactor_output(const Compactor *c, size_t *len)
+{
+    *len = c->out_len - c->out_head;
+    return c->out + c->out_head;
+}
+
+void compactor_consume(Compactor *c, size_t len)
+{
+    c->out_head += len;
+    if (c->out_head == c->out_len) {
+        c->out_head = 0;
+        c->out_len = 0;
+    }
+}
+
+unsigned long compactor_dropped(const Compactor *c)
+{
+    return c->dropped;
+}
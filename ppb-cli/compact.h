@@ -0,0 +1,46 @@
+#ifndef PPB_COMPACT_H
+#define PPB_COMPACT_H
+
+#include <stddef.h>
+
+// Streaming repeat-line compaction.
+//
+// A run of consecutive identical lines is replaced by the line and a marker
+// with the repeat count. Lines are compared by hash first, then byte for
+// byte against the first line of the run. In fuzzy mode, lines that differ
+// only in their numbers (timestamps, counters, ids) count as repeats too.
+//
+// Memory is bounded: only the current line and the run's first and last
+// lines are held. Lines longer than COMPACT_LINE_MAX are passed through as
+// they arrive and never compacted.
+
+#define COMPACT_LINE_MAX (64 * 1024)
+
+typedef enum {
+    COMPACT_KEEP_FIRST,     // the first line, then "repeated N more times"
+    COMPACT_KEEP_LAST,      // "N similar lines omitted", then the last line
+    COMPACT_KEEP_BOTH       // first line, "N similar lines omitted", last line
+} CompactKeep;
+
+typedef struct Compactor Compactor;
+
+Compactor *compactor_new(CompactKeep keep, int fuzzy);
+void compactor_free(Compactor *c);
+
+// Same protocol as the redactor: read into the buffer, commit what was
+// read, and drain the output; commit fails only when out of memory
+char *compactor_buffer(Compactor *c, size_t *cap);
+int compactor_commit(Compactor *c, size_t len);
+int compactor_finish(Compactor *c);
+int compactor_finished(const Compactor *c);
+
+const char *compactor_output(const Compactor *c, size_t *len);
+void compactor_consume(Compactor *c, size_t len);
+
+// Lines left out of the output so far
+unsigned long compactor_dropped(const Compactor *c);
+
+// "first", "last" or "both"; returns -1 for anything else
+int compact_keep_parse(const char *name, CompactKeep *keep);
+
+#endif
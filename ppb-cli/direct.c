@@ -0,0 +1,564 @@
+// Zero-copy upload path for plain HTTP and Unix sockets.
+//
+// curl reads the body into its own buffers before writing it to the socket.
+// For large local uploads that copy dominates, so when TLS is not involved
+// put writes the request head itself and lets the kernel move the body:
+// sendfile(2) from a regular file, splice(2) from a pipe. Anything this path
+// does not handle (https, proxies, terminals on stdin) goes through curl.
+
+#define _GNU_SOURCE
+
+#include "direct.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#define HOST_SIZE 256
+#define PATH_SIZE 512
+#define HEAD_SIZE 8192
+#define CHUNK_MAX (1024 * 1024)          // largest chunk taken from a pipe at once
+#define FILE_SEND_MAX (1L << 30)         // sendfile() per call
+#define RESPONSE_MAX (16 * 1024 * 1024)
+#define CONTINUE_WAIT_MS 1000            // same as curl's default expect timeout
+
+typedef struct {
+    char authority[HOST_SIZE]; // Host header value, port included
+    char host[HOST_SIZE];      // for getaddrinfo, without IPv6 brackets
+    char port[8];
+    char path[PATH_SIZE];
+} Target;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t cap;
+} Buffer;
+
+// Parse http://host[:port][/path]; fails for anything curl should handle
+static int parse_http_url(const char *url, Target *t)
+{
+    if (strncasecmp(url, "http://", 7) != 0) return -1;
+    const char *p = url + 7;
+    size_t len = strcspn(p, "/?#");
+    if (len == 0 || len >= HOST_SIZE) return -1;
+    if (memchr(p, '@', len)) return -1; // credentials in the URL
+    memcpy(t->authority, p, len);
+    t->authority[len] = '\0';
+
+    const char *port = NULL;
+    if (t->authority[0] == '[') {
+        const char *close = strchr(t->authority, ']');
+        if (!close || (close[1] && close[1] != ':')) return -1;
+        size_t host_len = (size_t)(close - t->authority) - 1;
+        memcpy(t->host, t->authority + 1, host_len);
+        t->host[host_len] = '\0';
+        if (close[1] == ':') port = close + 2;
+    } else {
+        const char *colon = strchr(t->authority, ':');
+        size_t host_len = colon ? (size_t)(colon - t->authority) : len;
+        memcpy(t->host, t->authority, host_len);
+        t->host[host_len] = '\0';
+        if (colon) port = colon + 1;
+    }
+    if (port && (*port == '\0' || strlen(port) >= sizeof(t->port) || strspn(port, "0123456789") != strlen(port)))
+        return -1;
+    snprintf(t->port, sizeof(t->port), "%s", port ? port : "80");
+
+    const char *rest = p + len;
+    size_t rest_len = strcspn(rest, "#");
+    if (rest_len + 2 > PATH_SIZE) return -1;
+    if (rest[0] == '/')
+        snprintf(t->path, PATH_SIZE, "%.*s", (int)rest_len, rest);
+    else
+        snprintf(t->path, PATH_SIZE, "/%.*s", (int)rest_len, rest);
+    return 0;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Milliseconds left before the deadline: -1 without one, 0 once it has passed
+static int remaining_ms(const DirectRequest *req)
+{
+    if (req->deadline_at <= 0) return -1;
+    double left = (req->deadline_at - now_seconds()) * 1000;
+    if (left <= 0) return 0;
+    return left > 1e9 ? 1000000000 : (int)left + 1;
+}
+
+#ifdef __linux__
+
+int direct_supported(const DirectRequest *req)
+{
+    Target target;
+    if (parse_http_url(req->url, &target) != 0) return 0;
+
+    // curl would go through the proxy; so must we, so leave it to curl
+    if (!req->unix_socket && (getenv("http_proxy") || getenv("ALL_PROXY") || getenv("all_proxy")))
+        return 0;
+
+    struct stat st;
+    if (fstat(req->in_fd, &st) != 0) return 0;
+    return S_ISFIFO(st.st_mode) || S_ISREG(st.st_mode);
+}
+
+// Bound the next blocking socket call by what is left of the deadline
+static int apply_deadline(int sock, const DirectRequest *req)
+{
+    int ms = remaining_ms(req);
+    if (ms < 0) return 0;
+    if (ms == 0) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    struct timeval tv = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return 0;
+}
+
+static int connect_target(const DirectRequest *req, const Target *target)
+{
+    if (req->unix_socket) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(req->unix_socket) >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(addr.sun_path, req->unix_socket);
+        int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock < 0) return -1;
+        if (apply_deadline(sock, req) != 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            int saved = errno;
+            close(sock);
+            errno = saved;
+            return -1;
+        }
+        return sock;
+    }
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *addrs = NULL;
+    int rc = getaddrinfo(target->host, target->port, &hints, &addrs);
+    if (rc != 0) {
+        fprintf(stderr, "Error: could not resolve %s: %s\n", target->host, gai_strerror(rc));
+        errno = 0;
+        return -1;
+    }
+    int sock = -1;
+    int saved = ECONNREFUSED;
+    for (struct addrinfo *ai = addrs; ai; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (sock < 0) {
+            saved = errno;
+            continue;
+        }
+        // Linux bounds connect() by the send timeout
+        if (apply_deadline(sock, req) == 0 && connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        saved = errno;
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(addrs);
+    if (sock < 0) {
+        errno = saved;
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+static int send_all(int sock, const char *data, size_t len, int flags)
+{
+    while (len > 0) {
+        ssize_t n = send(sock, data, len, flags | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) errno = ETIMEDOUT;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Build the request head from the same header list the curl path uses
+static int format_head(const DirectRequest *req, const Target *target, char *head, size_t cap, int *expect_continue)
+{
+    size_t len = 0;
+    int n = snprintf(head, cap, "POST %s HTTP/1.1\r\nHost: %s\r\nAccept: */*\r\nConnection: close\r\n",
+                     target->path, target->authority);
+    if (n < 0 || (size_t)n >= cap) return -1;
+    len = (size_t)n;
+
+    *expect_continue = 0;
+    for (const struct curl_slist *h = req->headers; h; h = h->next) {
+        const char *line = h->data;
+        const char *colon = strchr(line, ':');
+        if (!colon) continue;
+        // "Name:" with no value is curl's way of suppressing a header
+        if (colon[1 + strspn(colon + 1, " \t")] == '\0') continue;
+        if (strncasecmp(line, "Expect:", 7) == 0) {
+            *expect_continue = strstr(line, "100-continue") != NULL;
+            if (!*expect_continue) continue;
+        }
+        n = snprintf(head + len, cap - len, "%s\r\n", line);
+        if (n < 0 || (size_t)n >= cap - len) return -1;
+        len += (size_t)n;
+    }
+
+    if (req->body_size >= 0)
+        n = snprintf(head + len, cap - len, "Content-Length: %lld\r\n\r\n", req->body_size);
+    else
+        n = snprintf(head + len, cap - len, "Transfer-Encoding: chunked\r\n\r\n");
+    if (n < 0 || (size_t)n >= cap - len) return -1;
+    return (int)(len + (size_t)n);
+}
+
+static int buffer_recv(int sock, Buffer *buf)
+{
+    if (buf->cap - buf->size < 65536 + 1) {
+        if (buf->cap >= RESPONSE_MAX) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        size_t cap = buf->cap ? buf->cap * 2 : 65536 * 2;
+        char *data = realloc(buf->data, cap);
+        if (!data) return -1;
+        buf->data = data;
+        buf->cap = cap;
+    }
+    for (;;) {
+        ssize_t n = recv(sock, buf->data + buf->size, buf->cap - buf->size - 1, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) errno = ETIMEDOUT;
+        if (n > 0) {
+            buf->size += (size_t)n;
+            buf->data[buf->size] = '\0';
+        }
+        return (int)(n < 0 ? -1 : n > 0);
+    }
+}
+
+// Read until a complete response head is buffered; returns its length
+static int read_head(int sock, const DirectRequest *req, Buffer *buf)
+{
+    for (;;) {
+        char *end = buf->data ? memmem(buf->data, buf->size, "\r\n\r\n", 4) : NULL;
+        if (end) return (int)(end - buf->data) + 4;
+        if (apply_deadline(sock, req) != 0) return -1;
+        int rc = buffer_recv(sock, buf);
+        if (rc <= 0) {
+            if (rc == 0) errno = ECONNRESET;
+            return -1;
+        }
+    }
+}
+
+static long parse_status(const char *head)
+{
+    if (strncmp(head, "HTTP/", 5) != 0) return -1;
+    const char *sp = strchr(head, ' ');
+    return sp ? strtol(sp + 1, NULL, 10) : -1;
+}
+
+// Value of a response header within the head, or NULL
+static const char *find_header(const char *head, size_t head_len, const char *name)
+{
+    size_t name_len = strlen(name);
+    const char *line = memmem(head, head_len, "\r\n", 2);
+    while (line && line + 2 < head + head_len) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':')
+            return line + name_len + 1 + strspn(line + name_len + 1, " \t");
+        line = memmem(line, (size_t)(head + head_len - line), "\r\n", 2);
+    }
+    return NULL;
+}
+
+static size_t decode_chunked(char *data, size_t size)
+{
+    size_t in = 0, out = 0;
+    while (in < size) {
+        char *end = NULL;
+        unsigned long chunk = strtoul(data + in, &end, 16);
+        char *line_end = memmem(data + in, size - in, "\r\n", 2);
+        if (!line_end || end == data + in || chunk == 0) break;
+        in = (size_t)(line_end - data) + 2;
+        if (chunk > size - in) chunk = size - in;
+        memmove(data + out, data + in, chunk);
+        out += chunk;
+        in += chunk + 2;
+    }
+    data[out] = '\0';
+    return out;
+}
+
+// Read the final response, skipping interim 1xx responses
+static int read_response(int sock, const DirectRequest *req, Buffer *buf, DirectResponse *resp)
+{
+    int head_len;
+    long status;
+    for (;;) {
+        head_len = read_head(sock, req, buf);
+        if (head_len < 0) return -1;
+        status = parse_status(buf->data);
+        if (status < 0) {
+            errno = EPROTO;
+            return -1;
+        }
+        if (status >= 200) break;
+        memmove(buf->data, buf->data + head_len, buf->size - (size_t)head_len + 1);
+        buf->size -= (size_t)head_len;
+    }
+
+    const char *length = find_header(buf->data, (size_t)head_len, "Content-Length");
+    const char *encoding = find_header(buf->data, (size_t)head_len, "Transfer-Encoding");
+    int chunked = encoding && strncasecmp(encoding, "chunked", 7) == 0;
+    long long expected = length && !chunked ? strtoll(length, NULL, 10) : -1;
+
+    for (;;) {
+        size_t have = buf->size - (size_t)head_len;
+        if (expected >= 0 && (long long)have >= expected) break;
+        if (chunked && have >= 5 && memcmp(buf->data + buf->size - 5, "0\r\n\r\n", 5) == 0) break;
+        if (apply_deadline(sock, req) != 0) return -1;
+        int rc = buffer_recv(sock, buf);
+        if (rc < 0) return -1;
+        if (rc == 0) break;
+    }
+
+    size_t body_size = buf->size - (size_t)head_len;
+    if (expected >= 0 && (long long)body_size > expected) body_size = (size_t)expected;
+    resp->status = status;
+    resp->body = malloc(body_size + 1);
+    if (!resp->body) return -1;
+    memcpy(resp->body, buf->data + head_len, body_size);
+    resp->body[body_size] = '\0';
+    resp->body_size = chunked ? decode_chunked(resp->body, body_size) : body_size;
+    return 0;
+}
+
+static int send_file_body(int sock, const DirectRequest *req)
+{
+    off_t offset = lseek(req->in_fd, 0, SEEK_CUR);
+    if (offset < 0) offset = 0;
+    long long left = req->body_size;
+    while (left > 0) {
+        if (apply_deadline(sock, req) != 0) return -1;
+        size_t count = left > FILE_SEND_MAX ? (size_t)FILE_SEND_MAX : (size_t)left;
+        ssize_t n = sendfile(sock, req->in_fd, &offset, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) errno = ETIMEDOUT;
+            return -1;
+        }
+        if (n == 0) {
+            fprintf(stderr, "Error: input shrank while uploading\n");
+            errno = 0;
+            return -1;
+        }
+        left -= n;
+    }
+    lseek(req->in_fd, offset, SEEK_SET);
+    return 0;
+}
+
+// Move exactly `count` bytes that are already waiting in the pipe
+static int move_from_pipe(int sock, const DirectRequest *req, size_t count, int *copy, char **scratch)
+{
+    while (count > 0) {
+        ssize_t n;
+        if (!*copy) {
+            n = splice(req->in_fd, NULL, sock, NULL, count, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n < 0 && errno == EINVAL) {
+                // Not every socket family takes spliced pages; copy instead
+                *copy = 1;
+                if (req->verbose)
+                    fprintf(stderr, "[*] splice() not supported here, copying\n");
+                continue;
+            }
+        } else {
+            if (!*scratch && !(*scratch = malloc(CHUNK_MAX))) return -1;
+            n = read(req->in_fd, *scratch, count > CHUNK_MAX ? CHUNK_MAX : count);
+            if (n > 0 && send_all(sock, *scratch, (size_t)n, MSG_MORE) != 0) return -1;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) errno = ETIMEDOUT;
+            return -1;
+        }
+        if (n == 0) {
+            errno = EPIPE;
+            return -1;
+        }
+        count -= (size_t)n;
+    }
+    return 0;
+}
+
+// Send a pipe as chunked encoding. Each chunk is whatever the pipe holds at
+// that moment, so its size is known before the data is spliced.
+static int send_pipe_body(int sock, const DirectRequest *req)
+{
+    int copy = 0;
+    char *scratch = NULL;
+    int rc = -1;
+
+    // Bigger pipe, fewer and larger chunks; best effort
+    fcntl(req->in_fd, F_SETPIPE_SZ, CHUNK_MAX);
+
+    for (;;) {
+        int avail = 0;
+        if (ioctl(req->in_fd, FIONREAD, &avail) != 0) goto out;
+        if (avail == 0) {
+            struct pollfd pfd = { .fd = req->in_fd, .events = POLLIN };
+            int ready = poll(&pfd, 1, remaining_ms(req));
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready < 0) goto out;
+            if (ready == 0) {
+                errno = ETIMEDOUT;
+                goto out;
+            }
+            if (ioctl(req->in_fd, FIONREAD, &avail) != 0) goto out;
+            if (avail == 0) break; // writer closed
+        }
+        if (apply_deadline(sock, req) != 0) goto out;
+        size_t count = avail > CHUNK_MAX ? CHUNK_MAX : (size_t)avail;
+        char line[32];
+        int len = snprintf(line, sizeof(line), "%zx\r\n", count);
+        if (send_all(sock, line, (size_t)len, MSG_MORE) != 0) goto out;
+        if (move_from_pipe(sock, req, count, &copy, &scratch) != 0) goto out;
+        if (send_all(sock, "\r\n", 2, MSG_MORE) != 0) goto out;
+    }
+    rc = send_all(sock, "0\r\n\r\n", 5, 0);
+out:
+    free(scratch);
+    return rc;
+}
+
+int direct_upload(const DirectRequest *req, DirectResponse *resp)
+{
+    Target target;
+    Buffer buf = {0};
+    char head[HEAD_SIZE];
+    int expect_continue = 0;
+    int result = DIRECT_ERROR;
+    int sock = -1;
+
+    memset(resp, 0, sizeof(*resp));
+    if (parse_http_url(req->url, &target) != 0) {
+        fprintf(stderr, "Error: unsupported URL for direct upload: %s\n", req->url);
+        return DIRECT_ERROR;
+    }
+    int head_len = format_head(req, &target, head, sizeof(head), &expect_continue);
+    if (head_len < 0) {
+        fprintf(stderr, "Error: request headers too long\n");
+        return DIRECT_ERROR;
+    }
+
+    // A server that closes early must not kill us in the middle of sendfile()
+    signal(SIGPIPE, SIG_IGN);
+
+    sock = connect_target(req, &target);
+    if (sock < 0) {
+        if (errno == ETIMEDOUT || errno == EAGAIN || errno == EINPROGRESS) {
+            result = DIRECT_TIMEOUT;
+        } else if (errno) {
+            fprintf(stderr, "Error: could not connect to %s: %s\n",
+                    req->unix_socket ? req->unix_socket : target.authority, strerror(errno));
+        }
+        return result;
+    }
+    if (req->verbose)
+        fprintf(stderr, "[*] Direct upload via %s\n", req->body_size >= 0 ? "sendfile()" : "splice()");
+
+    // MSG_MORE holds the head back until the body follows; with Expect the
+    // server has to see it right away
+    if (apply_deadline(sock, req) != 0 ||
+        send_all(sock, head, (size_t)head_len, expect_continue ? 0 : MSG_MORE) != 0)
+        goto failed;
+
+    if (expect_continue) {
+        // Send the body only once the server accepts the headers, or after
+        // a short wait in case it ignores Expect
+        int wait = remaining_ms(req);
+        if (wait < 0 || wait > CONTINUE_WAIT_MS) wait = CONTINUE_WAIT_MS;
+        struct pollfd pfd = { .fd = sock, .events = POLLIN };
+        if (poll(&pfd, 1, wait) > 0) {
+            int interim = read_head(sock, req, &buf);
+            if (interim < 0) goto failed;
+            if (parse_status(buf.data) != 100) {
+                if (read_response(sock, req, &buf, resp) != 0) goto failed;
+                result = DIRECT_OK;
+                goto done;
+            }
+            buf.size -= (size_t)interim;
+            memmove(buf.data, buf.data + interim, buf.size + 1);
+        }
+    }
+
+    int sent = req->body_size >= 0 ? send_file_body(sock, req) : send_pipe_body(sock, req);
+    if (sent != 0 && errno != EPIPE && errno != ECONNRESET)
+        goto failed;
+    // After EPIPE the server may still have said why it stopped reading
+    if (read_response(sock, req, &buf, resp) != 0)
+        goto failed;
+    result = DIRECT_OK;
+    goto done;
+
+failed:
+    if (errno == ETIMEDOUT) {
+        result = DIRECT_TIMEOUT;
+    } else if (errno) {
+        fprintf(stderr, "Error: upload failed: %s\n", strerror(errno));
+    }
+done:
+    free(buf.data);
+    close(sock);
+    return result;
+}
+
+#else
+
+int direct_supported(const DirectRequest *req)
+{
+    (void)req;
+    (void)remaining_ms;
+    (void)parse_http_url;
+    return 0;
+}
+
+int direct_upload(const DirectRequest *req, DirectResponse *resp)
+{
+    (void)req;
+    memset(resp, 0, sizeof(*resp));
+    return DIRECT_ERROR;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef PPB_DIRECT_H
+#define PPB_DIRECT_H
+
+#include <stddef.h>
+#include <curl/curl.h>
+
+// Outcome of direct_upload()
+enum {
+    DIRECT_OK = 0,
+    DIRECT_ERROR,     // failed; a message has been printed
+    DIRECT_TIMEOUT,   // the deadline ran out
+};
+
+typedef struct {
+    const char *url;            // http:// URL; https needs curl
+    const char *unix_socket;    // connect here instead of the URL's host, or NULL
+    const struct curl_slist *headers; // same list the curl path would send
+    int in_fd;                  // request body: a pipe or a regular file
+    long long body_size;        // bytes left in a regular file, -1 for a pipe
+    double deadline_at;         // monotonic time to give up at, 0 for none
+    int verbose;
+} DirectRequest;
+
+typedef struct {
+    long status;
+    char *body;                 // NUL-terminated, caller frees
+    size_t body_size;
+} DirectResponse;
+
+// Whether direct_upload() can handle this request; if not, use curl.
+// Nothing is read from in_fd until direct_upload() is called.
+int direct_supported(const DirectRequest *req);
+
+// Send the request head itself, then move the body from in_fd to the socket
+// with splice(2) (pipes) or sendfile(2) (files), without copying it through
+// userspace.
+int direct_upload(const DirectRequest *req, DirectResponse *resp);
+
+#endif
@@ -0,0 +1,49 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "group.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static uint64_t fnv1a(uint64_t h, const char *p, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ (unsigned char)p[i]) * 0x100000001b3ull;
+    return h;
+}
+
+// splitmix64 finalizer, so similar names and keys give unrelated scores
+static uint64_t mix(uint64_t h)
+{
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+size_t group_owner(const MirrorTarget *members, size_t count, const char *key)
+{
+    size_t owner = 0;
+    uint64_t best = 0;
+    size_t key_len = strnlen(key, GROUP_KEY_SIZE);
+    for (size_t i = 0; i < count; i++) {
+        // Scored by name, not URL, so a member can move without remapping
+        uint64_t h = fnv1a(0xcbf29ce484222325ull, members[i].name, strlen(members[i].name) + 1);
+        uint64_t score = mix(fnv1a(h, key, key_len));
+        if (i == 0 || score > best) {
+            best = score;
+            owner = i;
+        }
+    }
+    return owner;
+}
+
+int group_raw_url(const char *upload_url, const char *id, char *out, size_t cap)
+{
+    // https://host/upload -> https://host/raw/<id>
+    const char *scheme = strstr(upload_url, "://");
+    const char *path = strchr(scheme ? scheme + 3 : upload_url, '/');
+    size_t base = path ? (size_t)(strrchr(upload_url, '/') - upload_url) : strlen(upload_url);
+    int n = snprintf(out, cap, "%.*s/raw/%s", (int)base, upload_url, id);
+    return n < 0 || (size_t)n >= cap ? -1 : 0;
+}
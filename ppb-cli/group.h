@@ -0,0 +1,22 @@
+#ifndef PPB_GROUP_H
+#define PPB_GROUP_H
+
+#include <stddef.h>
+
+#include "mirror.h"
+
+// A server group shares one content-addressed store: each paste lives on
+// the member chosen by rendezvous (highest random weight) hashing of its
+// short id, so uploads and reads agree on the owner without a router.
+// Adding a member moves only the pastes it now wins, about 1/n of them.
+
+#define GROUP_KEY_SIZE 16       // hex digits of the checksum, the server's short id
+
+// Index of the member that owns key
+size_t group_owner(const MirrorTarget *members, size_t count, const char *key);
+
+// URL of a paste on a server, derived from its upload URL; -1 if it does
+// not fit
+int group_raw_url(const char *upload_url, const char *id, char *out, size_t cap);
+
+#endif
@@ -0,0 +1,318 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mirror.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vendor/cJSON.h"
+
+#define READ_CHUNK (256 * 1024)
+#define RESPONSE_MAX (1024 * 1024)
+#define AUTH_SIZE 1024
+#define STALL_SECONDS 5.0
+
+typedef struct Leg Leg;
+
+typedef struct {
+    MirrorUpload *up;
+    Leg *legs;
+
+    // Window: input bytes [base, base + len) of the stream
+    char *buf;
+    size_t cap;
+    unsigned long long base;
+    size_t len;
+    int eof;
+    int failed;
+    Sha256 sha;
+    char checksum[SHA256_HEX_SIZE];
+} Shared;
+
+struct Leg {
+    Shared *shared;
+    MirrorTarget *target;
+    CURL *easy;
+    struct curl_slist *headers;
+    unsigned long long offset;  // next input byte to send
+    int active;
+    int paused;
+    double moved_at;            // when offset last advanced
+    char *body;
+    size_t body_size;
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Lowest offset any mirror still sending has reached
+static unsigned long long slowest(const Shared *s)
+{
+    unsigned long long low = s->base + s->len;
+    for (size_t i = 0; i < s->up->count; i++) {
+        if (s->legs[i].active && s->legs[i].offset < low) low = s->legs[i].offset;
+    }
+    return low;
+}
+
+// Read more input into the window; returns 0 if there is no room until the
+// slowest mirror catches up
+static int fill(Shared *s)
+{
+    size_t done = (size_t)(slowest(s) - s->base);
+    if (done > 0) {
+        memmove(s->buf, s->buf + done, s->len - done);
+        s->base += done;
+        s->len -= done;
+    }
+    if (s->len == s->cap) {
+        if (s->cap >= MIRROR_WINDOW) return 0;
+        size_t cap = s->cap ? s->cap * 2 : READ_CHUNK;
+        char *buf = realloc(s->buf, cap);
+        if (!buf) {
+            fprintf(stderr, "Error: not enough memory for mirroring\n");
+            s->failed = 1;
+            return 1;
+        }
+        s->buf = buf;
+        s->cap = cap;
+    }
+
+    size_t room = s->cap - s->len;
+    ssize_t got = s->up->source(s->up->source_ctx, s->buf + s->len, room < READ_CHUNK ? room : READ_CHUNK);
+    if (got < 0) {
+        s->failed = 1;
+        return 1;
+    }
+    sha256_update(&s->sha, s->buf + s->len, (size_t)got);
+    s->len += (size_t)got;
+    // With a known size curl stops reading at the last byte, before EOF
+    if (got == 0 || (s->up->body_size >= 0 && s->base + s->len >= (unsigned long long)s->up->body_size)) {
+        s->eof = 1;
+        sha256_final_hex(&s->sha, s->checksum);
+    }
+    return 1;
+}
+
+static size_t read_callback(char *dest, size_t size, size_t nmemb, void *userp)
+{
+    Leg *leg = (Leg *)userp;
+    Shared *s = leg->shared;
+    size_t want = size * nmemb;
+
+    for (;;) {
+        unsigned long long end = s->base + s->len;
+        if (leg->offset < end) {
+            size_t n = (size_t)(end - leg->offset) < want ? (size_t)(end - leg->offset) : want;
+            memcpy(dest, s->buf + (leg->offset - s->base), n);
+            leg->offset += n;
+            leg->moved_at = now_seconds();
+            return n;
+        }
+        if (s->failed) return CURL_READFUNC_ABORT;
+        if (s->eof) return 0;
+        if (!fill(s)) {
+            leg->paused = 1;
+            return CURL_READFUNC_PAUSE;
+        }
+    }
+}
+
+static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    Leg *leg = (Leg *)userp;
+    size_t n = size * nmemb;
+    if (leg->body_size + n > RESPONSE_MAX) return 0;
+    char *body = realloc(leg->body, leg->body_size + n + 1);
+    if (!body) return 0;
+    memcpy(body + leg->body_size, contents, n);
+    leg->body = body;
+    leg->body_size += n;
+    body[leg->body_size] = '\0';
+    return n;
+}
+
+static int checksum_matches(const char *body, const char *checksum)
+{
+    cJSON *root = body ? cJSON_ParseLazy(body, strlen(body)) : NULL;
+    cJSON *meta = cJSON_GetObjectItemCaseSensitive(root, "meta");
+    cJSON *sum = cJSON_GetObjectItemCaseSensitive(meta, "checksum");
+    const char *value = cJSON_GetStringValue(sum);
+    int match = value && strcmp(value, checksum) == 0;
+    cJSON_Delete(root);
+    return match;
+}
+
+static int start_leg(Leg *leg, CURLM *multi)
+{
+    const MirrorUpload *up = leg->shared->up;
+    char auth[AUTH_SIZE];
+    snprintf(auth, sizeof(auth), "Authorization: Bearer %s", leg->target->token);
+    leg->headers = curl_slist_append(NULL, auth);
+    for (const struct curl_slist *h = up->headers; h && leg->headers; h = h->next) {
+        struct curl_slist *headers = curl_slist_append(leg->headers, h->data);
+        if (!headers) {
+            curl_slist_free_all(leg->headers);
+            leg->headers = NULL;
+        }
+        leg->headers = headers;
+    }
+    leg->easy = curl_easy_init();
+    if (!leg->headers || !leg->easy) return -1;
+
+    CURL *easy = leg->easy;
+    curl_easy_setopt(easy, CURLOPT_URL, leg->target->url);
+    curl_easy_setopt(easy, CURLOPT_POST, 1L);
+    curl_easy_setopt(easy, CURLOPT_READFUNCTION, read_callback);
+    curl_easy_setopt(easy, CURLOPT_READDATA, (void *)leg);
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, (void *)leg);
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, leg->headers);
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, (void *)leg);
+    if (up->body_size >= 0)
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)up->body_size);
+    if (up->unix_socket)
+        curl_easy_setopt(easy, CURLOPT_UNIX_SOCKET_PATH, up->unix_socket);
+    if (up->timeout_ms > 0) {
+        curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, up->timeout_ms);
+        curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, up->timeout_ms);
+    }
+    if (curl_multi_add_handle(multi, easy) != CURLM_OK) return -1;
+    leg->active = 1;
+    leg->moved_at = now_seconds();
+    return 0;
+}
+
+static void finish_leg(Leg *leg, CURLM *multi, CURLcode result)
+{
+    MirrorTarget *target = leg->target;
+    curl_multi_remove_handle(multi, leg->easy);
+    leg->active = 0;
+    target->error = result;
+    if (result == CURLE_OK)
+        curl_easy_getinfo(leg->easy, CURLINFO_RESPONSE_CODE, &target->status);
+    target->response = leg->body;
+    leg->body = NULL;
+    // Success means the whole body went out, so the checksum is final
+    target->acked = result == CURLE_OK && target->status >= 200 && target->status < 300 &&
+                    leg->shared->eof && checksum_matches(target->response, leg->shared->checksum);
+}
+
+int mirror_upload(MirrorUpload *up, char checksum[SHA256_HEX_SIZE])
+{
+    Shared shared = {.up = up};
+    sha256_init(&shared.sha);
+    shared.legs = calloc(up->count, sizeof(*shared.legs));
+    CURLM *multi = curl_multi_init();
+    int acks = -1;
+    if (!shared.legs || !multi) {
+        fprintf(stderr, "Error: not enough memory for mirroring\n");
+        goto done;
+    }
+
+    for (size_t i = 0; i < up->count; i++) {
+        Leg *leg = &shared.legs[i];
+        leg->shared = &shared;
+        leg->target = &up->targets[i];
+        if (start_leg(leg, multi) != 0) {
+            fprintf(stderr, "Error: failed to initialize CURL\n");
+            goto done;
+        }
+    }
+
+    acks = 0;
+    int running = 1;
+    while (running) {
+        curl_multi_perform(multi, &running);
+
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            char *private = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &private);
+            Leg *leg = (Leg *)private;
+            finish_leg(leg, multi, msg->data.result);
+            if (leg->target->acked) acks++;
+        }
+
+        if ((size_t)acks >= up->quorum && up->cancel_stragglers) {
+            for (size_t i = 0; i < up->count; i++) {
+                Leg *leg = &shared.legs[i];
+                if (!leg->active) continue;
+                curl_multi_remove_handle(multi, leg->easy);
+                leg->active = 0;
+                leg->target->cancelled = 1;
+            }
+            break;
+        }
+
+        // With the window full, a mirror that has stopped taking data holds
+        // everyone else back; give up on it after a while
+        int blocked = 0;
+        for (size_t i = 0; i < up->count; i++)
+            blocked |= shared.legs[i].active && shared.legs[i].paused;
+        if (blocked) {
+            unsigned long long low = slowest(&shared);
+            double now = now_seconds();
+            for (size_t i = 0; i < up->count; i++) {
+                Leg *leg = &shared.legs[i];
+                if (!leg->active || leg->offset != low || now - leg->moved_at < STALL_SECONDS) continue;
+                curl_multi_remove_handle(multi, leg->easy);
+                leg->active = 0;
+                leg->target->stalled = 1;
+            }
+        }
+
+        // A mirror that ran out of window goes on once the slowest one has
+        // freed a read's worth of it
+        int room = slowest(&shared) - shared.base >= READ_CHUNK;
+        for (size_t i = 0; i < up->count; i++) {
+            Leg *leg = &shared.legs[i];
+            if (!leg->active || !leg->paused) continue;
+            if (room || leg->offset < shared.base + shared.len || shared.eof || shared.failed) {
+                leg->paused = 0;
+                curl_easy_pause(leg->easy, CURLPAUSE_CONT);
+            }
+        }
+
+        if (running)
+            curl_multi_wait(multi, NULL, 0, 100, NULL);
+    }
+    if (shared.failed) acks = -1;
+
+done:
+    if (shared.eof)
+        memcpy(checksum, shared.checksum, SHA256_HEX_SIZE);
+    else
+        checksum[0] = '\0';
+    for (size_t i = 0; shared.legs && i < up->count; i++) {
+        Leg *leg = &shared.legs[i];
+        if (leg->active) curl_multi_remove_handle(multi, leg->easy);
+        if (leg->easy) curl_easy_cleanup(leg->easy);
+        curl_slist_free_all(leg->headers);
+        free(leg->body);
+    }
+    free(shared.legs);
+    free(shared.buf);
+    if (multi) curl_multi_cleanup(multi);
+    return acks;
+}
+
+void mirror_targets_free(MirrorTarget *targets, size_t count)
+{
+    if (!targets) return;
+    for (size_t i = 0; i < count; i++) {
+        free(targets[i].name);
+        free(targets[i].url);
+        free(targets[i].token);
+        free(targets[i].response);
+    }
+    free(targets);
+}
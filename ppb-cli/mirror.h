@@ -0,0 +1,56 @@
+#ifndef PPB_MIRROR_H
+#define PPB_MIRROR_H
+
+#include <curl/curl.h>
+#include <sys/types.h>
+
+#include "sha256.h"
+
+// Fan-out upload: the input is read once into a shared window and sent to
+// every mirror over concurrent connections. A mirror acknowledges when it
+// answers 2xx with the checksum of exactly what was sent.
+//
+// The window holds what the slowest mirror has not sent yet, up to
+// MIRROR_WINDOW; a mirror that gets that far ahead waits for the others.
+// One that takes no data for a few seconds meanwhile is dropped.
+
+#define MIRROR_WINDOW (16 * 1024 * 1024)
+
+// Fills dest with up to cap bytes of input; 0 at the end, -1 on error
+typedef ssize_t (*MirrorSource)(void *ctx, char *dest, size_t cap);
+
+typedef struct {
+    char *name;                 // as given to --mirror; all three owned
+    char *url;
+    char *token;
+
+    // Outcome
+    long status;                // HTTP status, 0 if there was no response
+    CURLcode error;
+    int acked;                  // 2xx with a matching checksum
+    int cancelled;              // stopped after the quorum was reached
+    int stalled;                // dropped for holding the others back
+    char *response;             // NUL-terminated body, or NULL
+} MirrorTarget;
+
+typedef struct {
+    MirrorTarget *targets;
+    size_t count;
+    size_t quorum;
+    int cancel_stragglers;      // stop the others once the quorum has acked
+    MirrorSource source;
+    void *source_ctx;
+    const struct curl_slist *headers;   // sent to every mirror, besides Authorization
+    long long body_size;        // -1 when unknown
+    const char *unix_socket;
+    long timeout_ms;            // 0: no limit
+} MirrorUpload;
+
+// Returns the number of mirrors that acknowledged, or -1 if the input could
+// not be read or memory ran out. checksum gets the digest of the input.
+int mirror_upload(MirrorUpload *up, char checksum[SHA256_HEX_SIZE]);
+
+// Frees the strings and responses too
+void mirror_targets_free(MirrorTarget *targets, size_t count);
+
+#endif
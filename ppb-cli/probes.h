@@ -0,0 +1,40 @@
+#ifndef PPB_PROBES_H
+#define PPB_PROBES_H
+
+// USDT tracepoints, provider "ppb", for tracing a production put with
+// bpftrace or perf without rebuilding it (see trace/). Built in when
+// compiled with -DPPB_USDT (make USDT=1, the default) and <sys/sdt.h> is
+// installed (systemtap-sdt-dev, systemtap-sdt-devel); no-ops otherwise. An
+// idle probe is a single nop. Strings are passed as pointers.
+//
+//   config__start(path)                  config__done(path, found)
+//   read__chunk(bytes)                   bytes handed to the upload; 0 at the end, -1 on error
+//   transfer__start(url, body_size)      body_size -1 when chunked
+//   transfer__phases(dns, connect, tls, pretransfer, first_byte, total)
+//                                        curl's timings, in microseconds from the start
+//   transfer__done(curl_code, http_status)
+//   direct__start(url, body_size)        direct__done(result, http_status)
+//   response__chunk(bytes)               response__done(http_status, bytes)
+//   cjson__parse__start(text, length)    cjson__parse__done(ok, bytes_parsed)
+//   cjson__print__start(formatted)       cjson__print__done(length)
+
+#if defined(PPB_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PPB_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef PPB_HAVE_USDT
+#define PPB_PROBE1(name, a) DTRACE_PROBE1(ppb, name, a)
+#define PPB_PROBE2(name, a, b) DTRACE_PROBE2(ppb, name, a, b)
+#define PPB_PROBE6(name, a, b, c, d, e, f) DTRACE_PROBE6(ppb, name, a, b, c, d, e, f)
+#else
+// Arguments are not evaluated, but still count as used
+#define PPB_PROBE1(name, a) do { (void)sizeof(a); } while (0)
+#define PPB_PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define PPB_PROBE6(name, a, b, c, d, e, f) \
+    do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d); (void)sizeof(e); (void)sizeof(f); } while (0)
+#endif
+
+#endif
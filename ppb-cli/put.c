@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <curl/curl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,21 +8,55 @@
 #include <getopt.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <poll.h>
 #include <stdbool.h>
+#include <time.h>
 
 #include "vendor/cJSON.h"
+#include "direct.h"
+#include "redact.h"
+#include "compact.h"
+#include "mirror.h"
+#include "group.h"
+#include "spool.h"
+#include "probes.h"
+#include "snapshot.h"
+#include "batch.h"
 
 #define CONFIG_SIZE 65536
 #define URL_SIZE 512
 #define TOKEN_SIZE 512
+#define GROUP_SIZE 64
+#define DEADLINE_HEADER "X-PPB-Deadline-Ms"
+#define EXPECT_CONTINUE_MIN (1024 * 1024) // known-size bodies from here on wait for 100 Continue
+#define SPOOL_MEMORY (8 * 1024 * 1024)      // piped input kept in memory before spilling to a file
+#define SPOOL_LIMIT (100LL * 1024 * 1024)   // and spooled at most, the server's upload limit
+#define BATCH_CONNECTIONS 8                 // uploads in flight at once for file arguments
 
 typedef struct {
     char url[URL_SIZE];
     char token[TOKEN_SIZE];
     int verbose;
     int show_response;
+    int redact;
+    char *redact_config;   // "redact" object from the config file, as JSON text
+    int compact;
+    CompactKeep compact_keep;
+    int compact_fuzzy;
+    char group[GROUP_SIZE];  // server group to shard uploads over, or ""
+    int spool;
+    size_t spool_memory;
+    long long spool_limit;
 } Config;
 
+// What stdin goes through before upload; any may be NULL
+typedef struct {
+    Redactor *redactor;
+    Compactor *compactor;
+    Spool *spool;           // filtered input read ahead, replayed first
+    double deadline_at;     // monotonic time stdin must have ended by, 0: none
+} InputFilters;
+
 typedef struct {
     char *data;
     size_t size;
@@ -37,6 +73,7 @@ static size_t write_callback(void *contents, size_t size, size_t nmemb, void *us
 {
     size_t realsize = size * nmemb;
     ResponseBuffer *mem = (ResponseBuffer *)userp;
+    PPB_PROBE1(response__chunk, realsize);
     char *ptr = realloc(mem->data, mem->size + realsize + 1);
     
     if (!ptr) {
@@ -53,13 +90,31 @@ static size_t write_callback(void *contents, size_t size, size_t nmemb, void *us
 }
 
 void print_help(const char *prog) {
-    printf("Usage: %s [OPTIONS]\n\n", prog);
+    printf("Usage: %s [OPTIONS]\n", prog);
+    printf("       %s get <ID> [OPTIONS]\n", prog);
+    printf("       %s [OPTIONS] FILE...\n\n", prog);
     printf("Options:\n");
     printf("  --url <URL>          Override server URL\n");
     printf("  --token <TOKEN>      Override auth token\n");
     printf("  --server <NAME>      Use server config by name\n");
     printf("  --config <PATH>      Use custom config file\n");
     printf("  --init-config        Write default config then exit\n");
+    printf("  --deadline <SECONDS> Give up if the upload takes longer than this\n");
+    printf("  --unix-socket <PATH> Connect to the server through a Unix socket\n");
+    printf("  --no-splice          Always upload through curl\n");
+    printf("  --redact             Mask tokens, keys and passwords before uploading\n");
+    printf("  --no-redact          Upload as is, even if the config enables --redact\n");
+    printf("  --compact            Collapse runs of repeated lines into one plus a count\n");
+    printf("  --no-compact         Keep repeated lines, even if the config enables --compact\n");
+    printf("  --compact-keep <WHICH> Lines of a run to keep: first, last or both\n");
+    printf("  --compact-fuzzy      Lines differing only in numbers count as repeats\n");
+    printf("  --mirror <LIST>      Upload to several servers at once (names or URLs, comma-separated)\n");
+    printf("  --quorum <N>         Succeed once N mirrors have stored the upload (default: all)\n");
+    printf("  --cancel-stragglers  Stop the remaining mirrors once the quorum is reached\n");
+    printf("  --group <NAME>       Upload to the member of a server group that owns the content\n");
+    printf("  --no-spool           Stream piped input as it arrives instead of reading it first\n");
+    printf("  --spool              Read piped input first, even if the config disables it\n");
+    printf("  --files-from <PATH>  Upload the files listed in PATH, one per line (- for stdin)\n");
     printf("  -v, --verbose        Verbose output\n");
     printf("  -r, --response       Show server response\n");
     printf("  -h, --help           Show this help message\n\n");
@@ -74,6 +129,131 @@ void print_help(const char *prog) {
     printf("\nPrecedence: CLI > env > config > defaults.\n");
 }
 
+static void free_filters(InputFilters *filters)
+{
+    redactor_free(filters->redactor);
+    compactor_free(filters->compactor);
+    spool_free(filters->spool);
+}
+
+static void report_filters(const InputFilters *filters, int verbose)
+{
+    if (filters->redactor && verbose)
+        fprintf(stderr, "[*] Redacted %lu secrets\n", redactor_count(filters->redactor));
+    if (filters->compactor && verbose)
+        fprintf(stderr, "[*] Compacted away %lu repeated lines\n", compactor_dropped(filters->compactor));
+}
+
+static double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Up to cap bytes of stdin; 0 at the end, -1 on error or once the
+// deadline has passed
+static ssize_t read_stdin(const InputFilters *filters, char *dest, size_t cap)
+{
+    for (;;) {
+        if (filters->deadline_at > 0) {
+            double left = (filters->deadline_at - monotonic_seconds()) * 1000;
+            struct pollfd pfd = {.fd = fileno(stdin), .events = POLLIN};
+            int ready = left > 0 ? poll(&pfd, 1, left > 1e9 ? 1000000000 : (int)left + 1) : 0;
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready == 0) {
+                fprintf(stderr, "Error: deadline exceeded while reading input\n");
+                return -1;
+            }
+        }
+        ssize_t got = read(fileno(stdin), dest, cap);
+        if (got >= 0 || errno != EINTR) {
+            if (got < 0)
+                fprintf(stderr, "Error: could not read input: %s\n", strerror(errno));
+            return got;
+        }
+    }
+}
+
+// Up to cap bytes of redacted input; 0 at the end, -1 on error
+static ssize_t read_redacted(InputFilters *filters, char *dest, size_t cap)
+{
+    Redactor *redactor = filters->redactor;
+    for (;;) {
+        size_t ready = 0;
+        const char *out = redactor_output(redactor, &ready);
+        if (ready > 0) {
+            size_t n = ready < cap ? ready : cap;
+            memcpy(dest, out, n);
+            redactor_consume(redactor, n);
+            return (ssize_t)n;
+        }
+        if (redactor_finished(redactor)) return 0;
+
+        size_t space_cap = 0;
+        char *space = redactor_buffer(redactor, &space_cap);
+        ssize_t got = read_stdin(filters, space, space_cap);
+        if (got < 0) return -1;
+        if (got == 0) {
+            redactor_finish(redactor);
+        } else if (redactor_commit(redactor, (size_t)got) != 0) {
+            fprintf(stderr, "Error: not enough memory for redaction\n");
+            return -1;
+        }
+    }
+}
+
+static ssize_t read_compacted(InputFilters *filters, char *dest, size_t cap)
+{
+    Compactor *compactor = filters->compactor;
+    for (;;) {
+        size_t ready = 0;
+        const char *out = compactor_output(compactor, &ready);
+        if (ready > 0) {
+            size_t n = ready < cap ? ready : cap;
+            memcpy(dest, out, n);
+            compactor_consume(compactor, n);
+            return (ssize_t)n;
+        }
+        if (compactor_finished(compactor)) return 0;
+
+        size_t space_cap = 0;
+        char *space = compactor_buffer(compactor, &space_cap);
+        ssize_t got = filters->redactor ? read_redacted(filters, space, space_cap)
+                                        : read_stdin(filters, space, space_cap);
+        if (got < 0) return -1;
+        int rc = got == 0 ? compactor_finish(compactor) : compactor_commit(compactor, (size_t)got);
+        if (rc != 0) {
+            fprintf(stderr, "Error: not enough memory for compaction\n");
+            return -1;
+        }
+    }
+}
+
+// stdin through the redactor, then the compactor
+static ssize_t read_filtered(void *ctx, char *dest, size_t cap)
+{
+    InputFilters *filters = (InputFilters *)ctx;
+    if (filters->compactor) return read_compacted(filters, dest, cap);
+    if (filters->redactor) return read_redacted(filters, dest, cap);
+    return read_stdin(filters, dest, cap);
+}
+
+// Input as uploaded: what was spooled, then the rest of read_filtered()
+static ssize_t read_input(void *ctx, char *dest, size_t cap)
+{
+    InputFilters *filters = (InputFilters *)ctx;
+    ssize_t n = filters->spool ? spool_read(filters->spool, dest, cap) : read_filtered(ctx, dest, cap);
+    PPB_PROBE1(read__chunk, n);
+    return n;
+}
+
+static size_t filter_read_callback(char *dest, size_t size, size_t nmemb, void *userp)
+{
+    ssize_t n = read_input(userp, dest, size * nmemb);
+    return n < 0 ? CURL_READFUNC_ABORT : (size_t)n;
+}
+
 char *get_config_path(const char *custom_path) {
     static char path[512];
     char *home = getenv("HOME");
@@ -192,75 +372,637 @@ static int write_default_config(const char *config_path, int verbose)
     return 0;
 }
 
-// Simple JSON value extractor - avoid full JSON parsing
-static char *read_entire_file(const char *path, size_t max_bytes, size_t *out_len)
+// The config file, from its snapshot when that is current; with
+// PPB_CONFIG_SNAPSHOT=0 the JSON is always parsed
+static int load_config_file(const char *config_path, ConfigSnapshot *conf)
 {
-    FILE *f = fopen(path, "rb");
-    if (!f) return NULL;
-    struct stat st;
-    if (stat(path, &st) != 0) { fclose(f); return NULL; }
-    if ((size_t)st.st_size > max_bytes) { fclose(f); return NULL; }
-    size_t len = (size_t)st.st_size;
-    char *buf = (char *)malloc(len + 1);
-    if (!buf) { fclose(f); return NULL; }
-    size_t n = fread(buf, 1, len, f);
-    fclose(f);
-    buf[n] = '\0';
-    if (out_len) *out_len = n;
-    return buf;
+    const char *env = getenv("PPB_CONFIG_SNAPSHOT");
+    return snapshot_load(config_path, CONFIG_SIZE, !(env && strcmp(env, "0") == 0), conf);
+}
+
+static void apply_server(const SnapshotServer *server, Config *cfg)
+{
+    if (server->url) copy_string(cfg->url, URL_SIZE, server->url);
+    if (server->token) copy_string(cfg->token, TOKEN_SIZE, server->token);
 }
 
-static void apply_server_object(cJSON *server_obj, Config *cfg)
+static long json_long(const cJSON *obj, const char *name, long fallback)
 {
-    cJSON *url = cJSON_GetObjectItemCaseSensitive(server_obj, "url");
-    cJSON *token = cJSON_GetObjectItemCaseSensitive(server_obj, "token");
-    if (cJSON_IsString(url) && url->valuestring) copy_string(cfg->url, URL_SIZE, url->valuestring);
-    if (cJSON_IsString(token) && token->valuestring) copy_string(cfg->token, TOKEN_SIZE, token->valuestring);
+    cJSON *item = cJSON_GetObjectItemCaseSensitive(obj, name);
+    return cJSON_IsNumber(item) ? (long)cJSON_GetNumberValue(item) : fallback;
+}
+
+static int json_bool(const cJSON *obj, const char *name, int fallback)
+{
+    cJSON *item = cJSON_GetObjectItemCaseSensitive(obj, name);
+    if (item && (item->type & 0xFF) == cJSON_True) return 1;
+    if (item && (item->type & 0xFF) == cJSON_False) return 0;
+    return fallback;
 }
 
 static void parse_config(const char *config_path, Config *cfg, const char *server_name)
 {
     if (!config_path) return;
-    size_t len = 0;
-    char *buffer = read_entire_file(config_path, CONFIG_SIZE, &len);
-    if (!buffer) {
-        if (cfg->verbose)
+    PPB_PROBE1(config__start, config_path);
+    ConfigSnapshot conf;
+    int rc = load_config_file(config_path, &conf);
+    if (rc != SNAPSHOT_OK) {
+        if (cfg->verbose && rc == SNAPSHOT_INVALID)
+            fprintf(stderr, "Note: config at %s is invalid JSON, ignoring\n", config_path);
+        else if (cfg->verbose)
             fprintf(stderr, "Note: config not readable at %s, using defaults\n", config_path);
+        PPB_PROBE2(config__done, config_path, 0);
         return;
     }
+    if (cfg->verbose && conf.mapped)
+        fprintf(stderr, "[*] Config loaded from its snapshot\n");
+
+    if (server_name) {
+        const SnapshotServer *server = snapshot_server(&conf, server_name);
+        if (server) apply_server(server, cfg);
+    } else {
+        if (conf.default_server) copy_string(cfg->url, URL_SIZE, conf.default_server);
+        if (conf.default_token) copy_string(cfg->token, TOKEN_SIZE, conf.default_token);
+        if (conf.default_group) copy_string(cfg->group, GROUP_SIZE, conf.default_group);
+    }
+
+    if (conf.redact) {
+        // Parsed only if redaction ends up enabled
+        if (conf.redact_enabled) cfg->redact = 1;
+        cfg->redact_config = strdup(conf.redact);
+    }
+
+    if (conf.compact) {
+        if (conf.compact_enabled) cfg->compact = 1;
+        if (conf.compact_fuzzy) cfg->compact_fuzzy = 1;
+        if (conf.compact_keep && compact_keep_parse(conf.compact_keep, &cfg->compact_keep) != 0)
+            fprintf(stderr, "Note: unknown compact keep \"%s\" in config, using first\n", conf.compact_keep);
+    }
+
+    if (conf.spool_enabled >= 0) cfg->spool = conf.spool_enabled;
+    if (conf.spool_memory_mb >= 0) cfg->spool_memory = (size_t)conf.spool_memory_mb * 1024 * 1024;
+    if (conf.spool_limit_mb >= 0) cfg->spool_limit = (long long)conf.spool_limit_mb * 1024 * 1024;
+
+    snapshot_free(&conf);
+    PPB_PROBE2(config__done, config_path, 1);
+}
+
+// Rules from the "redact" config object, after the built-in ones unless
+// "defaults" is false:
+//   {"name": "...", "anchor": "tok_" | ["...", ...], "regex": "...",
+//    "keep": N, "min": N, "max": N}
+static Redactor *build_redactor(const cJSON *config)
+{
+    char err[256];
+    cJSON *mask = cJSON_GetObjectItemCaseSensitive(config, "mask");
+    Redactor *redactor = redactor_new(cJSON_IsString(mask) && mask->valuestring[0] ? mask->valuestring[0] : '*');
+    if (!redactor) {
+        fprintf(stderr, "Error: not enough memory for redaction\n");
+        return NULL;
+    }
+
+    if (json_bool(config, "defaults", 1) &&
+        redactor_add_defaults(redactor, err, sizeof(err)) != 0)
+        goto failed;
+
+    cJSON *rules = cJSON_GetObjectItemCaseSensitive(config, "rules");
+    for (const cJSON *rule_obj = cJSON_IsArray(rules) ? rules->child : NULL; rule_obj; rule_obj = rule_obj->next) {
+        const char *anchors[32];
+        size_t count = 0;
+        cJSON *anchor = cJSON_GetObjectItemCaseSensitive(rule_obj, "anchor");
+        if (cJSON_IsString(anchor)) {
+            anchors[count++] = anchor->valuestring;
+        } else if (cJSON_IsArray(anchor)) {
+            for (const cJSON *item = anchor->child; item; item = item->next) {
+                if (cJSON_IsString(item) && count < sizeof(anchors) / sizeof(anchors[0]) - 1)
+                    anchors[count++] = item->valuestring;
+            }
+        }
+        anchors[count] = NULL;
+
+        cJSON *name = cJSON_GetObjectItemCaseSensitive(rule_obj, "name");
+        cJSON *regex = cJSON_GetObjectItemCaseSensitive(rule_obj, "regex");
+        RedactRule rule = {
+            .name = cJSON_IsString(name) ? name->valuestring : NULL,
+            .anchors = anchors,
+            .regex = cJSON_IsString(regex) ? regex->valuestring : NULL,
+            .keep = json_long(rule_obj, "keep", -1),
+            .min = json_long(rule_obj, "min", -1),
+            .max = json_long(rule_obj, "max", -1)
+        };
+        if (redactor_add_rule(redactor, &rule, err, sizeof(err)) != 0)
+            goto failed;
+    }
+
+    if (redactor_compile(redactor, err, sizeof(err)) != 0)
+        goto failed;
+    return redactor;
+
+failed:
+    fprintf(stderr, "Error: redact config: %s\n", err);
+    redactor_free(redactor);
+    return NULL;
+}
+
+static const char *status_message(long http_code)
+{
+    switch (http_code) {
+    case 401: return "unauthorized (401) - invalid token";
+    case 413: return "file too large (413)";
+    case 429: return "rate limited by server (429), try again later";
+    case 504: return "server gave up, deadline exceeded (504)";
+    default: return NULL;
+    }
+}
+
+// --mirror entries are URLs or server names from the config file. A server
+// without its own token, or a URL, uses the token in effect.
+static MirrorTarget *resolve_mirrors(const char *config_path, const char *list, const Config *cfg, size_t *count)
+{
+    ConfigSnapshot conf = {0};
+    if (config_path) load_config_file(config_path, &conf);
+
+    size_t n = 1;
+    for (const char *p = list; *p; p++) n += *p == ',';
+    MirrorTarget *targets = calloc(n, sizeof(*targets));
+    *count = 0;
+    for (const char *p = list; targets && *p; ) {
+        size_t item_len = strcspn(p, ",");
+        Config entry = *cfg;
+        MirrorTarget *target = &targets[*count];
+        target->name = strndup(p, item_len);
+        if (!target->name) goto failed;
+        p += item_len + (p[item_len] == ',');
+        if (!target->name[0]) {
+            free(target->name);
+            continue;
+        }
+        (*count)++;
+
+        if (strstr(target->name, "://")) {
+            copy_string(entry.url, URL_SIZE, target->name);
+        } else {
+            const SnapshotServer *server = snapshot_server(&conf, target->name);
+            if (!server) {
+                fprintf(stderr, "Error: --mirror: no server named \"%s\" in the config\n", target->name);
+                goto failed;
+            }
+            apply_server(server, &entry);
+        }
+        target->url = strdup(entry.url);
+        target->token = strdup(entry.token);
+        if (!target->url || !target->token) goto failed;
+    }
+    if (!targets) {
+        fprintf(stderr, "Error: not enough memory for mirroring\n");
+    } else if (*count == 0) {
+        fprintf(stderr, "Error: --mirror expects a list of servers\n");
+        goto failed;
+    }
+    snapshot_free(&conf);
+    return targets;
+
+failed:
+    mirror_targets_free(targets, *count);
+    snapshot_free(&conf);
+    return NULL;
+}
+
+// Members of a config "groups" entry: a list of server names or URLs
+static MirrorTarget *resolve_group(const char *config_path, const char *name, const Config *cfg, size_t *count)
+{
+    ConfigSnapshot conf = {0};
+    if (config_path) load_config_file(config_path, &conf);
+    const SnapshotGroup *group = snapshot_group(&conf, name);
+    MirrorTarget *members = NULL;
+    if (!group || !group->members[0])
+        fprintf(stderr, "Error: no server group named \"%s\" in the config\n", name);
+    else
+        members = resolve_mirrors(config_path, group->members, cfg, count);
+    snapshot_free(&conf);
+    return members;
+}
 
-    cJSON *root = cJSON_ParseWithLength(buffer, len);
-    if (!root) {
+// Hash the input and point cfg at the group member that owns it. Input
+// that is not a plain file is spooled first, through the filters, and
+// takes the place of stdin.
+static int route_to_owner(Config *cfg, const MirrorTarget *group, size_t count, InputFilters *filters)
+{
+    char checksum[SHA256_HEX_SIZE];
+    long long size = 0;
+    int in = fileno(stdin);
+    struct stat st;
+    if (!filters->redactor && !filters->compactor && fstat(in, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (hash_file(in, &size, checksum) != 0) return -1;
+    } else {
+        int fd = spool_input(read_input, filters, &size, checksum);
+        if (fd < 0) return -1;
+        report_filters(filters, cfg->verbose);
+        free_filters(filters);
+        filters->redactor = NULL;
+        filters->compactor = NULL;
+        int rc = dup2(fd, in);
+        close(fd);
+        if (rc < 0) {
+            fprintf(stderr, "Error: could not read spool file: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    const MirrorTarget *owner = &group[group_owner(group, count, checksum)];
+    copy_string(cfg->url, URL_SIZE, owner->url);
+    copy_string(cfg->token, TOKEN_SIZE, owner->token);
+    if (cfg->verbose)
+        fprintf(stderr, "[*] Group %s: %.*s (%lld bytes) belongs to %s, %s\n",
+                cfg->group, GROUP_KEY_SIZE, checksum, size, owner->name, owner->url);
+    if (cfg->token[0] == '\0') {
+        fprintf(stderr, "Error: group member %s has no token. Set one in its config entry, or use --token.\n", owner->name);
+        return -1;
+    }
+    return 0;
+}
+
+// put get <ID>: fetch a paste, from the group member that owns it if
+// there is a group
+static int run_get(const char *id, const Config *cfg, const MirrorTarget *group, size_t count)
+{
+    const char *upload_url = cfg->url;
+    if (group) {
+        if (strlen(id) < GROUP_KEY_SIZE) {
+            fprintf(stderr, "Error: get in a group needs the %d-character short id or the checksum\n", GROUP_KEY_SIZE);
+            return 1;
+        }
+        const MirrorTarget *owner = &group[group_owner(group, count, id)];
+        upload_url = owner->url;
         if (cfg->verbose)
-            fprintf(stderr, "Note: config at %s is invalid JSON, ignoring\n", config_path);
-        free(buffer);
-        return;
+            fprintf(stderr, "[*] Group %s: %.*s belongs to %s\n", cfg->group, GROUP_KEY_SIZE, id, owner->name);
     }
 
-    if (server_name) {
-        cJSON *servers = cJSON_GetObjectItemCaseSensitive(root, "servers");
-        cJSON *server = cJSON_IsObject(servers) ? cJSON_GetObjectItemCaseSensitive(servers, server_name) : NULL;
-        if (cJSON_IsObject(server)) {
-            apply_server_object(server, cfg);
+    char url[URL_SIZE + 128];
+    if (strchr(id, '/') || group_raw_url(upload_url, id, url, sizeof(url)) != 0) {
+        fprintf(stderr, "Error: invalid paste id\n");
+        return 1;
+    }
+    if (cfg->verbose)
+        fprintf(stderr, "[*] URL: %s\n", url);
+
+    CURL *curl = curl_easy_init();
+    if (!curl) {
+        fprintf(stderr, "Error: failed to initialize CURL\n");
+        return 1;
+    }
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, stdout);
+    CURLcode res = curl_easy_perform(curl);
+    long http_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_cleanup(curl);
+
+    if (res == CURLE_OK) return 0;
+    if (http_code == 404)
+        fprintf(stderr, "Error: not found (404)\n");
+    else if (http_code >= 400 && status_message(http_code))
+        fprintf(stderr, "Error: %s\n", status_message(http_code));
+    else if (http_code >= 400)
+        fprintf(stderr, "Error: HTTP %ld\n", http_code);
+    else
+        fprintf(stderr, "Error: download failed: %s\n", curl_easy_strerror(res));
+    return 1;
+}
+
+// curl's phase timings for the transfer__phases probe
+static void probe_transfer_phases(CURL *curl)
+{
+    curl_off_t dns = 0, connect = 0, tls = 0, pretransfer = 0, first_byte = 0, total = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+    PPB_PROBE6(transfer__phases, (long long)dns, (long long)connect, (long long)tls,
+               (long long)pretransfer, (long long)first_byte, (long long)total);
+}
+
+// Upload to every mirror; the exit code is 0 once the quorum has the data
+static int run_mirrors(MirrorUpload *up, const Config *cfg)
+{
+    char checksum[SHA256_HEX_SIZE];
+    int acks = mirror_upload(up, checksum);
+    if (acks < 0) return 1;
+
+    for (size_t i = 0; i < up->count; i++) {
+        const MirrorTarget *target = &up->targets[i];
+        if (target->acked) {
+            if (cfg->verbose)
+                fprintf(stderr, "[*] Mirror %s: stored (HTTP %ld)\n", target->name, target->status);
+            if (cfg->show_response)
+                printf("%s\n", target->response);
+            else
+                fputs(target->response, stdout);
+        } else if (target->cancelled) {
+            if (cfg->verbose)
+                fprintf(stderr, "[*] Mirror %s: cancelled after the quorum was reached\n", target->name);
+        } else if (target->stalled) {
+            fprintf(stderr, "Error: mirror %s: stopped taking data, dropped so the others could finish\n", target->name);
+        } else if (target->error != CURLE_OK) {
+            fprintf(stderr, "Error: mirror %s: %s\n", target->name, curl_easy_strerror(target->error));
+        } else if (target->status >= 200 && target->status < 300) {
+            fprintf(stderr, "Error: mirror %s: stored data does not match the checksum\n", target->name);
+        } else {
+            const char *message = status_message(target->status);
+            if (message)
+                fprintf(stderr, "Error: mirror %s: %s\n", target->name, message);
+            else
+                fprintf(stderr, "Error: mirror %s: HTTP %ld\n", target->name, target->status);
+        }
+    }
+
+    if ((size_t)acks < up->quorum) {
+        fprintf(stderr, "Error: %d of %zu mirrors stored the upload, quorum is %zu\n",
+                acks, up->count, up->quorum);
+        return 1;
+    }
+    if (cfg->verbose)
+        fprintf(stderr, "[+] Quorum reached: %d of %zu mirrors stored %s\n", acks, up->count, checksum);
+    return 0;
+}
+
+// One connection's worth of a batch upload
+typedef struct {
+    CURL *easy;
+    struct curl_slist *headers;
+    BatchFile file;
+    ResponseBuffer response;
+    int active;
+} BatchLeg;
+
+typedef struct {
+    const char *const *paths;
+    size_t count;
+    const Config *cfg;
+    const MirrorTarget *group;  // NULL without a group
+    size_t group_count;
+    const char *unix_socket;
+    double started;
+    double deadline;            // seconds from started, 0: none
+} BatchUpload;
+
+// Read the list for --files-from, one path per line; "-" is stdin. The
+// paths are strdup'd and appended after the *count the caller passes in,
+// which stay the caller's to free.
+static char **read_file_list(const char *path, char **paths, size_t *count)
+{
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "Error: could not open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    size_t given = *count;
+    size_t cap = *count;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, in)) >= 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        if (len == 0) continue;
+        if (*count == cap) {
+            cap = cap ? cap * 2 : 1024;
+            char **grown = realloc(paths, cap * sizeof(*paths));
+            if (!grown) break;
+            paths = grown;
         }
+        if (!(paths[*count] = strdup(line))) break;
+        (*count)++;
+    }
+    int failed = ferror(in) || !feof(in);
+    free(line);
+    if (in != stdin) fclose(in);
+    if (failed) {
+        fprintf(stderr, "Error: could not read %s\n", path);
+        for (size_t i = given; i < *count; i++) free(paths[i]);
+        free(paths);
+        return NULL;
+    }
+    return paths;
+}
+
+// Hand the leg's file to curl, addressed to the group member that owns it
+// if there is a group
+static int start_batch_leg(BatchLeg *leg, CURLM *multi, const BatchUpload *up)
+{
+    const Config *cfg = up->cfg;
+    const char *url = cfg->url;
+    const char *token = cfg->token;
+    if (up->group) {
+        char checksum[SHA256_HEX_SIZE];
+        Sha256 sha;
+        sha256_init(&sha);
+        sha256_update(&sha, leg->file.data, leg->file.size);
+        sha256_final_hex(&sha, checksum);
+        const MirrorTarget *owner = &up->group[group_owner(up->group, up->group_count, checksum)];
+        url = owner->url;
+        token = owner->token;
+        if (cfg->verbose)
+            fprintf(stderr, "[*] Group %s: %s belongs to %s\n", cfg->group, up->paths[leg->file.index], owner->name);
+    }
+    if (token[0] == '\0') {
+        fprintf(stderr, "Error: %s: no token for %s. Set one in its config entry, or use --token.\n",
+                up->paths[leg->file.index], url);
+        return -1;
+    }
+
+    long remaining_ms = 0;
+    if (up->deadline > 0) {
+        remaining_ms = (long)((up->deadline - (monotonic_seconds() - up->started)) * 1000);
+        if (remaining_ms <= 0) {
+            fprintf(stderr, "Error: %s: deadline exceeded before upload started\n", up->paths[leg->file.index]);
+            return -1;
+        }
+    }
+
+    char line[TOKEN_SIZE + URL_SIZE];
+    struct curl_slist *headers = curl_slist_append(NULL, "Content-Type: application/octet-stream");
+    headers = curl_slist_append(headers, leg->file.size >= EXPECT_CONTINUE_MIN ? "Expect: 100-continue" : "Expect:");
+    snprintf(line, sizeof(line), "Authorization: Bearer %s", token);
+    headers = curl_slist_append(headers, line);
+    if (remaining_ms > 0) {
+        snprintf(line, sizeof(line), DEADLINE_HEADER ": %ld", remaining_ms);
+        headers = curl_slist_append(headers, line);
+    }
+    if (!headers || (!leg->easy && !(leg->easy = curl_easy_init()))) {
+        curl_slist_free_all(headers);
+        fprintf(stderr, "Error: failed to initialize CURL\n");
+        return -1;
+    }
+
+    // The handle is reused from file to file; the multi handle keeps the
+    // connections, so each upload after the first skips the handshake
+    CURL *easy = leg->easy;
+    curl_easy_setopt(easy, CURLOPT_URL, url);
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDS, leg->file.data);
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)leg->file.size);
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, (void *)&leg->response);
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, (void *)leg);
+    if (up->unix_socket)
+        curl_easy_setopt(easy, CURLOPT_UNIX_SOCKET_PATH, up->unix_socket);
+    if (remaining_ms > 0) {
+        curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, remaining_ms);
+        curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, remaining_ms);
+    }
+    if (curl_multi_add_handle(multi, easy) != CURLM_OK) {
+        curl_slist_free_all(headers);
+        fprintf(stderr, "Error: failed to initialize CURL\n");
+        return -1;
+    }
+    PPB_PROBE2(transfer__start, url, (long long)leg->file.size);
+    leg->headers = headers;
+    leg->active = 1;
+    return 0;
+}
+
+// Report one finished upload; 0 if the server stored it
+static int finish_batch_leg(BatchLeg *leg, CURLM *multi, const BatchUpload *up, CURLcode res)
+{
+    const char *path = up->paths[leg->file.index];
+    long http_code = 0;
+    curl_easy_getinfo(leg->easy, CURLINFO_RESPONSE_CODE, &http_code);
+    probe_transfer_phases(leg->easy);
+    PPB_PROBE2(transfer__done, (int)res, http_code);
+    curl_multi_remove_handle(multi, leg->easy);
+    curl_slist_free_all(leg->headers);
+    leg->headers = NULL;
+    leg->active = 0;
+    free(leg->file.data);
+    leg->file.data = NULL;
+
+    int rc = 1;
+    if (res == CURLE_OPERATION_TIMEDOUT && up->deadline > 0) {
+        fprintf(stderr, "Error: %s: deadline of %gs exceeded\n", path, up->deadline);
+    } else if (res != CURLE_OK) {
+        fprintf(stderr, "Error: %s: upload failed: %s\n", path, curl_easy_strerror(res));
+    } else if (http_code < 200 || http_code >= 300) {
+        if (status_message(http_code))
+            fprintf(stderr, "Error: %s: %s\n", path, status_message(http_code));
+        else
+            fprintf(stderr, "Error: %s: HTTP %ld\n", path, http_code);
     } else {
-        cJSON *default_url = cJSON_GetObjectItemCaseSensitive(root, "default_server");
-        cJSON *default_token = cJSON_GetObjectItemCaseSensitive(root, "default_token");
-        if (cJSON_IsString(default_url) && default_url->valuestring) copy_string(cfg->url, URL_SIZE, default_url->valuestring);
-        if (cJSON_IsString(default_token) && default_token->valuestring) copy_string(cfg->token, TOKEN_SIZE, default_token->valuestring);
+        cJSON *root = leg->response.data && !up->cfg->show_response
+                          ? cJSON_ParseLazy(leg->response.data, leg->response.size) : NULL;
+        const char *url = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(root, "url"));
+        if (up->cfg->show_response)
+            printf("%s\n", leg->response.data ? leg->response.data : "");
+        else if (url)
+            printf("%s  %s\n", url, path);
+        else if (leg->response.data)
+            printf("%s  %s\n", leg->response.data, path);
+        cJSON_Delete(root);
+        rc = 0;
+    }
+    free(leg->response.data);
+    leg->response.data = NULL;
+    leg->response.size = 0;
+    return rc;
+}
+
+// Upload every file given on the command line, BATCH_CONNECTIONS at a time.
+// The batch reader reads ahead of the uploads, so the next file is usually
+// in memory by the time a connection frees up.
+static int run_batch(const BatchUpload *up)
+{
+    BatchReader *reader = batch_reader_new(up->paths, up->count, (size_t)SPOOL_LIMIT, 1);
+    BatchLeg *legs = calloc(BATCH_CONNECTIONS, sizeof(*legs));
+    CURLM *multi = curl_multi_init();
+    size_t failed = 0, done = 0;
+    int broken = 0;
+    if (!reader || !legs || !multi) {
+        fprintf(stderr, "Error: not enough memory for the batch\n");
+        broken = 1;
+        goto out;
     }
+    if (up->cfg->verbose)
+        fprintf(stderr, "[*] Batch: %zu files, read with %s, %d connections\n",
+                up->count, batch_reader_backend(reader), BATCH_CONNECTIONS);
+
+    int more = 1, active = 0;
+    for (;;) {
+        for (size_t i = 0; more && i < BATCH_CONNECTIONS; i++) {
+            BatchLeg *leg = &legs[i];
+            while (more && !leg->active) {
+                int got = batch_reader_next(reader, &leg->file);
+                if (got <= 0) {
+                    broken = got < 0;
+                    more = 0;
+                } else if (leg->file.error) {
+                    fprintf(stderr, "Error: %s: %s\n", up->paths[leg->file.index], strerror(leg->file.error));
+                    failed++;
+                    done++;
+                } else if (start_batch_leg(leg, multi, up) != 0) {
+                    free(leg->file.data);
+                    leg->file.data = NULL;
+                    failed++;
+                    done++;
+                } else {
+                    active++;
+                }
+            }
+        }
+        if (!active) break;
 
-    cJSON_Delete(root);
-    free(buffer);
+        int running = 0;
+        curl_multi_perform(multi, &running);
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            char *private = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &private);
+            failed += finish_batch_leg((BatchLeg *)private, multi, up, msg->data.result);
+            done++;
+            active--;
+        }
+        if (running)
+            curl_multi_wait(multi, NULL, 0, 100, NULL);
+    }
+    if (broken)
+        fprintf(stderr, "Error: reading the files failed after %zu of %zu\n", done, up->count);
+    else if (up->cfg->verbose)
+        fprintf(stderr, "[+] Uploaded %zu of %zu files\n", done - failed, up->count);
+
+out:
+    for (size_t i = 0; legs && i < BATCH_CONNECTIONS; i++) {
+        if (legs[i].active) curl_multi_remove_handle(multi, legs[i].easy);
+        if (legs[i].easy) curl_easy_cleanup(legs[i].easy);
+        curl_slist_free_all(legs[i].headers);
+        free(legs[i].file.data);
+        free(legs[i].response.data);
+    }
+    free(legs);
+    if (multi) curl_multi_cleanup(multi);
+    batch_reader_free(reader);
+    return broken || failed ? 1 : 0;
 }
 
 int main(int argc, char *argv[])
 {
+    double started = monotonic_seconds();
     Config cfg = {
         .url = "https://epa.st/upload",
         .token = "",
         .verbose = 0,
-        .show_response = 0
+        .show_response = 0,
+        .redact = 0,
+        .redact_config = NULL,
+        .compact = 0,
+        .compact_keep = COMPACT_KEEP_FIRST,
+        .compact_fuzzy = 0,
+        .group = "",
+        .spool = 1,
+        .spool_memory = SPOOL_MEMORY,
+        .spool_limit = SPOOL_LIMIT
     };
     const char *server_name = NULL;
     const char *custom_config = NULL;
@@ -269,6 +1011,19 @@ int main(int argc, char *argv[])
     int cli_url_set = 0;
     int cli_token_set = 0;
     int init_config_only = 0;
+    double deadline = 0;
+    const char *unix_socket = NULL;
+    int use_direct = 1;
+    int cli_redact = -1;
+    int cli_compact = -1;
+    const char *cli_compact_keep = NULL;
+    int cli_compact_fuzzy = 0;
+    const char *mirror_list = NULL;
+    long quorum = 0;
+    int cancel_stragglers = 0;
+    const char *cli_group = NULL;
+    int cli_spool = -1;
+    const char *files_from = NULL;
     
     // Parse CLI args first (store overrides, apply later)
     int opt;
@@ -278,6 +1033,22 @@ int main(int argc, char *argv[])
         {"server", required_argument, 0, 's'},
         {"config", required_argument, 0, 'c'},
         {"init-config", no_argument, 0, 'i'},
+        {"deadline", required_argument, 0, 'd'},
+        {"unix-socket", required_argument, 0, 'U'},
+        {"no-splice", no_argument, 0, 'S'},
+        {"redact", no_argument, 0, 'R'},
+        {"no-redact", no_argument, 0, 'N'},
+        {"compact", no_argument, 0, 'C'},
+        {"no-compact", no_argument, 0, 'n'},
+        {"compact-keep", required_argument, 0, 'K'},
+        {"compact-fuzzy", no_argument, 0, 'F'},
+        {"mirror", required_argument, 0, 'M'},
+        {"quorum", required_argument, 0, 'Q'},
+        {"cancel-stragglers", no_argument, 0, 'X'},
+        {"group", required_argument, 0, 'G'},
+        {"spool", no_argument, 0, 'P'},
+        {"no-spool", no_argument, 0, 'p'},
+        {"files-from", required_argument, 0, 'f'},
         {"verbose", no_argument, 0, 'v'},
         {"response", no_argument, 0, 'r'},
         {"help", no_argument, 0, 'h'},
@@ -303,6 +1074,66 @@ int main(int argc, char *argv[])
         case 'i':
             init_config_only = 1;
             break;
+        case 'd': {
+            char *end = NULL;
+            deadline = strtod(optarg, &end);
+            if (!end || *end != '\0' || deadline <= 0) {
+                fprintf(stderr, "Error: --deadline expects a positive number of seconds\n");
+                return 1;
+            }
+            break;
+        }
+        case 'U':
+            unix_socket = optarg;
+            break;
+        case 'S':
+            use_direct = 0;
+            break;
+        case 'R':
+            cli_redact = 1;
+            break;
+        case 'N':
+            cli_redact = 0;
+            break;
+        case 'C':
+            cli_compact = 1;
+            break;
+        case 'n':
+            cli_compact = 0;
+            break;
+        case 'K':
+            cli_compact_keep = optarg;
+            break;
+        case 'F':
+            cli_compact_fuzzy = 1;
+            break;
+        case 'M':
+            mirror_list = optarg;
+            break;
+        case 'Q': {
+            char *end = NULL;
+            quorum = strtol(optarg, &end, 10);
+            if (!end || *end != '\0' || quorum <= 0) {
+                fprintf(stderr, "Error: --quorum expects a positive number of mirrors\n");
+                return 1;
+            }
+            break;
+        }
+        case 'X':
+            cancel_stragglers = 1;
+            break;
+        case 'G':
+            cli_group = optarg;
+            break;
+        case 'P':
+            cli_spool = 1;
+            break;
+        case 'p':
+            cli_spool = 0;
+            break;
+        case 'f':
+            files_from = optarg;
+            break;
         case 'v':
             cfg.verbose = 1;
             break;
@@ -318,6 +1149,17 @@ int main(int argc, char *argv[])
         }
     }
 
+    // put get <ID> fetches; any other arguments are files to upload
+    const char *get_id = NULL;
+    if (optind < argc && strcmp(argv[optind], "get") == 0) {
+        if (optind + 2 != argc || files_from) {
+            print_help(argv[0]);
+            return 1;
+        }
+        get_id = argv[optind + 1];
+    }
+    int batch = !get_id && (optind < argc || files_from);
+
     // Config (lowest precedence after defaults)
     const char *config_path = get_config_path(custom_config);
 
@@ -342,20 +1184,206 @@ int main(int argc, char *argv[])
     // CLI overrides (highest)
     if (cli_url_set) copy_string(cfg.url, URL_SIZE, cli_url);
     if (cli_token_set) copy_string(cfg.token, TOKEN_SIZE, cli_token);
+    if (cli_redact >= 0) cfg.redact = cli_redact;
+    if (cli_compact >= 0) cfg.compact = cli_compact;
+    if (cli_compact_fuzzy) cfg.compact_fuzzy = 1;
+    if (cli_spool >= 0) cfg.spool = cli_spool;
+    if (cli_compact_keep && compact_keep_parse(cli_compact_keep, &cfg.compact_keep) != 0) {
+        fprintf(stderr, "Error: --compact-keep expects first, last or both\n");
+        free(cfg.redact_config);
+        return 1;
+    }
+    // A server picked by hand outranks the config's default group
+    if (env_url || cli_url_set || server_name || mirror_list) cfg.group[0] = '\0';
+    if (cli_group) copy_string(cfg.group, GROUP_SIZE, cli_group);
+    if (cli_group && mirror_list) {
+        fprintf(stderr, "Error: --group and --mirror cannot be combined\n");
+        free(cfg.redact_config);
+        return 1;
+    }
 
-    if (cfg.verbose) {
-        fprintf(stderr, "[*] URL: %s\n", cfg.url);
-        fprintf(stderr, "[*] Token: %s\n", cfg.token[0] ? "***" : "(not set)");
+    MirrorTarget *group = NULL;
+    size_t group_count = 0;
+    if (cfg.group[0]) {
+        group = resolve_group(config_path, cfg.group, &cfg, &group_count);
+        if (!group) {
+            free(cfg.redact_config);
+            return 1;
+        }
     }
 
-    if (cfg.token[0] == '\0') {
-        fprintf(stderr, "Error: token is not set. Use --token, PPB_TOKEN, or config file.\n");
-        return 1;
+    if (get_id) {
+        int rc = run_get(get_id, &cfg, group, group_count);
+        mirror_targets_free(group, group_count);
+        free(cfg.redact_config);
+        return rc;
+    }
+
+    if (batch) {
+        free(cfg.redact_config);
+        if (mirror_list) {
+            fprintf(stderr, "Error: --mirror uploads stdin only, not file arguments\n");
+            mirror_targets_free(group, group_count);
+            return 1;
+        }
+        if (cfg.redact || cfg.compact) {
+            fprintf(stderr, "Error: --redact and --compact filter stdin only. Use --no-redact and --no-compact to upload files as they are.\n");
+            mirror_targets_free(group, group_count);
+            return 1;
+        }
+        if (!group && cfg.token[0] == '\0') {
+            fprintf(stderr, "Error: token is not set. Use --token, PPB_TOKEN, or config file.\n");
+            return 1;
+        }
+        size_t count = (size_t)(argc - optind);
+        char **paths = malloc((count ? count : 1) * sizeof(*paths));
+        if (!paths)
+            fprintf(stderr, "Error: not enough memory for the file list\n");
+        for (size_t i = 0; paths && i < count; i++)
+            paths[i] = argv[optind + i];
+        if (paths && files_from)
+            paths = read_file_list(files_from, paths, &count);
+        int rc = 1;
+        if (paths && count) {
+            if (cfg.verbose && !group)
+                fprintf(stderr, "[*] URL: %s\n", cfg.url);
+            BatchUpload up = {
+                .paths = (const char *const *)paths,
+                .count = count,
+                .cfg = &cfg,
+                .group = group,
+                .group_count = group_count,
+                .unix_socket = unix_socket,
+                .started = started,
+                .deadline = deadline
+            };
+            rc = run_batch(&up);
+        } else if (paths) {
+            rc = 0;
+        }
+        for (size_t i = (size_t)(argc - optind); paths && i < count; i++)
+            free(paths[i]);
+        free(paths);
+        mirror_targets_free(group, group_count);
+        return rc;
+    }
+
+    MirrorTarget *mirrors = NULL;
+    size_t mirror_count = 0;
+    if (mirror_list) {
+        mirrors = resolve_mirrors(config_path, mirror_list, &cfg, &mirror_count);
+        if (!mirrors) {
+            free(cfg.redact_config);
+            return 1;
+        }
+        for (size_t i = 0; i < mirror_count; i++) {
+            if (cfg.verbose)
+                fprintf(stderr, "[*] Mirror %s: %s\n", mirrors[i].name, mirrors[i].url);
+            if (mirrors[i].token[0] == '\0') {
+                fprintf(stderr, "Error: mirror %s has no token. Set one in its config entry, or use --token.\n", mirrors[i].name);
+                mirror_targets_free(mirrors, mirror_count);
+                free(cfg.redact_config);
+                return 1;
+            }
+        }
+        if ((size_t)quorum > mirror_count) {
+            fprintf(stderr, "Error: --quorum %ld is more than the %zu mirrors given\n", quorum, mirror_count);
+            mirror_targets_free(mirrors, mirror_count);
+            free(cfg.redact_config);
+            return 1;
+        }
+    } else if (!group) {
+        if (cfg.verbose) {
+            fprintf(stderr, "[*] URL: %s\n", cfg.url);
+            fprintf(stderr, "[*] Token: %s\n", cfg.token[0] ? "***" : "(not set)");
+        }
+
+        if (cfg.token[0] == '\0') {
+            fprintf(stderr, "Error: token is not set. Use --token, PPB_TOKEN, or config file.\n");
+            free(cfg.redact_config);
+            return 1;
+        }
+    }
+
+    // Spooling waits for the producer, so stdin is held to the deadline too
+    InputFilters filters = {.deadline_at = deadline > 0 ? started + deadline : 0};
+    if (cfg.redact) {
+        cJSON *redact_config = cfg.redact_config ? cJSON_Parse(cfg.redact_config) : NULL;
+        filters.redactor = build_redactor(redact_config);
+        cJSON_Delete(redact_config);
+        if (!filters.redactor) {
+            mirror_targets_free(mirrors, mirror_count);
+            mirror_targets_free(group, group_count);
+            free(cfg.redact_config);
+            return 1;
+        }
+    }
+    free(cfg.redact_config);
+    if (cfg.compact) {
+        filters.compactor = compactor_new(cfg.compact_keep, cfg.compact_fuzzy);
+        if (!filters.compactor) {
+            fprintf(stderr, "Error: not enough memory for compaction\n");
+            mirror_targets_free(mirrors, mirror_count);
+            mirror_targets_free(group, group_count);
+            free_filters(&filters);
+            return 1;
+        }
+    }
+    int filtered = filters.redactor || filters.compactor;
+
+    // In a group the content picks the server, so it is hashed first
+    if (group) {
+        int rc = route_to_owner(&cfg, group, group_count, &filters);
+        mirror_targets_free(group, group_count);
+        if (rc != 0) {
+            free_filters(&filters);
+            return 1;
+        }
+        filtered = 0;
+    }
+
+    // Read piped input to the end before connecting, so a slow producer does
+    // not hold a server worker for as long as it runs
+    struct stat in_st;
+    if (cfg.spool && fstat(fileno(stdin), &in_st) == 0 && !S_ISREG(in_st.st_mode)) {
+        Spool *spool = spool_fill(read_filtered, &filters, cfg.spool_memory, cfg.spool_limit);
+        if (!spool) {
+            mirror_targets_free(mirrors, mirror_count);
+            free_filters(&filters);
+            return 1;
+        }
+        if (cfg.verbose && spool->complete)
+            fprintf(stderr, "[*] Spooled %lld bytes %s\n", spool->size, spool->fd < 0 ? "in memory" : "to a temp file");
+        else if (cfg.verbose)
+            fprintf(stderr, "[*] Spool full at %lld bytes, streaming the rest\n", spool->size);
+
+        if (spool->complete && spool->fd >= 0) {
+            // The file stands in for stdin, so it can go out with sendfile.
+            // It is already filtered, and the filters are spent.
+            int rc = dup2(spool->fd, fileno(stdin));
+            spool_free(spool);
+            report_filters(&filters, cfg.verbose);
+            free_filters(&filters);
+            filters.redactor = NULL;
+            filters.compactor = NULL;
+            if (rc < 0) {
+                fprintf(stderr, "Error: could not read spool file: %s\n", strerror(errno));
+                mirror_targets_free(mirrors, mirror_count);
+                free_filters(&filters);
+                return 1;
+            }
+            filtered = 0;
+        } else {
+            filters.spool = spool;
+            filtered = 1;
+        }
     }
 
     CURL *curl = curl_easy_init();
     if (!curl) {
         fprintf(stderr, "Error: failed to initialize CURL\n");
+        mirror_targets_free(mirrors, mirror_count);
+        free_filters(&filters);
         return 1;
     }
     
@@ -364,53 +1392,170 @@ int main(int argc, char *argv[])
     
     curl_easy_setopt(curl, CURLOPT_URL, cfg.url);
     curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_READDATA, stdin);
+    if (filtered) {
+        curl_easy_setopt(curl, CURLOPT_READFUNCTION, filter_read_callback);
+        curl_easy_setopt(curl, CURLOPT_READDATA, (void *)&filters);
+    } else {
+        curl_easy_setopt(curl, CURLOPT_READDATA, stdin);
+    }
+    if (unix_socket)
+        curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, unix_socket);
+
+    // A regular file on stdin has a known size: send Content-Length instead of
+    // chunking, so the server can reject oversized uploads from the headers.
+    // Masking keeps lengths; compaction does not, so it chunks unless spooled.
+    curl_off_t body_size = -1;
+    if (filters.spool) {
+        if (filters.spool->complete) body_size = (curl_off_t)filters.spool->size;
+    } else if (!(filtered && filters.compactor) && fstat(fileno(stdin), &in_st) == 0 && S_ISREG(in_st.st_mode)) {
+        off_t pos = lseek(fileno(stdin), 0, SEEK_CUR);
+        body_size = (curl_off_t)(in_st.st_size - (pos > 0 ? pos : 0));
+    }
+    if (body_size >= 0)
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, body_size);
     
     // Handle response
     ResponseBuffer response = {0};
-    if (cfg.show_response) {
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
-    }
-    
-    char auth_header[TOKEN_SIZE + 32];
-    snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", cfg.token);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
     
     struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, auth_header);
     headers = curl_slist_append(headers, "Content-Type: application/octet-stream");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        fprintf(stderr, "Error: upload failed: %s\n", curl_easy_strerror(res));
+
+    // Large uploads wait for the server to accept the headers (token, size,
+    // rate limit) before sending the body; small ones are not worth the round trip
+    if (body_size >= EXPECT_CONTINUE_MIN)
+        headers = curl_slist_append(headers, "Expect: 100-continue");
+    else if (body_size >= 0)
+        headers = curl_slist_append(headers, "Expect:");
+
+    // Spend only what is left of the deadline, and tell the server the budget
+    long remaining_ms = 0;
+    if (deadline > 0) {
+        remaining_ms = (long)((deadline - (monotonic_seconds() - started)) * 1000);
+        if (remaining_ms <= 0) {
+            fprintf(stderr, "Error: deadline exceeded before upload started\n");
+            curl_slist_free_all(headers);
+            curl_easy_cleanup(curl);
+            mirror_targets_free(mirrors, mirror_count);
+            free_filters(&filters);
+            return 1;
+        }
+        char deadline_header[64];
+        snprintf(deadline_header, sizeof(deadline_header), DEADLINE_HEADER ": %ld", remaining_ms);
+        headers = curl_slist_append(headers, deadline_header);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, remaining_ms);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, remaining_ms);
+        if (cfg.verbose)
+            fprintf(stderr, "[*] Deadline: %ld ms remaining\n", remaining_ms);
+    }
+
+    if (mirrors) {
+        MirrorUpload up = {
+            .targets = mirrors,
+            .count = mirror_count,
+            .quorum = quorum > 0 ? (size_t)quorum : mirror_count,
+            .cancel_stragglers = cancel_stragglers,
+            .source = read_input,
+            .source_ctx = &filters,
+            .headers = headers,
+            .body_size = (long long)body_size,
+            .unix_socket = unix_socket,
+            .timeout_ms = remaining_ms
+        };
+        int rc = run_mirrors(&up, &cfg);
+        report_filters(&filters, cfg.verbose);
+        mirror_targets_free(mirrors, mirror_count);
         curl_slist_free_all(headers);
         curl_easy_cleanup(curl);
-        if (response.data)
-            free(response.data);
-        return 1;
+        free_filters(&filters);
+        return rc;
     }
-    
-    // Check HTTP response code
+
+    char auth_header[TOKEN_SIZE + 32];
+    snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", cfg.token);
+    headers = curl_slist_append(headers, auth_header);
+
     long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    DirectRequest direct = {
+        .url = cfg.url,
+        .unix_socket = unix_socket,
+        .headers = headers,
+        .in_fd = fileno(stdin),
+        .body_size = (long long)body_size,
+        .deadline_at = deadline > 0 ? started + deadline : 0,
+        .verbose = cfg.verbose
+    };
+
+    if (use_direct && !filtered && direct_supported(&direct)) {
+        // Plain HTTP: let the kernel move the body instead of copying it through curl
+        DirectResponse reply;
+        PPB_PROBE2(direct__start, cfg.url, (long long)body_size);
+        int rc = direct_upload(&direct, &reply);
+        PPB_PROBE2(direct__done, rc, rc == DIRECT_OK ? reply.status : 0L);
+        if (rc != DIRECT_OK) {
+            if (rc == DIRECT_TIMEOUT && deadline > 0)
+                fprintf(stderr, "Error: deadline of %gs exceeded\n", deadline);
+            else if (rc == DIRECT_TIMEOUT)
+                fprintf(stderr, "Error: upload failed: timed out\n");
+            curl_slist_free_all(headers);
+            curl_easy_cleanup(curl);
+            free_filters(&filters);
+            return 1;
+        }
+        http_code = reply.status;
+        response.data = reply.body;
+        response.size = reply.body_size;
+    } else {
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+        PPB_PROBE2(transfer__start, cfg.url, (long long)body_size);
+        CURLcode res = curl_easy_perform(curl);
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        probe_transfer_phases(curl);
+        PPB_PROBE2(transfer__done, (int)res, http_code);
+        if (res == CURLE_OPERATION_TIMEDOUT && deadline > 0) {
+            fprintf(stderr, "Error: deadline of %gs exceeded\n", deadline);
+            curl_slist_free_all(headers);
+            curl_easy_cleanup(curl);
+            free_filters(&filters);
+            if (response.data)
+                free(response.data);
+            return 1;
+        }
+        if (res != CURLE_OK) {
+            fprintf(stderr, "Error: upload failed: %s\n", curl_easy_strerror(res));
+            curl_slist_free_all(headers);
+            curl_easy_cleanup(curl);
+            free_filters(&filters);
+            if (response.data)
+                free(response.data);
+            return 1;
+        }
+    }
+    PPB_PROBE2(response__done, http_code, response.size);
+
+    report_filters(&filters, cfg.verbose);
     
     if (cfg.verbose)
         fprintf(stderr, "[*] HTTP Status: %ld\n", http_code);
     
     if (cfg.show_response && response.data && response.size > 0) {
         printf("%s\n", response.data);
+    } else if (!cfg.show_response && response.data) {
+        fwrite(response.data, 1, response.size, stdout);
     }
     
     if (http_code >= 200 && http_code < 300) {
         if (cfg.verbose)
             fprintf(stderr, "[+] Upload successful\n");
-    } else if (http_code == 401) {
-        fprintf(stderr, "Error: unauthorized (401) - invalid token\n");
+    } else if (status_message(http_code)) {
+        fprintf(stderr, "Error: %s\n", status_message(http_code));
     }
     
     curl_slist_free_all(headers);
     curl_easy_cleanup(curl);
+    free_filters(&filters);
     if (response.data)
         free(response.data);
     
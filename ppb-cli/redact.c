@@ -0,0 +1,626 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "redact.h"
+
+#include <regex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define REDACT_TEDDY 1
+#include <tmmintrin.h>
+#endif
+
+#define READ_CHUNK (256 * 1024)
+#define ANCHOR_MIN 3            // the prefilter looks at the first three bytes
+#define ANCHOR_MAX 64
+#define MAX_STATES 65535
+#define TOKEN_MIN 8
+#define TOKEN_MAX 256
+#define REGEX_MAX 512
+#define MATCH_LIMIT (1024 * 1024)
+#define BUCKETS 8
+#define PREFIX_BITS 65536
+
+typedef struct {
+    char *name;
+    regex_t regex;
+    int has_regex;
+    int has_group;              // mask the first subexpression, not the whole match
+    long keep;
+    size_t min;
+    size_t max;
+} Rule;
+
+typedef struct {
+    char *text;
+    size_t len;
+    size_t rule;
+    int same;                   // next anchor with identical text, or -1
+} Anchor;
+
+typedef struct {
+    size_t start;               // window offset of the anchor
+    size_t anchor;
+} Hit;
+
+struct Redactor {
+    char mask;
+    Rule *rules;
+    size_t nrules;
+    Anchor *anchors;
+    size_t nanchors;
+
+    // Aho-Corasick automaton as a full DFA; state 0 is the root
+    uint16_t *next;             // nstates * 256
+    int32_t *out;               // anchor ending in this state, or -1
+    uint16_t *report;           // first state on the suffix chain with an anchor, or 0
+    uint16_t *link;             // next such state after this one, or 0
+    uint8_t *depth;
+    size_t nstates;
+
+    // Prefilter: hashed set of the first three bytes of every anchor
+    unsigned char prefixes[PREFIX_BITS / 8];
+#ifdef REDACT_TEDDY
+    unsigned char teddy[6][16]; // nibble -> bucket masks: lo/hi nibble of bytes 0, 1 and 2
+    int use_teddy;
+#endif
+
+    // Window: [head, ready) can be sent, [ready, end) is held back
+    char *buf;
+    size_t cap;
+    size_t head;
+    size_t ready;
+    size_t scanned;
+    size_t end;
+    unsigned state;
+    Hit *hits;
+    size_t nhits;
+    size_t hits_cap;
+    char *scratch;              // NUL-terminated copy for regexec()
+    size_t max_span;
+
+    int compiled;
+    int finished;
+    unsigned long count;
+};
+
+static unsigned char token_chars[256];
+
+static void init_token_chars(void)
+{
+    const char *extra = "-_./+=";
+    for (int c = 0; c < 256; c++)
+        token_chars[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+    for (; *extra; extra++)
+        token_chars[(unsigned char)*extra] = 1;
+}
+
+Redactor *redactor_new(char mask)
+{
+    Redactor *r = calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    r->mask = mask ? mask : '*';
+    if (!token_chars['a']) init_token_chars();
+    return r;
+}
+
+void redactor_free(Redactor *r)
+{
+    if (!r) return;
+    for (size_t i = 0; i < r->nrules; i++) {
+        free(r->rules[i].name);
+        if (r->rules[i].has_regex) regfree(&r->rules[i].regex);
+    }
+    for (size_t i = 0; i < r->nanchors; i++)
+        free(r->anchors[i].text);
+    free(r->rules);
+    free(r->anchors);
+    free(r->next);
+    free(r->out);
+    free(r->report);
+    free(r->link);
+    free(r->depth);
+    free(r->buf);
+    free(r->hits);
+    free(r->scratch);
+    free(r);
+}
+
+static char *dup_string(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = malloc(len);
+    if (copy) memcpy(copy, s, len);
+    return copy;
+}
+
+int redactor_add_rule(Redactor *r, const RedactRule *spec, char *err, size_t errlen)
+{
+    char fallback[32];
+    const char *name = spec->name;
+    if (!name) {
+        snprintf(fallback, sizeof(fallback), "rule %zu", r->nrules + 1);
+        name = fallback;
+    }
+    if (r->compiled) {
+        snprintf(err, errlen, "%s: rules cannot be added after compiling", name);
+        return -1;
+    }
+    if (!spec->anchors || !spec->anchors[0]) {
+        snprintf(err, errlen, "%s: needs at least one anchor", name);
+        return -1;
+    }
+    for (const char *const *a = spec->anchors; *a; a++) {
+        size_t len = strlen(*a);
+        if (len < ANCHOR_MIN || len > ANCHOR_MAX) {
+            snprintf(err, errlen, "%s: anchor \"%s\" must be %d to %d bytes", name, *a, ANCHOR_MIN, ANCHOR_MAX);
+            return -1;
+        }
+    }
+
+    Rule *rules = realloc(r->rules, (r->nrules + 1) * sizeof(*rules));
+    if (!rules) goto nomem;
+    r->rules = rules;
+    Rule *rule = &r->rules[r->nrules];
+    memset(rule, 0, sizeof(*rule));
+    rule->keep = spec->keep;
+    rule->min = spec->min >= 0 ? (size_t)spec->min : TOKEN_MIN;
+    rule->max = spec->max > 0 ? (size_t)spec->max : (spec->regex ? REGEX_MAX : TOKEN_MAX);
+    if (rule->max > MATCH_LIMIT) rule->max = MATCH_LIMIT;
+    if (spec->regex) {
+        int rc = regcomp(&rule->regex, spec->regex, REG_EXTENDED);
+        if (rc != 0) {
+            char msg[128];
+            regerror(rc, &rule->regex, msg, sizeof(msg));
+            snprintf(err, errlen, "%s: invalid regex: %s", name, msg);
+            return -1;
+        }
+        rule->has_regex = 1;
+        rule->has_group = rule->regex.re_nsub > 0;
+    }
+    if (!(rule->name = dup_string(name))) {
+        if (rule->has_regex) regfree(&rule->regex);
+        goto nomem;
+    }
+    r->nrules++;
+
+    for (const char *const *a = spec->anchors; *a; a++) {
+        Anchor *anchors = realloc(r->anchors, (r->nanchors + 1) * sizeof(*anchors));
+        if (!anchors) goto nomem;
+        r->anchors = anchors;
+        Anchor *anchor = &r->anchors[r->nanchors];
+        if (!(anchor->text = dup_string(*a))) goto nomem;
+        anchor->len = strlen(*a);
+        anchor->rule = r->nrules - 1;
+        anchor->same = -1;
+        r->nanchors++;
+    }
+    return 0;
+
+nomem:
+    snprintf(err, errlen, "out of memory");
+    return -1;
+}
+
+// Built-in rules: well-known token prefixes, AWS key ids, private key blocks
+// and key=value style passwords
+static const char *const github_anchors[] = {"ghp_", "gho_", "ghu_", "ghs_", "ghr_", "github_pat_", NULL};
+static const char *const gitlab_anchors[] = {"glpat-", NULL};
+static const char *const slack_anchors[] = {"xoxb-", "xoxp-", "xoxa-", "xoxr-", "xoxs-", NULL};
+static const char *const stripe_anchors[] = {"sk_live_", "rk_live_", "sk_test_", NULL};
+static const char *const api_key_anchors[] = {"sk-", NULL};
+static const char *const jwt_anchors[] = {"eyJ", NULL};
+static const char *const bearer_anchors[] = {"Bearer ", "bearer ", NULL};
+static const char *const aws_anchors[] = {"AKIA", "ASIA", NULL};
+static const char *const key_anchors[] = {"-----BEGIN ", NULL};
+static const char *const password_anchors[] = {
+    "password", "Password", "PASSWORD", "passwd", "secret", "SECRET",
+    "api_key", "apikey", "API_KEY", "access_token", NULL
+};
+
+static const RedactRule default_rules[] = {
+    {"github", github_anchors, NULL, -1, 20, -1},
+    {"gitlab", gitlab_anchors, NULL, -1, 20, -1},
+    {"slack", slack_anchors, NULL, -1, 10, -1},
+    {"stripe", stripe_anchors, NULL, -1, 16, -1},
+    {"api-key", api_key_anchors, NULL, -1, 20, -1},
+    {"jwt", jwt_anchors, NULL, -1, 20, -1},
+    {"bearer", bearer_anchors, NULL, -1, 16, -1},
+    {"aws-key-id", aws_anchors, "A[KS]IA[0-9A-Z]{16}", 4, -1, 20},
+    {"private-key", key_anchors, "-----BEGIN [A-Z0-9 ]*PRIVATE KEY-----([^-]*)-----END", 0, -1, 16384},
+    {"password", password_anchors,
+     "[A-Za-z_]*[\"']?[[:space:]]*[:=][[:space:]]*[\"']?([^\"'[:space:]&,;]{4,})", 0, -1, 256},
+};
+
+int redactor_add_defaults(Redactor *r, char *err, size_t errlen)
+{
+    for (size_t i = 0; i < sizeof(default_rules) / sizeof(default_rules[0]); i++) {
+        if (redactor_add_rule(r, &default_rules[i], err, errlen) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static inline uint32_t prefix_hash(const unsigned char *p)
+{
+    uint32_t v = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    return (v * 0x9e3779b1u) >> 16;
+}
+
+static inline int prefix_set(const Redactor *r, const unsigned char *p)
+{
+    uint32_t h = prefix_hash(p);
+    return r->prefixes[h >> 3] & (1u << (h & 7));
+}
+
+#ifdef REDACT_TEDDY
+// Number of three-byte strings a bucket lets through, optionally with one
+// more prefix added: the product of its nibble set sizes
+static size_t bucket_span(const Redactor *r, unsigned char bit, const unsigned char *extra)
+{
+    size_t span = 1;
+    for (int m = 0; m < 6; m++) {
+        size_t n = 0;
+        for (int v = 0; v < 16; v++) {
+            int nib = extra ? (m & 1 ? extra[m / 2] >> 4 : extra[m / 2] & 15) : -1;
+            n += (r->teddy[m][v] & bit) || nib == v;
+        }
+        span *= n;
+    }
+    return span;
+}
+#endif
+
+static void add_prefix(Redactor *r, const unsigned char *text)
+{
+    uint32_t h = prefix_hash(text);
+    r->prefixes[h >> 3] |= (unsigned char)(1u << (h & 7));
+#ifdef REDACT_TEDDY
+    // A position is a candidate when one bucket has both nibbles of all
+    // three bytes, so a bucket also passes every mix of its prefixes'
+    // nibbles. Put each prefix where that adds the fewest strings.
+    unsigned char bit = 1;
+    size_t best = (size_t)-1;
+    for (int b = 0; b < BUCKETS; b++) {
+        unsigned char t = (unsigned char)(1u << b);
+        size_t cost = bucket_span(r, t, text) - bucket_span(r, t, NULL);
+        if (cost < best) {
+            best = cost;
+            bit = t;
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        r->teddy[2 * k][text[k] & 15] |= bit;
+        r->teddy[2 * k + 1][text[k] >> 4] |= bit;
+    }
+#endif
+}
+
+int redactor_compile(Redactor *r, char *err, size_t errlen)
+{
+    if (r->nanchors == 0) {
+        snprintf(err, errlen, "no redaction rules");
+        return -1;
+    }
+    size_t total = 1;
+    for (size_t i = 0; i < r->nanchors; i++)
+        total += r->anchors[i].len;
+    if (total > MAX_STATES) {
+        snprintf(err, errlen, "too many redaction anchors");
+        return -1;
+    }
+
+    r->next = calloc(total * 256, sizeof(*r->next));
+    r->out = malloc(total * sizeof(*r->out));
+    r->report = calloc(total, sizeof(*r->report));
+    r->link = calloc(total, sizeof(*r->link));
+    r->depth = calloc(total, sizeof(*r->depth));
+    uint16_t *fail = calloc(total, sizeof(*fail));
+    uint16_t *queue = malloc(total * sizeof(*queue));
+    if (!r->next || !r->out || !r->report || !r->link || !r->depth || !fail || !queue) {
+        free(fail);
+        free(queue);
+        snprintf(err, errlen, "out of memory");
+        return -1;
+    }
+    for (size_t s = 0; s < total; s++)
+        r->out[s] = -1;
+
+    // Trie of all anchors
+    r->nstates = 1;
+    for (size_t i = 0; i < r->nanchors; i++) {
+        const unsigned char *text = (const unsigned char *)r->anchors[i].text;
+        unsigned s = 0;
+        for (size_t k = 0; k < r->anchors[i].len; k++) {
+            uint16_t *edge = &r->next[(s << 8) | text[k]];
+            if (!*edge) {
+                *edge = (uint16_t)r->nstates;
+                r->depth[r->nstates] = (uint8_t)(k + 1);
+                r->nstates++;
+            }
+            s = *edge;
+        }
+        r->anchors[i].same = r->out[s];
+        r->out[s] = (int32_t)i;
+        size_t k = 0;
+        while (k < i && memcmp(r->anchors[k].text, text, 3) != 0) k++;
+        if (k == i) add_prefix(r, text);
+    }
+
+    // Breadth-first: failure links, then missing edges follow the failure
+    // link, turning the trie into a DFA
+    size_t qhead = 0, qtail = 0;
+    for (unsigned c = 0; c < 256; c++) {
+        unsigned t = r->next[c];
+        if (t) queue[qtail++] = (uint16_t)t;
+    }
+    while (qhead < qtail) {
+        unsigned s = queue[qhead++];
+        unsigned f = fail[s];
+        r->link[s] = r->out[f] >= 0 ? (uint16_t)f : r->report[f];
+        r->report[s] = r->out[s] >= 0 ? (uint16_t)s : r->link[s];
+        for (unsigned c = 0; c < 256; c++) {
+            uint16_t *edge = &r->next[(s << 8) | c];
+            if (*edge) {
+                fail[*edge] = r->next[(f << 8) | c];
+                queue[qtail++] = *edge;
+            } else {
+                *edge = r->next[(f << 8) | c];
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+
+    size_t scratch = 0;
+    for (size_t i = 0; i < r->nanchors; i++) {
+        const Rule *rule = &r->rules[r->anchors[i].rule];
+        size_t span = r->anchors[i].len + rule->max;
+        if (span > r->max_span) r->max_span = span;
+        if (rule->has_regex && rule->max > scratch) scratch = rule->max;
+    }
+    r->cap = READ_CHUNK + 2 * r->max_span + ANCHOR_MAX;
+    r->buf = malloc(r->cap);
+    r->scratch = malloc(scratch + 1);
+    if (!r->buf || !r->scratch) {
+        snprintf(err, errlen, "out of memory");
+        return -1;
+    }
+#ifdef REDACT_TEDDY
+    r->use_teddy = __builtin_cpu_supports("ssse3");
+#endif
+    r->compiled = 1;
+    return 0;
+}
+
+static size_t find_scalar(const Redactor *r, const unsigned char *b, size_t i, size_t limit)
+{
+    for (; i < limit; i++) {
+        if (prefix_set(r, b + i)) return i;
+    }
+    return limit;
+}
+
+#ifdef REDACT_TEDDY
+// First position in [i, limit) that starts an anchor prefix; b[limit + 1]
+// must be readable. Classifies 16 positions at a time by the nibbles of the
+// byte there and the two after it (all from one bucket), then confirms
+// candidates against the hashed prefix set.
+__attribute__((target("ssse3")))
+static inline __m128i teddy_nibbles(__m128i lo, __m128i hi, const unsigned char *p)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    return _mm_and_si128(_mm_shuffle_epi8(lo, _mm_and_si128(v, nibble)),
+                         _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+}
+
+// Written out so the six masks stay in registers
+#define TEDDY_CLASSIFY(m, p)                                            \
+    _mm_and_si128(_mm_and_si128(teddy_nibbles((m)[0], (m)[1], (p)),     \
+                                teddy_nibbles((m)[2], (m)[3], (p) + 1)), \
+                  teddy_nibbles((m)[4], (m)[5], (p) + 2))
+
+__attribute__((target("ssse3")))
+static size_t find_teddy(const Redactor *r, const unsigned char *b, size_t i, size_t limit)
+{
+    __m128i masks[6];
+    for (int k = 0; k < 6; k++)
+        masks[k] = _mm_loadu_si128((const __m128i *)r->teddy[k]);
+    const __m128i zero = _mm_setzero_si128();
+
+    while (i + 32 <= limit) {
+        __m128i lo = TEDDY_CLASSIFY(masks, b + i);
+        __m128i hi = TEDDY_CLASSIFY(masks, b + i + 16);
+        uint32_t mask = ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, zero)) |
+                         (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, zero)) << 16) ^ 0xffffffffu;
+        while (mask) {
+            size_t k = i + (size_t)__builtin_ctz(mask);
+            if (prefix_set(r, b + k)) return k;
+            mask &= mask - 1;
+        }
+        i += 32;
+    }
+    return find_scalar(r, b, i, limit);
+}
+#endif
+
+static size_t find_candidate(const Redactor *r, const unsigned char *b, size_t i, size_t limit)
+{
+#ifdef REDACT_TEDDY
+    if (r->use_teddy) return find_teddy(r, b, i, limit);
+#endif
+    return find_scalar(r, b, i, limit);
+}
+
+static int push_hit(Redactor *r, size_t start, size_t anchor)
+{
+    if (r->nhits == r->hits_cap) {
+        size_t cap = r->hits_cap ? r->hits_cap * 2 : 16;
+        Hit *hits = realloc(r->hits, cap * sizeof(*hits));
+        if (!hits) return -1;
+        r->hits = hits;
+        r->hits_cap = cap;
+    }
+    r->hits[r->nhits].start = start;
+    r->hits[r->nhits].anchor = anchor;
+    r->nhits++;
+    return 0;
+}
+
+// Run the automaton over new input, skipping ahead with the prefilter
+// whenever it is back at the root
+static int scan(Redactor *r)
+{
+    const unsigned char *b = (const unsigned char *)r->buf;
+    size_t i = r->scanned;
+    size_t to = r->end;
+    unsigned s = r->state;
+
+    while (i < to) {
+        if (s == 0) {
+            // The prefilter looks two bytes ahead; the last two wait for more input
+            i = i + 2 < to ? find_candidate(r, b, i, to - 2) : i;
+            if (i + 2 >= to) {
+                if (r->finished) {
+                    // Too short to hold an anchor
+                    i = to;
+                }
+                break;
+            }
+        }
+        s = r->next[(s << 8) | b[i]];
+        i++;
+        for (unsigned t = r->report[s]; t; t = r->link[t]) {
+            for (int a = r->out[t]; a >= 0; a = r->anchors[a].same) {
+                if (push_hit(r, i - r->anchors[a].len, (size_t)a) != 0) return -1;
+            }
+        }
+    }
+    r->scanned = i;
+    r->state = s;
+    return 0;
+}
+
+static void mask_span(Redactor *r, size_t from, size_t to)
+{
+    if (from >= to) return;
+    for (size_t k = from; k < to; k++) {
+        if (r->buf[k] != '\n' && r->buf[k] != '\r') r->buf[k] = r->mask;
+    }
+    r->count++;
+}
+
+// Mask what the rule matches at this hit; returns 0 if more input is needed.
+// Only scanned bytes are looked at, so masking never hides an anchor from
+// the scan that it would have seen had the input arrived in one read.
+static int resolve(Redactor *r, const Hit *hit)
+{
+    const Anchor *anchor = &r->anchors[hit->anchor];
+    const Rule *rule = &r->rules[anchor->rule];
+    size_t start = hit->start;
+    size_t end = r->finished ? r->end : r->scanned;
+
+    if (!rule->has_regex) {
+        size_t pos = start + anchor->len;
+        size_t limit = pos + rule->max;
+        while (pos < end && pos < limit && token_chars[(unsigned char)r->buf[pos]])
+            pos++;
+        if (pos == end && pos < limit && !r->finished) return 0;
+        if (pos - start - anchor->len >= rule->min)
+            mask_span(r, start + (rule->keep >= 0 ? (size_t)rule->keep : anchor->len), pos);
+        return 1;
+    }
+
+    size_t avail = end - start;
+    if (avail < rule->max && !r->finished) return 0;
+    size_t len = avail < rule->max ? avail : rule->max;
+    memcpy(r->scratch, r->buf + start, len);
+    r->scratch[len] = '\0';
+    regmatch_t match[2];
+    if (regexec(&rule->regex, r->scratch, 2, match, 0) == 0 && match[0].rm_so == 0) {
+        const regmatch_t *span = rule->has_group && match[1].rm_so >= 0 ? &match[1] : &match[0];
+        mask_span(r, start + (size_t)span->rm_so + (rule->keep > 0 ? (size_t)rule->keep : 0),
+                  start + (size_t)span->rm_eo);
+    }
+    return 1;
+}
+
+// Resolve hits in the order they were found, up to the first that needs
+// more input, and release everything no pending hit or partial anchor can
+// still reach. An earlier hit's mask can cut a later hit's token short, so
+// resolving a later hit first would make the output depend on how the
+// input was split into reads.
+static void settle(Redactor *r)
+{
+    size_t limit = r->finished ? r->end : r->scanned - r->depth[r->state];
+    size_t kept = 0;
+    for (size_t k = 0; k < r->nhits; k++) {
+        if (!kept && resolve(r, &r->hits[k])) continue;
+        if (r->hits[k].start < limit) limit = r->hits[k].start;
+        r->hits[kept++] = r->hits[k];
+    }
+    r->nhits = kept;
+    if (limit > r->ready) r->ready = limit;
+}
+
+char *redactor_buffer(Redactor *r, size_t *cap)
+{
+    if (r->head && r->cap - r->end < READ_CHUNK) {
+        size_t shift = r->head;
+        memmove(r->buf, r->buf + shift, r->end - shift);
+        r->head = 0;
+        r->ready -= shift;
+        r->scanned -= shift;
+        r->end -= shift;
+        for (size_t k = 0; k < r->nhits; k++)
+            r->hits[k].start -= shift;
+    }
+    size_t space = r->cap - r->end;
+    *cap = space < READ_CHUNK ? space : READ_CHUNK;
+    return r->buf + r->end;
+}
+
+int redactor_commit(Redactor *r, size_t len)
+{
+    r->end += len;
+    if (scan(r) != 0) return -1;
+    settle(r);
+    return 0;
+}
+
+void redactor_finish(Redactor *r)
+{
+    r->finished = 1;
+    // Hits found now only need the existing window, so nothing can fail
+    // beyond running out of memory for them; mask to the end in that case
+    if (scan(r) != 0) {
+        mask_span(r, r->ready, r->end);
+        r->nhits = 0;
+    }
+    settle(r);
+}
+
+int redactor_finished(const Redactor *r)
+{
+    return r->finished;
+}
+
+const char *redactor_output(const Redactor *r, size_t *len)
+{
+    *len = r->ready - r->head;
+    return r->buf + r->head;
+}
+
+void redactor_consume(Redactor *r, size_t len)
+{
+    r->head += len;
+}
+
+unsigned long redactor_count(const Redactor *r)
+{
+    return r->count;
+}
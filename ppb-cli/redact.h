@@ -0,0 +1,53 @@
+#ifndef PPB_REDACT_H
+#define PPB_REDACT_H
+
+#include <stddef.h>
+
+// Streaming secret redaction.
+//
+// Every rule has one or more literal anchors ("ghp_", "-----BEGIN "). All
+// anchors are found in one pass by an Aho-Corasick automaton, with a SIMD
+// prefilter skipping text that cannot start one. At each anchor the rule
+// decides what to mask: either the run of token characters that follows it,
+// or the match of a POSIX extended regex starting there. Masking replaces
+// bytes one for one (newlines are kept), so the output has the input's size.
+//
+// Input is pushed through a window; bytes are released once no pending
+// match can still cover them, so matches spanning reads are handled.
+
+typedef struct Redactor Redactor;
+
+typedef struct {
+    const char *name;
+    const char *const *anchors; // NULL-terminated
+    const char *regex;          // NULL: mask the token after the anchor
+    long keep;                  // leading bytes left visible; -1 for the default
+    long min;                   // token rules: shortest token worth masking; -1 for default
+    long max;                   // longest match; -1 for the default
+} RedactRule;
+
+Redactor *redactor_new(char mask);
+void redactor_free(Redactor *r);
+
+// Add a rule; returns 0, or -1 with a message in err
+int redactor_add_rule(Redactor *r, const RedactRule *rule, char *err, size_t errlen);
+// Add the built-in rules for common token formats, keys and passwords
+int redactor_add_defaults(Redactor *r, char *err, size_t errlen);
+// Build the matcher; no rules can be added afterwards
+int redactor_compile(Redactor *r, char *err, size_t errlen);
+
+// Space to read input into, and hand it over once read; commit fails only
+// when out of memory
+char *redactor_buffer(Redactor *r, size_t *cap);
+int redactor_commit(Redactor *r, size_t len);
+// End of input: everything still held becomes ready
+void redactor_finish(Redactor *r);
+int redactor_finished(const Redactor *r);
+
+// Redacted bytes ready to send; consume them when sent
+const char *redactor_output(const Redactor *r, size_t *len);
+void redactor_consume(Redactor *r, size_t len);
+
+unsigned long redactor_count(const Redactor *r);
+
+#endif
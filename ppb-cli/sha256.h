@@ -0,0 +1,23 @@
+#ifndef PPB_SHA256_H
+#define PPB_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SHA-256, matching the server's paste checksums (FIPS 180-4)
+
+#define SHA256_HEX_SIZE 65
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;            // bytes hashed so far
+    unsigned char block[64];
+    size_t used;
+} Sha256;
+
+void sha256_init(Sha256 *ctx);
+void sha256_update(Sha256 *ctx, const void *data, size_t len);
+// Lowercase hex digest, NUL-terminated
+void sha256_final_hex(Sha256 *ctx, char hex[SHA256_HEX_SIZE]);
+
+#endif
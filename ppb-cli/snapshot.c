@@ -0,0 +1,419 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vendor/cJSON.h"
+
+#define SNAPSHOT_MAGIC "PPBSNAP1"   // last byte is the format version
+#define SNAPSHOT_ENDIAN 0x01020304u
+#define SNAPSHOT_MAX (16 * 1024 * 1024)
+
+#ifdef __APPLE__
+#define MTIME_NSEC(st) ((st)->st_mtimespec.tv_nsec)
+#else
+#define MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#endif
+
+// Start of the image. Strings are NUL-terminated and referenced by offset;
+// 0 means absent, since the header sits there.
+typedef struct {
+    char magic[8];
+    uint32_t endian;            // a snapshot from another byte order reads as stale
+    uint32_t length;            // of the whole image
+
+    // The JSON it was built from
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t path;
+
+    uint32_t default_server;
+    uint32_t default_token;
+    uint32_t default_group;
+    uint32_t servers;           // server_count x {name, url, token}
+    uint32_t server_count;
+    uint32_t groups;            // group_count x {name, members}
+    uint32_t group_count;
+    uint32_t redact;
+    uint32_t compact_keep;
+    int32_t redact_enabled;
+    int32_t compact;
+    int32_t compact_enabled;
+    int32_t compact_fuzzy;
+    int32_t spool_enabled;
+    int64_t spool_memory_mb;
+    int64_t spool_limit_mb;
+} Header;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;                 // out of memory, or over SNAPSHOT_MAX
+} Image;
+
+// Append n bytes at a 4-byte boundary; returns their offset
+static uint32_t put_bytes(Image *img, const void *p, size_t n)
+{
+    size_t at = (img->len + 3) & ~(size_t)3;
+    if (img->failed || at + n > SNAPSHOT_MAX) {
+        img->failed = 1;
+        return 0;
+    }
+    if (at + n > img->cap) {
+        size_t cap = img->cap ? img->cap * 2 : 4096;
+        while (cap < at + n) cap *= 2;
+        char *grown = realloc(img->data, cap);
+        if (!grown) {
+            img->failed = 1;
+            return 0;
+        }
+        img->data = grown;
+        img->cap = cap;
+    }
+    memset(img->data + img->len, 0, at - img->len);
+    if (p) memcpy(img->data + at, p, n);
+    else memset(img->data + at, 0, n);
+    img->len = at + n;
+    return (uint32_t)at;
+}
+
+static uint32_t put_string(Image *img, const char *s)
+{
+    return s ? put_bytes(img, s, strlen(s) + 1) : 0;
+}
+
+static void set_u32(Image *img, uint32_t at, uint32_t value)
+{
+    if (!img->failed) memcpy(img->data + at, &value, sizeof(value));
+}
+
+static const char *json_text(const cJSON *obj, const char *name)
+{
+    return cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(obj, name));
+}
+
+static int json_flag(const cJSON *obj, const char *name, int fallback)
+{
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(obj, name);
+    if (item && (item->type & 0xFF) == cJSON_True) return 1;
+    if (item && (item->type & 0xFF) == cJSON_False) return 0;
+    return fallback;
+}
+
+static int64_t json_number(const cJSON *obj, const char *name)
+{
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(obj, name);
+    return cJSON_IsNumber(item) ? (int64_t)cJSON_GetNumberValue(item) : -1;
+}
+
+static void put_servers(Image *img, Header *h, const cJSON *servers)
+{
+    size_t count = 0;
+    for (const cJSON *s = cJSON_IsObject(servers) ? servers->child : NULL; s; s = s->next)
+        count += cJSON_IsObject(s) && s->string;
+    h->server_count = (uint32_t)count;
+    h->servers = put_bytes(img, NULL, count * 3 * sizeof(uint32_t));
+    size_t i = 0;
+    for (const cJSON *s = cJSON_IsObject(servers) ? servers->child : NULL; s; s = s->next) {
+        if (!cJSON_IsObject(s) || !s->string) continue;
+        uint32_t at = h->servers + (uint32_t)(i++ * 3 * sizeof(uint32_t));
+        uint32_t name = put_string(img, s->string);
+        uint32_t url = put_string(img, json_text(s, "url"));
+        uint32_t token = put_string(img, json_text(s, "token"));
+        set_u32(img, at, name);
+        set_u32(img, at + 4, url);
+        set_u32(img, at + 8, token);
+    }
+}
+
+static void put_groups(Image *img, Header *h, const cJSON *groups)
+{
+    size_t count = 0;
+    for (const cJSON *g = cJSON_IsObject(groups) ? groups->child : NULL; g; g = g->next)
+        count += cJSON_IsArray(g) && g->string;
+    h->group_count = (uint32_t)count;
+    h->groups = put_bytes(img, NULL, count * 2 * sizeof(uint32_t));
+    size_t i = 0;
+    for (const cJSON *g = cJSON_IsObject(groups) ? groups->child : NULL; g; g = g->next) {
+        if (!cJSON_IsArray(g) || !g->string) continue;
+        size_t len = 1;
+        for (const cJSON *m = g->child; m; m = m->next)
+            if (cJSON_GetStringValue(m)) len += strlen(m->valuestring) + 1;
+        char *members = calloc(1, len);
+        if (!members) {
+            img->failed = 1;
+            return;
+        }
+        for (const cJSON *m = g->child; m; m = m->next) {
+            if (!cJSON_GetStringValue(m)) continue;
+            if (members[0]) strcat(members, ",");
+            strcat(members, m->valuestring);
+        }
+        uint32_t at = h->groups + (uint32_t)(i++ * 2 * sizeof(uint32_t));
+        uint32_t name = put_string(img, g->string);
+        uint32_t list = put_string(img, members);
+        free(members);
+        set_u32(img, at, name);
+        set_u32(img, at + 4, list);
+    }
+}
+
+// -1 if json is not valid JSON, -2 if the image could not be built
+static int build_image(const char *json, const char *path, const struct stat *st, Image *img)
+{
+    // Lazily: values the image does not take are never decoded, and the
+    // redact section goes back out as text the way it was written
+    cJSON *root = cJSON_ParseLazy(json, strlen(json));
+    if (!root || !cJSON_IsObject(root)) {
+        cJSON_Delete(root);
+        return -1;
+    }
+
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.endian = SNAPSHOT_ENDIAN;
+    h.dev = (uint64_t)st->st_dev;
+    h.ino = (uint64_t)st->st_ino;
+    h.size = (int64_t)st->st_size;
+    h.mtime_sec = (int64_t)st->st_mtime;
+    h.mtime_nsec = (int64_t)MTIME_NSEC(st);
+    put_bytes(img, NULL, sizeof(h));
+
+    h.path = put_string(img, path);
+    h.default_server = put_string(img, json_text(root, "default_server"));
+    h.default_token = put_string(img, json_text(root, "default_token"));
+    h.default_group = put_string(img, json_text(root, "default_group"));
+    put_servers(img, &h, cJSON_GetObjectItemCaseSensitive(root, "servers"));
+    put_groups(img, &h, cJSON_GetObjectItemCaseSensitive(root, "groups"));
+
+    // Only needed with --redact, so kept as text and parsed then
+    const cJSON *redact = cJSON_GetObjectItemCaseSensitive(root, "redact");
+    if (cJSON_IsObject(redact)) {
+        h.redact_enabled = json_flag(redact, "enabled", 0);
+        char *text = cJSON_PrintUnformatted(redact);
+        if (!text) img->failed = 1;
+        h.redact = put_string(img, text);
+        free(text);
+    }
+
+    const cJSON *compact = cJSON_GetObjectItemCaseSensitive(root, "compact");
+    h.compact = cJSON_IsObject(compact);
+    h.compact_enabled = h.compact ? json_flag(compact, "enabled", 0) : 0;
+    h.compact_fuzzy = h.compact ? json_flag(compact, "fuzzy", 0) : 0;
+    h.compact_keep = h.compact ? put_string(img, json_text(compact, "keep")) : 0;
+
+    const cJSON *spool = cJSON_GetObjectItemCaseSensitive(root, "spool");
+    int has_spool = cJSON_IsObject(spool);
+    h.spool_enabled = has_spool ? json_flag(spool, "enabled", -1) : -1;
+    h.spool_memory_mb = has_spool ? json_number(spool, "memory_mb") : -1;
+    h.spool_limit_mb = has_spool ? json_number(spool, "limit_mb") : -1;
+
+    cJSON_Delete(root);
+    h.length = (uint32_t)img->len;
+    if (img->failed) return -2;
+    memcpy(img->data, &h, sizeof(h));
+    return 0;
+}
+
+static const char *string_at(const char *base, size_t len, uint32_t at)
+{
+    if (at == 0 || at >= len || !memchr(base + at, '\0', len - at)) return NULL;
+    return base + at;
+}
+
+static uint32_t u32_at(const char *base, uint32_t at)
+{
+    uint32_t value;
+    memcpy(&value, base + at, sizeof(value));
+    return value;
+}
+
+// Point out at the image; -1 if it is malformed
+static int decode(ConfigSnapshot *out, const char *base, size_t len)
+{
+    Header h;
+    if (len < sizeof(h)) return -1;
+    memcpy(&h, base, sizeof(h));
+    if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 || h.endian != SNAPSHOT_ENDIAN || h.length != len)
+        return -1;
+    if ((uint64_t)h.servers + (uint64_t)h.server_count * 12 > len || (uint64_t)h.groups + (uint64_t)h.group_count * 8 > len)
+        return -1;
+
+    out->default_server = string_at(base, len, h.default_server);
+    out->default_token = string_at(base, len, h.default_token);
+    out->default_group = string_at(base, len, h.default_group);
+    out->redact = string_at(base, len, h.redact);
+    out->redact_enabled = h.redact_enabled;
+    out->compact = h.compact;
+    out->compact_enabled = h.compact_enabled;
+    out->compact_fuzzy = h.compact_fuzzy;
+    out->compact_keep = string_at(base, len, h.compact_keep);
+    out->spool_enabled = h.spool_enabled;
+    out->spool_memory_mb = (long)h.spool_memory_mb;
+    out->spool_limit_mb = (long)h.spool_limit_mb;
+
+    out->servers = calloc(h.server_count ? h.server_count : 1, sizeof(*out->servers));
+    out->groups = calloc(h.group_count ? h.group_count : 1, sizeof(*out->groups));
+    if (!out->servers || !out->groups) return -1;
+    for (uint32_t i = 0; i < h.server_count; i++) {
+        SnapshotServer *s = &out->servers[out->server_count];
+        uint32_t at = h.servers + i * 12;
+        s->name = string_at(base, len, u32_at(base, at));
+        s->url = string_at(base, len, u32_at(base, at + 4));
+        s->token = string_at(base, len, u32_at(base, at + 8));
+        if (!s->name) return -1;
+        out->server_count++;
+    }
+    for (uint32_t i = 0; i < h.group_count; i++) {
+        SnapshotGroup *g = &out->groups[out->group_count];
+        uint32_t at = h.groups + i * 8;
+        g->name = string_at(base, len, u32_at(base, at));
+        g->members = string_at(base, len, u32_at(base, at + 4));
+        if (!g->name || !g->members) return -1;
+        out->group_count++;
+    }
+    return 0;
+}
+
+// config.json -> .config.json.snap, .ppb-config.json -> .ppb-config.json.snap
+static int snapshot_path(const char *path, char *out, size_t cap)
+{
+    const char *slash = strrchr(path, '/');
+    const char *base = slash ? slash + 1 : path;
+    int n = snprintf(out, cap, "%.*s%s%s.snap", (int)(base - path), path, base[0] == '.' ? "" : ".", base);
+    return n < 0 || (size_t)n >= cap ? -1 : 0;
+}
+
+// Map the snapshot at snap_path if it was built from this JSON file
+static int map_snapshot(const char *snap_path, const char *path, const struct stat *json, ConfigSnapshot *out)
+{
+    int fd = open(snap_path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    // Only trust a snapshot nobody else could have written
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 022) ||
+        st.st_size < (off_t)sizeof(Header) || st.st_size > SNAPSHOT_MAX) {
+        close(fd);
+        return -1;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    Header h;
+    memcpy(&h, map, sizeof(h));
+    const char *built_from = string_at(map, len, h.path);
+    int current = h.dev == (uint64_t)json->st_dev && h.ino == (uint64_t)json->st_ino &&
+                  h.size == (int64_t)json->st_size && h.mtime_sec == (int64_t)json->st_mtime &&
+                  h.mtime_nsec == (int64_t)MTIME_NSEC(json) && built_from && strcmp(built_from, path) == 0;
+    if (!current || decode(out, map, len) != 0) {
+        munmap(map, len);
+        snapshot_free(out);
+        return -1;
+    }
+    out->image = map;
+    out->image_len = len;
+    out->mapped = 1;
+    return 0;
+}
+
+// Best effort: replaced atomically, so a concurrent run maps the old or the
+// new snapshot, never half of one
+static void write_snapshot(const char *snap_path, const char *data, size_t len)
+{
+    char tmp[1040];
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", snap_path) >= (int)sizeof(tmp)) return;
+    int fd = mkstemp(tmp);
+    if (fd < 0) return;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t w = write(fd, data + done, len - done);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        done += (size_t)w;
+    }
+    if (close(fd) != 0 || done != len || rename(tmp, snap_path) != 0)
+        unlink(tmp);
+}
+
+int snapshot_load(const char *path, size_t max_bytes, int use_snapshot, ConfigSnapshot *out)
+{
+    memset(out, 0, sizeof(*out));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return SNAPSHOT_UNREADABLE;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size > max_bytes) {
+        close(fd);
+        return SNAPSHOT_UNREADABLE;
+    }
+
+    char snap_path[1024];
+    int snapshots = use_snapshot && snapshot_path(path, snap_path, sizeof(snap_path)) == 0;
+    if (snapshots && map_snapshot(snap_path, path, &st, out) == 0) {
+        close(fd);
+        return SNAPSHOT_OK;
+    }
+
+    char *json = malloc((size_t)st.st_size + 1);
+    size_t got = 0;
+    while (json && got < (size_t)st.st_size) {
+        ssize_t n = read(fd, json + got, (size_t)st.st_size - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    close(fd);
+    if (!json) return SNAPSHOT_UNREADABLE;
+    json[got] = '\0';
+
+    Image img = {0};
+    int rc = build_image(json, path, &st, &img);
+    free(json);
+    if (rc != 0 || decode(out, img.data, img.len) != 0) {
+        free(img.data);
+        snapshot_free(out);
+        return rc == -1 ? SNAPSHOT_INVALID : SNAPSHOT_UNREADABLE;
+    }
+    out->image = img.data;
+    out->image_len = img.len;
+    if (snapshots) write_snapshot(snap_path, img.data, img.len);
+    return SNAPSHOT_OK;
+}
+
+void snapshot_free(ConfigSnapshot *snap)
+{
+    if (snap->mapped) munmap(snap->image, snap->image_len);
+    else free(snap->image);
+    free(snap->servers);
+    free(snap->groups);
+    memset(snap, 0, sizeof(*snap));
+}
+
+const SnapshotServer *snapshot_server(const ConfigSnapshot *snap, const char *name)
+{
+    for (size_t i = 0; i < snap->server_count; i++)
+        if (strcmp(snap->servers[i].name, name) == 0) return &snap->servers[i];
+    return NULL;
+}
+
+const SnapshotGroup *snapshot_group(const ConfigSnapshot *snap, const char *name)
+{
+    for (size_t i = 0; i < snap->group_count; i++)
+        if (strcmp(snap->groups[i].name, name) == 0) return &snap->groups[i];
+    return NULL;
+}
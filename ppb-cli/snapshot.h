@@ -0,0 +1,63 @@
+#ifndef PPB_SNAPSHOT_H
+#define PPB_SNAPSHOT_H
+
+#include <stddef.h>
+
+// The settings put reads from a config file, kept in a flat binary snapshot
+// next to it (.config.json.snap for config.json) so that a run maps the
+// snapshot instead of parsing JSON. A snapshot records the path, device,
+// inode, size and mtime of the JSON it came from; when any of them differ
+// the JSON is parsed again and the snapshot rewritten.
+
+// Outcome of snapshot_load()
+enum {
+    SNAPSHOT_OK = 0,
+    SNAPSHOT_UNREADABLE,        // no such file, or larger than max_bytes
+    SNAPSHOT_INVALID,           // not valid JSON
+};
+
+typedef struct {
+    const char *name;
+    const char *url;            // NULL if absent
+    const char *token;          // NULL if absent
+} SnapshotServer;
+
+typedef struct {
+    const char *name;
+    const char *members;        // comma-separated server names or URLs
+} SnapshotGroup;
+
+// Strings point into the snapshot; NULL, or -1 for numbers, means absent
+typedef struct {
+    const char *default_server;
+    const char *default_token;
+    const char *default_group;
+    SnapshotServer *servers;    // "servers" entries that are objects
+    size_t server_count;
+    SnapshotGroup *groups;      // "groups" entries that are arrays
+    size_t group_count;
+    const char *redact;         // the "redact" object as JSON text
+    int redact_enabled;
+    int compact;                // "compact" object present
+    int compact_enabled;
+    int compact_fuzzy;
+    const char *compact_keep;
+    int spool_enabled;
+    long spool_memory_mb;
+    long spool_limit_mb;
+    int mapped;                 // 1 if read from the snapshot, 0 if parsed
+
+    void *image;                // private
+    size_t image_len;
+} ConfigSnapshot;
+
+// Load the config at path, from its snapshot when that is current. With
+// use_snapshot 0 the JSON is always parsed and no snapshot is written.
+int snapshot_load(const char *path, size_t max_bytes, int use_snapshot, ConfigSnapshot *out);
+
+void snapshot_free(ConfigSnapshot *snap);
+
+const SnapshotServer *snapshot_server(const ConfigSnapshot *snap, const char *name);
+const SnapshotGroup *snapshot_group(const ConfigSnapshot *snap, const char *name);
+
+#endif
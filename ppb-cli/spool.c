@@ -0,0 +1,223 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "spool.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SPOOL_CHUNK (256 * 1024)
+
+static int write_all(int fd, const char *p, size_t n)
+{
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) return -1;
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+static int temp_file(void)
+{
+    const char *dir = getenv("TMPDIR");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/ppb-spool-XXXXXX", dir && dir[0] ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Error: could not create a spool file in %s: %s\n",
+                dir && dir[0] ? dir : "/tmp", strerror(errno));
+        return -1;
+    }
+    unlink(path);
+    return fd;
+}
+
+int spool_input(SpoolSource source, void *ctx, long long *size, char checksum[SHA256_HEX_SIZE])
+{
+    char *buf = malloc(SPOOL_CHUNK);
+    int fd = buf ? temp_file() : -1;
+    if (!buf) fprintf(stderr, "Error: not enough memory for spooling\n");
+    if (fd < 0) {
+        free(buf);
+        return -1;
+    }
+
+    Sha256 sha;
+    sha256_init(&sha);
+    *size = 0;
+    for (;;) {
+        ssize_t got = source(ctx, buf, SPOOL_CHUNK);
+        if (got < 0) goto failed;
+        if (got == 0) break;
+        if (write_all(fd, buf, (size_t)got) != 0) {
+            fprintf(stderr, "Error: could not write spool file: %s\n", strerror(errno));
+            goto failed;
+        }
+        sha256_update(&sha, buf, (size_t)got);
+        *size += got;
+    }
+    sha256_final_hex(&sha, checksum);
+    free(buf);
+    if (lseek(fd, 0, SEEK_SET) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+
+failed:
+    free(buf);
+    close(fd);
+    return -1;
+}
+
+// Move what is in memory to a temp file and keep spooling there
+static int spill(Spool *spool)
+{
+    spool->fd = temp_file();
+    if (spool->fd < 0) return -1;
+    if (write_all(spool->fd, spool->mem, spool->mem_len) != 0) {
+        fprintf(stderr, "Error: could not write spool file: %s\n", strerror(errno));
+        return -1;
+    }
+    free(spool->mem);
+    spool->mem = NULL;
+    spool->mem_len = spool->mem_cap = 0;
+    return 0;
+}
+
+// Make room for want more bytes in memory, up to the memory budget;
+// returns how many fit
+static size_t reserve(Spool *spool, size_t want, size_t memory)
+{
+    size_t room = memory - spool->mem_len;
+    if (want > room) want = room;
+    if (spool->mem_len + want > spool->mem_cap) {
+        size_t cap = spool->mem_cap ? spool->mem_cap * 2 : SPOOL_CHUNK;
+        if (cap < spool->mem_len + want) cap = spool->mem_len + want;
+        if (cap > memory) cap = memory;
+        char *grown = realloc(spool->mem, cap);
+        if (!grown) return 0;
+        spool->mem = grown;
+        spool->mem_cap = cap;
+    }
+    return want;
+}
+
+Spool *spool_fill(SpoolSource source, void *ctx, size_t memory, long long limit)
+{
+    Spool *spool = calloc(1, sizeof(*spool));
+    char *chunk = malloc(SPOOL_CHUNK);
+    if (!spool || !chunk) {
+        fprintf(stderr, "Error: not enough memory for spooling\n");
+        free(spool);
+        free(chunk);
+        return NULL;
+    }
+    spool->source = source;
+    spool->ctx = ctx;
+    spool->fd = -1;
+
+    while (limit < 0 || spool->size < limit) {
+        size_t want = SPOOL_CHUNK;
+        if (limit >= 0 && (long long)want > limit - spool->size) want = (size_t)(limit - spool->size);
+
+        // Straight into memory while it fits; otherwise through chunk, and
+        // spill only if the input turns out not to have ended
+        size_t fits = spool->fd < 0 ? reserve(spool, want, memory) : 0;
+        char *dest = fits ? spool->mem + spool->mem_len : chunk;
+        ssize_t got = source(ctx, dest, fits ? fits : want);
+        if (got < 0) goto failed;
+        if (got == 0) {
+            spool->complete = 1;
+            break;
+        }
+        if (fits) {
+            spool->mem_len += (size_t)got;
+        } else {
+            if (spool->fd < 0 && spill(spool) != 0) goto failed;
+            if (write_all(spool->fd, chunk, (size_t)got) != 0) {
+                fprintf(stderr, "Error: could not write spool file: %s\n", strerror(errno));
+                goto failed;
+            }
+        }
+        spool->size += got;
+    }
+    free(chunk);
+    if (spool->fd >= 0 && lseek(spool->fd, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Error: could not read spool file: %s\n", strerror(errno));
+        spool_free(spool);
+        return NULL;
+    }
+    return spool;
+
+failed:
+    free(chunk);
+    spool_free(spool);
+    return NULL;
+}
+
+ssize_t spool_read(void *ctx, char *dest, size_t cap)
+{
+    Spool *spool = (Spool *)ctx;
+    if (spool->sent == spool->size)
+        return spool->complete ? 0 : spool->source(spool->ctx, dest, cap);
+
+    if ((long long)cap > spool->size - spool->sent) cap = (size_t)(spool->size - spool->sent);
+    ssize_t got;
+    if (spool->fd < 0) {
+        memcpy(dest, spool->mem + spool->sent, cap);
+        got = (ssize_t)cap;
+    } else {
+        do {
+            got = read(spool->fd, dest, cap);
+        } while (got < 0 && errno == EINTR);
+        if (got <= 0) {
+            fprintf(stderr, "Error: could not read spool file: %s\n", got < 0 ? strerror(errno) : "truncated");
+            return -1;
+        }
+    }
+    spool->sent += got;
+    return got;
+}
+
+void spool_free(Spool *spool)
+{
+    if (!spool) return;
+    if (spool->fd >= 0) close(spool->fd);
+    free(spool->mem);
+    free(spool);
+}
+
+int hash_file(int fd, long long *size, char checksum[SHA256_HEX_SIZE])
+{
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    char *buf = malloc(SPOOL_CHUNK);
+    if (start < 0 || !buf) {
+        free(buf);
+        return -1;
+    }
+
+    Sha256 sha;
+    sha256_init(&sha);
+    *size = 0;
+    for (;;) {
+        ssize_t got = read(fd, buf, SPOOL_CHUNK);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            fprintf(stderr, "Error: could not read input: %s\n", strerror(errno));
+            free(buf);
+            return -1;
+        }
+        if (got == 0) break;
+        sha256_update(&sha, buf, (size_t)got);
+        *size += got;
+    }
+    free(buf);
+    sha256_final_hex(&sha, checksum);
+    return lseek(fd, start, SEEK_SET) == start ? 0 : -1;
+}
@@ -0,0 +1,46 @@
+#ifndef PPB_SPOOL_H
+#define PPB_SPOOL_H
+
+#include <sys/types.h>
+
+#include "sha256.h"
+
+// Input read to the end before the upload starts, into an unlinked file in
+// $TMPDIR (default /tmp), hashed on the way
+
+// Fills dest with up to cap bytes of input; 0 at the end, -1 on error
+typedef ssize_t (*SpoolSource)(void *ctx, char *dest, size_t cap);
+
+// Returns the file descriptor, positioned at the start, or -1 with a
+// message printed. size gets the byte count, checksum the hex SHA-256.
+int spool_input(SpoolSource source, void *ctx, long long *size, char checksum[SHA256_HEX_SIZE]);
+
+// Read-ahead for input that arrives slowly: held in memory up to a
+// threshold, then in an unlinked temp file, so the connection is opened
+// only once the input has ended (or the spool is full) and the body goes
+// out at line rate with a known length.
+typedef struct {
+    SpoolSource source;         // where input continues past a full spool
+    void *ctx;
+    char *mem;                  // everything read, while it fits in memory
+    size_t mem_len;
+    size_t mem_cap;
+    int fd;                     // everything read once spilled, -1 before
+    long long size;             // bytes spooled
+    long long sent;             // bytes handed out by spool_read()
+    int complete;               // the input ended within the limit
+} Spool;
+
+// Read until the input ends or limit bytes (-1: no limit) have been spooled,
+// keeping up to memory bytes in memory. NULL with a message on error.
+Spool *spool_fill(SpoolSource source, void *ctx, size_t memory, long long limit);
+
+// A SpoolSource: the spooled bytes, then the rest of the input
+ssize_t spool_read(void *spool, char *dest, size_t cap);
+
+void spool_free(Spool *spool);
+
+// Hash the rest of a regular file, then seek back to where it was
+int hash_file(int fd, long long *size, char checksum[SHA256_HEX_SIZE]);
+
+#endif
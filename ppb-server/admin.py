@@ -0,0 +1,487 @@
+"""Offline administration commands for ppb-server.
+
+Usage:
+    python admin.py reindex
+    python admin.py export [--since SEQ | --checkpoint FILE] > backup.tar
+    python admin.py import [--file backup.tar]
+    python admin.py bulk-import [--jobs N] [--state FILE] PATH... | --archive FILE
+    python admin.py migrate-meta --to xattr|files
+    python admin.py repair
+    python admin.py dedup-stats
+    python admin.py index-similar
+
+Commands use the same storage and index configuration (PPB_STORAGE,
+PPB_INDEX_PATH, ...) as the server, so run them from the server directory
+with the same environment.
+"""
+
+import argparse
+import collections
+import concurrent.futures
+import hashlib
+import io
+import json
+import logging
+import os
+import sys
+import tarfile
+import time
+from pathlib import Path
+from typing import Callable, Iterator
+
+import server
+
+logger = logging.getLogger("admin")
+
+MANIFEST_NAME = "ppb-export.json"
+REINDEX_BATCH = 1000
+PROGRESS_INTERVAL = 5.0  # seconds
+
+
+def reindex(args) -> int:
+    """Add every metadata record in the store to the index."""
+    batch = []
+    added = 0
+    seen = 0
+    for key in server.store.list(f"{server.META_DIR.name}/"):
+        if not key.endswith(".json"):
+            continue
+        try:
+            batch.append(json.loads(server.store.get(key)))
+        except (OSError, ValueError) as e:
+            logger.warning(f"Skipping unreadable metadata {key}: {e}")
+            continue
+        seen += 1
+        if len(batch) >= REINDEX_BATCH:
+            added += server.index.add_many(batch)
+            batch.clear()
+    local = server.local_store()
+    if local is not None:
+        # Objects whose metadata lives in an xattr have no meta file
+        for key in local.list(f"{server.RAW_DIR.name}/"):
+            try:
+                record = local.get_xattr(key, server.META_XATTR)
+                if record is None:
+                    continue
+                batch.append(json.loads(record))
+            except (OSError, ValueError) as e:
+                logger.warning(f"Skipping unreadable metadata on {key}: {e}")
+                continue
+            seen += 1
+            if len(batch) >= REINDEX_BATCH:
+                added += server.index.add_many(batch)
+                batch.clear()
+    if batch:
+        added += server.index.add_many(batch)
+    logger.info(f"Reindexed {seen} records, {added} new")
+    return 0
+
+
+def read_checkpoint(path: Path) -> int:
+    try:
+        return int(json.loads(path.read_text())["seq"])
+    except FileNotFoundError:
+        return 0
+
+
+def write_checkpoint(path: Path, seq: int) -> None:
+    tmp = path.with_name(path.name + ".tmp")
+    tmp.write_text(json.dumps({"seq": seq, "exported_at": time.time()}) + "\n")
+    os.replace(tmp, path)
+
+
+def add_member(archive: tarfile.TarFile, name: str, size: int, mtime: float, fileobj) -> None:
+    info = tarfile.TarInfo(name)
+    info.size = size
+    info.mtime = int(mtime)
+    info.mode = server.PERMISSIONS
+    archive.addfile(info, fileobj)
+
+
+def export(args) -> int:
+    """Stream every paste added after a checkpoint as a tar archive on stdout."""
+    checkpoint = Path(args.checkpoint) if args.checkpoint else None
+    since = args.since if args.since is not None else (read_checkpoint(checkpoint) if checkpoint else 0)
+
+    out = sys.stdout.buffer
+    if out.isatty():
+        logger.error("Refusing to write an archive to a terminal; redirect stdout")
+        return 1
+
+    last_seq = since
+    count = 0
+    total = 0
+    # "w|" writes a non-seekable stream, so nothing is buffered beyond one block
+    with tarfile.open(fileobj=out, mode="w|") as archive:
+        for row in server.index.since(since):
+            sha = row["checksum"]
+            data_key = server.raw_key(sha)
+            meta_record_key = server.meta_key(sha)
+            try:
+                size = server.store.size(data_key)
+                if server.store is server.local_store():
+                    # One fd serves both the object and its xattr metadata
+                    stream, meta = server.store.open_with_xattr(data_key, server.META_XATTR)
+                else:
+                    # A wrapper (chunks, compressed frames) keeps something
+                    # other than the paste on disk, so read through it
+                    record = server.read_meta(sha)
+                    meta = json.dumps(record, indent=2).encode() if record is not None else None
+                    stream = server.store.open(data_key)
+                with stream:
+                    add_member(archive, data_key, size, row["created_at"], stream)
+                if meta is None:
+                    meta = server.store.get(meta_record_key)
+            except FileNotFoundError:
+                logger.warning(f"Indexed paste {sha[:16]} is missing from the store, skipping")
+                last_seq = row["seq"]
+                continue
+            add_member(archive, meta_record_key, len(meta), row["created_at"], io.BytesIO(meta))
+            last_seq = row["seq"]
+            count += 1
+            total += size
+
+        manifest = json.dumps({"since": since, "seq": last_seq, "count": count}).encode()
+        add_member(archive, MANIFEST_NAME, len(manifest), time.time(), io.BytesIO(manifest))
+    out.flush()
+
+    if checkpoint:
+        write_checkpoint(checkpoint, last_seq)
+    logger.info(f"Exported {count} pastes ({total} bytes), seq {since} -> {last_seq}")
+    return 0
+
+
+def import_archive(args) -> int:
+    """Restore pastes from an archive produced by ``export``."""
+    source = open(args.file, "rb") if args.file else sys.stdin.buffer
+    raw_prefix = f"{server.RAW_DIR.name}/"
+    meta_prefix = f"{server.META_DIR.name}/"
+    restored = 0
+    skipped = 0
+
+    with source, tarfile.open(fileobj=source, mode="r|") as archive:
+        for member in archive:
+            if not member.isfile():
+                continue
+            name = member.name
+            if name == MANIFEST_NAME:
+                manifest = json.load(archive.extractfile(member))
+                logger.info(f"Archive covers seq {manifest['since']} -> {manifest['seq']}")
+                continue
+
+            data = archive.extractfile(member).read()
+            sha = name[len(raw_prefix) :] if name.startswith(raw_prefix) else None
+            if sha is not None:
+                if hashlib.sha256(data).hexdigest() != sha:
+                    logger.error(f"Checksum mismatch for {name}, skipping")
+                    skipped += 1
+                    continue
+                if not server.store.exists(name):
+                    server.store.put(name, data)
+            elif name.startswith(meta_prefix) and name.endswith(".json"):
+                meta = json.loads(data)
+                if not server.store.exists(server.raw_key(meta["checksum"])):
+                    logger.error(f"Metadata {name} has no object, skipping")
+                    skipped += 1
+                    continue
+                if server.meta_in_xattr:
+                    server.local_store().set_xattr(server.raw_key(meta["checksum"]), server.META_XATTR, data)
+                else:
+                    server.store.put(name, data)
+                if server.index.add(meta):
+                    restored += 1
+            else:
+                logger.warning(f"Ignoring unexpected archive member {name}")
+
+    logger.info(f"Restored {restored} pastes, skipped {skipped}")
+    return 1 if skipped else 0
+
+
+def iter_files(paths) -> Iterator[tuple[str, float, Callable[[], bytes]]]:
+    """Yield (name, mtime, loader) for every file below ``paths``, in a stable order."""
+    for root in paths:
+        root = Path(root)
+        if root.is_file():
+            yield str(root), root.stat().st_mtime, root.read_bytes
+            continue
+        stack = [root]
+        while stack:
+            directory = stack.pop()
+            with os.scandir(directory) as entries:
+                entries = sorted(entries, key=lambda e: e.name)
+            for entry in reversed(entries):
+                if entry.is_dir(follow_symlinks=False):
+                    stack.append(Path(entry.path))
+            for entry in entries:
+                if entry.is_file(follow_symlinks=False):
+                    path = Path(entry.path)
+                    yield entry.path, entry.stat().st_mtime, path.read_bytes
+
+
+def iter_archive(source) -> Iterator[tuple[str, float, Callable[[], bytes]]]:
+    """Yield (name, mtime, loader) for every regular file in a tar stream."""
+    with tarfile.open(fileobj=source, mode="r|*") as archive:
+        for member in archive:
+            if member.isfile():
+                data = archive.extractfile(member).read()
+                yield member.name, member.mtime, lambda data=data: data
+
+
+def ingest(name: str, mtime: float, load) -> tuple[dict | None, int]:
+    """Hash one input and write it to the store. Runs on pool threads.
+
+    hashlib and file I/O release the GIL, so threads hash on all cores.
+    Returns (meta, size); meta is None if the input was rejected.
+    """
+    data = load()
+    if len(data) > server.MAX_SIZE:
+        logger.warning(f"Skipping {name}: size {len(data)} exceeds max {server.MAX_SIZE}")
+        return None, len(data)
+
+    size, sha = server.generate_sha256(data)
+    meta = server.generate_meta(size, sha)
+    meta["created_at"] = mtime
+
+    if not server.object_stored(sha):
+        server.store_object(data, meta)
+    return meta, size
+
+
+def bulk_import(args) -> int:
+    """Import files or an archive straight into the store and index."""
+    if bool(args.paths) == bool(args.archive):
+        logger.error("Give either input paths or --archive")
+        return 1
+
+    state_path = Path(args.state) if args.state else None
+    position = 0
+    if state_path and state_path.exists():
+        position = json.loads(state_path.read_text())["position"]
+        logger.info(f"Resuming after {position} inputs")
+
+    source = None
+    if args.archive:
+        source = sys.stdin.buffer if args.archive == "-" else open(args.archive, "rb")
+        items = iter_archive(source)
+    else:
+        items = iter_files(args.paths)
+
+    def commit(done: int) -> int:
+        added = server.index.add_many(pending) if pending else 0
+        pending.clear()
+        if state_path:
+            tmp = state_path.with_name(state_path.name + ".tmp")
+            tmp.write_text(json.dumps({"position": done}) + "\n")
+            os.replace(tmp, state_path)
+        return added
+
+    jobs = args.jobs or os.cpu_count() or 1
+    window = collections.deque()
+    pending = []
+    stats = collections.Counter()
+    started = last_report = time.monotonic()
+
+    def report(final: bool = False) -> None:
+        elapsed = max(time.monotonic() - started, 1e-9)
+        logger.info(
+            f"{'Imported' if final else 'Progress:'} {stats['objects']} inputs "
+            f"({stats['new']} new, {stats['objects'] - stats['new'] - stats['rejected']} duplicate, "
+            f"{stats['rejected']} rejected), {stats['objects'] / elapsed:.0f} objects/s, "
+            f"{stats['bytes'] / elapsed / 2**20:.1f} MB/s"
+        )
+
+    done = position
+
+    def collect(future) -> None:
+        nonlocal done
+        meta, size = future.result()
+        done += 1
+        stats["objects"] += 1
+        stats["bytes"] += size
+        if meta is None:
+            stats["rejected"] += 1
+        else:
+            pending.append(meta)
+
+    try:
+        with concurrent.futures.ThreadPoolExecutor(max_workers=jobs) as pool:
+            for number, (name, mtime, load) in enumerate(items):
+                if number < position:
+                    continue
+                window.append(pool.submit(ingest, name, mtime, load))
+
+                # Complete in submission order so `done` is a contiguous prefix
+                while window and (len(window) >= jobs * 4 or window[0].done()):
+                    collect(window.popleft())
+                    if len(pending) >= REINDEX_BATCH:
+                        stats["new"] += commit(done)
+                    if time.monotonic() - last_report >= PROGRESS_INTERVAL:
+                        report()
+                        last_report = time.monotonic()
+
+            while window:
+                collect(window.popleft())
+    finally:
+        # Everything before `done` is in the store; make it durable in the index
+        stats["new"] += commit(done)
+        if source is not None and source is not sys.stdin.buffer:
+            source.close()
+
+    report(final=True)
+    return 0
+
+
+def migrate_meta(args) -> int:
+    """Move metadata records between meta files and xattrs on the objects."""
+    local = server.local_store()
+    if local is None:
+        logger.error("Metadata in xattrs needs local storage")
+        return 1
+    if args.to == "xattr" and not local.supports_xattrs(server.RAW_DIR.name):
+        logger.error(f"{server.DATA_DIR} does not support user xattrs")
+        return 1
+
+    moved = 0
+    failed = 0
+    for key in local.list(f"{server.RAW_DIR.name}/"):
+        sha = key[len(server.RAW_DIR.name) + 1 :]
+        meta_record_key = server.meta_key(sha)
+        try:
+            if args.to == "xattr":
+                if not local.exists(meta_record_key):
+                    continue
+                local.set_xattr(key, server.META_XATTR, local.get(meta_record_key))
+                # The xattr is in place before the file goes, so readers always find one
+                local.delete(meta_record_key)
+            else:
+                record = local.get_xattr(key, server.META_XATTR)
+                if record is None:
+                    continue
+                if not local.exists(meta_record_key):
+                    local.put(meta_record_key, record)
+                local.remove_xattr(key, server.META_XATTR)
+        except OSError as e:
+            logger.warning(f"Could not migrate metadata of {sha[:16]}: {e}")
+            failed += 1
+            continue
+        moved += 1
+    logger.info(f"Moved {moved} metadata records to {args.to}, {failed} failed")
+    if args.to == "xattr" and not server.META_IN_XATTR:
+        logger.warning("Set PPB_META_XATTR=1 so new pastes are stored the same way")
+    return 1 if failed else 0
+
+
+def repair(args) -> int:
+    """Rebuild the missing or corrupt pieces of every erasure-coded object."""
+    backend = server.storage.find_backend(server.store, server.storage.ErasureStorage)
+    if backend is None:
+        logger.error("repair needs PPB_STORAGE=erasure")
+        return 1
+
+    checked = 0
+    repaired = 0
+    failed = 0
+    last_report = time.monotonic()
+    for key in backend.list():
+        try:
+            written = backend.repair(key)
+        except OSError as e:
+            logger.error(f"Cannot repair {key}: {e}")
+            failed += 1
+            continue
+        checked += 1
+        repaired += written > 0
+        if time.monotonic() - last_report >= PROGRESS_INTERVAL:
+            logger.info(f"Checked {checked} objects, repaired {repaired}")
+            last_report = time.monotonic()
+    logger.info(f"Checked {checked} objects, repaired {repaired}, {failed} beyond repair")
+    return 1 if failed else 0
+
+
+def dedup_stats(args) -> int:
+    """Report how much chunk deduplication saves across stored pastes."""
+    backend = server.chunked_store
+    if backend is None:
+        logger.error("dedup-stats needs PPB_DEDUP=1")
+        return 1
+    logical, stored, objects = backend.usage()
+    ratio = logical / stored if stored else 1.0
+    logger.info(
+        f"{objects} chunked pastes of {logical} bytes use {stored} bytes of chunks: "
+        f"{ratio:.2f}x, {1 - stored / logical if logical else 0:.1%} saved"
+    )
+    return 0
+
+
+def index_similar(args) -> int:
+    """Sign every indexed paste that has no MinHash signature yet."""
+    signer = server.signer
+    if signer is None:
+        logger.warning("Set PPB_SIMILAR=1 so the server signs new pastes and answers /similar")
+        signer = server.minhash.Signer(server.index)
+
+    signed = 0
+    failed = 0
+    seq = 0
+    last_report = time.monotonic()
+    while batch := server.index.unsigned(seq, REINDEX_BATCH):
+        for paste in batch:
+            seq = paste["seq"]
+            try:
+                data = server.store.get_range(server.raw_key(paste["checksum"]), 0, server.minhash.MAX_BYTES)
+            except OSError as e:
+                logger.warning(f"Skipping unreadable paste {paste['short']}: {e}")
+                failed += 1
+                continue
+            signer.sign(paste["checksum"], data)
+            signed += 1
+            if time.monotonic() - last_report >= PROGRESS_INTERVAL:
+                logger.info(f"Signed {signed} pastes")
+                last_report = time.monotonic()
+    logger.info(f"Signed {signed} pastes, {failed} unreadable")
+    return 1 if failed else 0
+
+
+def main(argv=None) -> int:
+    parser = argparse.ArgumentParser(description="ppb-server administration")
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    commands.add_parser("reindex", help="rebuild the metadata index from the store")
+
+    export_parser = commands.add_parser("export", help="stream new pastes as a tar archive to stdout")
+    since_group = export_parser.add_mutually_exclusive_group()
+    since_group.add_argument("--since", type=int, help="export pastes with index seq greater than this")
+    since_group.add_argument("--checkpoint", help="read and update the last exported seq in this file")
+
+    import_parser = commands.add_parser("import", help="restore an export archive")
+    import_parser.add_argument("--file", help="archive to read (default: stdin)")
+
+    bulk_parser = commands.add_parser("bulk-import", help="import files directly, bypassing HTTP")
+    bulk_parser.add_argument("paths", nargs="*", help="files or directories to import")
+    bulk_parser.add_argument("--archive", help="read files from a tar stream instead ('-' for stdin)")
+    bulk_parser.add_argument("--jobs", type=int, default=0, help="hashing threads (default: CPU count)")
+    bulk_parser.add_argument("--state", help="progress file; rerun with the same file to resume")
+
+    migrate_parser = commands.add_parser("migrate-meta", help="move metadata between files and xattrs")
+    migrate_parser.add_argument("--to", choices=("xattr", "files"), required=True, help="where metadata should live")
+
+    commands.add_parser("repair", help="rebuild erasure-coded pieces lost with a volume")
+    commands.add_parser("dedup-stats", help="report the space chunk deduplication saves")
+    commands.add_parser("index-similar", help="sign pastes the similarity index is missing")
+
+    args = parser.parse_args(argv)
+    handlers = {
+        "reindex": reindex,
+        "export": export,
+        "import": import_archive,
+        "bulk-import": bulk_import,
+        "migrate-meta": migrate_meta,
+        "repair": repair,
+        "dedup-stats": dedup_stats,
+        "index-similar": index_similar,
+    }
+    return handlers[args.command](args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
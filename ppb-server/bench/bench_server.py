@@ -0,0 +1,597 @@
+"""Microbenchmarks for ppb-server hot paths.
+
+Runs every benchmark against a throwaway data directory, writes latency,
+throughput and peak RSS to a JSON results file, and optionally compares the
+run with a previous results file.
+
+Usage:
+    python bench/bench_server.py [--out results.json]
+        [--baseline old.json] [--threshold 0.25]
+        [--objects 10000,1000000] [--tokens 10,10000,100000]
+        [--sizes 1024,65536,1048576,10485760,104857600] [--only PATTERN]
+        [--ec 4+2] [--ec-sizes 65536,1048576,16777216]
+        [--dedup-sizes 1048576,16777216] [--compress-sizes 16777216,104857600]
+
+Exit status is 1 if any benchmark's median latency or peak RSS regressed by
+more than ``--threshold`` (a fraction) against the baseline, and 2 if any
+benchmark crashed.
+"""
+
+import argparse
+import json
+import multiprocessing
+import os
+import platform
+import random
+import resource
+import secrets
+import shutil
+import statistics
+import sys
+import tempfile
+import time
+from pathlib import Path
+
+SERVER_DIR = Path(__file__).resolve().parent.parent
+
+DEFAULT_TOKENS = "10,10000,100000"
+DEFAULT_SIZES = "1024,65536,1048576,10485760,104857600"
+DEFAULT_OBJECTS = "10000"  # add 1000000 for the full run; populating takes minutes
+DEFAULT_EC = "4+2"
+DEFAULT_EC_SIZES = "65536,1048576,16777216"  # below 1 MB objects are replicated, not coded
+DEFAULT_DEDUP_SIZES = "1048576,16777216"
+DEFAULT_COMPRESS_SIZES = "16777216,104857600"
+TAIL_LINES = 100  # lines read by the compress/tail benchmarks
+DEDUP_VARIANTS = 10  # versions of one log stored by the dedup ratio benchmark
+EXPORT_PASTES = 16  # versions of a 1 MB log exported and imported by export/round-trip
+SIMILAR_SIZES = (4096, 65536, 1048576)  # paste sizes signed by similar/sign
+SIMILAR_VARIANTS = 10  # near-duplicates of the queried paste in similar/query
+REINDEX_ROWS = 10000  # pastes per executemany when populating the index
+MIN_ITERATIONS = 5
+MAX_ITERATIONS = 10000
+TIME_BUDGET = 2.0  # seconds per benchmark
+
+
+def load_server(workdir: Path):
+    """Import server.py with its data directory rooted in ``workdir``."""
+    os.chdir(workdir)
+    sys.path.insert(0, str(SERVER_DIR))
+    import logging
+
+    logging.disable(logging.INFO)
+    import server
+
+    return server
+
+
+def measure(fn, budget: float = TIME_BUDGET, setup=None) -> list[float]:
+    """Call ``fn`` repeatedly and return per-call latencies in seconds.
+
+    If given, ``setup()`` runs untimed before each call and its result is
+    passed to ``fn``.
+    """
+    latencies = []
+    deadline = time.perf_counter() + budget
+    while len(latencies) < MIN_ITERATIONS or (
+        len(latencies) < MAX_ITERATIONS and time.perf_counter() < deadline
+    ):
+        args = (setup(),) if setup else ()
+        start = time.perf_counter()
+        fn(*args)
+        latencies.append(time.perf_counter() - start)
+    return latencies
+
+
+def summarize(latencies: list[float], nbytes: int = 0) -> dict:
+    latencies = sorted(latencies)
+    median = statistics.median(latencies)
+    result = {
+        "iterations": len(latencies),
+        "mean_s": statistics.fmean(latencies),
+        "median_s": median,
+        "p99_s": latencies[min(len(latencies) - 1, int(len(latencies) * 0.99))],
+        "ops_per_s": 1 / median if median else 0.0,
+    }
+    if nbytes:
+        result["mb_per_s"] = nbytes / median / 2**20 if median else 0.0
+    return result
+
+
+def write_tokens(server, count: int) -> str:
+    tokens = [secrets.token_urlsafe(32) for _ in range(count)]
+    server.TOKENS_PATH.write_text(json.dumps(tokens))
+    return tokens[-1]
+
+
+def populate_raw(server, count: int) -> None:
+    """Create ``count`` placeholder objects; short-hash lookup only lists names."""
+    server.RAW_DIR.mkdir(parents=True, exist_ok=True)
+    existing = sum(1 for _ in os.scandir(server.RAW_DIR))
+    for _ in range(existing, count):
+        (server.RAW_DIR / secrets.token_hex(32)).touch()
+
+
+def bench_require_auth(server, tokens: int) -> dict:
+    token = write_tokens(server, tokens)
+    protected = server.require_auth(lambda: ({}, 200))
+
+    def call():
+        with server.app.test_request_context(headers={"Authorization": f"Bearer {token}"}):
+            assert protected()[1] == 200
+
+    return summarize(measure(call))
+
+
+def bench_save_data(server, size: int, duplicate: bool, meta_xattr: bool = False) -> dict:
+    if meta_xattr:
+        server.META_IN_XATTR = True
+        server.meta_in_xattr = server.resolve_meta_mode()
+        if not server.meta_in_xattr:
+            raise RuntimeError("the temp directory does not support user xattrs")
+    fixed = os.urandom(size)
+    if duplicate:
+        server.save_data(fixed)
+
+    def payload():
+        return fixed if duplicate else os.urandom(16) + fixed[16:]
+
+    def call(data):
+        result, status = server.save_data(data)
+        assert status == 200, result
+
+    budget = TIME_BUDGET if size < 2**24 else TIME_BUDGET * 4
+    return summarize(measure(call, budget, payload), size)
+
+
+def bench_get_raw(server, kind: str, objects: int = 0, binary: bool = False) -> dict:
+    server.hot_cache = None  # measure storage reads, not cache hits
+    size = 64 * 1024
+    data = os.urandom(size) if binary else (b"2024-01-01 INFO request ok\n" * (size // 27))
+    result, _ = server.save_data(data)
+    sha = result["meta"]["checksum"]
+    if objects:
+        populate_raw(server, objects)
+    lookup = sha if kind == "full" else sha[:16]
+
+    def call():
+        with server.app.test_request_context():
+            response = server.get_raw(lookup)
+            assert not isinstance(response, tuple), response
+
+    return summarize(measure(call), len(data))
+
+
+def bench_generate_token(server) -> dict:
+    write_tokens(server, 10)
+
+    def call():
+        with server.app.test_request_context(method="POST"):
+            assert server.generate_token()[1] == 201
+
+    return summarize(measure(call))
+
+
+def bench_erasure_encode(server, data_shards: int, parity_shards: int, size: int) -> dict:
+    import erasure
+
+    codec = erasure.ReedSolomon(data_shards, parity_shards)
+    data = os.urandom(size)
+    return summarize(measure(lambda: codec.encode(data)), size)
+
+
+def bench_erasure_decode(server, data_shards: int, parity_shards: int, size: int, lost: int) -> dict:
+    """Rebuild the object with ``lost`` data shards missing."""
+    import erasure
+
+    codec = erasure.ReedSolomon(data_shards, parity_shards)
+    data = os.urandom(size)
+    shards = dict(enumerate(codec.encode(data)))
+    for index in range(lost):
+        del shards[index]
+    assert codec.decode(shards, size) == data
+    return summarize(measure(lambda: codec.decode(shards, size)), size)
+
+
+def bench_erasure_read(server, data_shards: int, parity_shards: int, size: int, lost: int) -> dict:
+    """Read an object back with ``lost`` of its volumes gone."""
+    volumes = [Path(f"volume{i}") for i in range(data_shards + parity_shards)]
+    for volume in volumes:
+        volume.mkdir()
+    store = server.storage.ErasureStorage(volumes, data_shards, parity_shards)
+    data = os.urandom(size)
+    store.put("raw/object", data)
+    # Take out the volumes holding the first pieces, data shards for coded objects
+    for volume in store.placement("raw/object")[:lost]:
+        shutil.rmtree(volume.root)
+    assert store.get("raw/object") == data
+    return summarize(measure(lambda: store.get("raw/object")), size)
+
+
+def log_text(size: int, seed: int) -> bytes:
+    """``size`` bytes of log lines, different for every seed."""
+    rng = random.Random(seed)
+    lines = []
+    total = 0
+    while total < size:
+        line = (
+            f"2024-05-{rng.randrange(1, 29):02d}T{rng.randrange(24):02d}:{rng.randrange(60):02d}:"
+            f"{rng.randrange(60):02d}.{rng.randrange(1000):03d}Z INFO worker={rng.randrange(64)} "
+            f"request id={rng.getrandbits(64):016x} path=/api/v1/items/{rng.randrange(10**6)} "
+            f"status=200 duration_ms={rng.randrange(500)}\n"
+        ).encode()
+        lines.append(line)
+        total += len(line)
+    return b"".join(lines)[:size]
+
+
+def edit_log(data: bytes, seed: int) -> bytes:
+    """Another version of a log: a few lines inserted, one changed, more appended."""
+    rng = random.Random(seed)
+    for _ in range(3):
+        at = data.find(b"\n", rng.randrange(len(data))) + 1
+        data = data[:at] + f"2024-05-01T00:00:00.000Z ERROR retry {rng.getrandbits(32):x}\n".encode() + data[at:]
+    at = rng.randrange(len(data))
+    data = data[:at] + b"#" + data[at + 1 :]
+    return data + log_text(len(data) // 50, seed)
+
+
+def use_chunks(server) -> None:
+    server.store = server.chunked_store = server.storage.ChunkedStorage(server.store)
+
+
+def bench_dedup_ingest(server, size: int, chunked: bool, variant: bool) -> dict:
+    """save_data of new logs, or of versions of one already stored."""
+    if chunked:
+        use_chunks(server)
+    base = log_text(size, 0)
+    if variant:
+        server.save_data(base)
+    seeds = iter(range(1, MAX_ITERATIONS + 2))
+
+    def payload():
+        seed = next(seeds)
+        return edit_log(base, seed)[:size] if variant else log_text(size, seed)
+
+    def call(data):
+        result, status = server.save_data(data)
+        assert status == 200, result
+
+    return summarize(measure(call, TIME_BUDGET * 2, payload), size)
+
+
+def bench_dedup_read(server, size: int, chunked: bool) -> dict:
+    """get_raw of a stored log, with the whole response body read."""
+    if chunked:
+        use_chunks(server)
+    data = log_text(size, 0)
+    sha = server.save_data(data)[0]["meta"]["checksum"]
+
+    def call():
+        with server.app.test_request_context():
+            response = server.get_raw(sha)
+            assert sum(len(part) for part in response.iter_encoded()) == size
+
+    return summarize(measure(call), size)
+
+
+def bench_dedup_ratio(server, size: int, chunked: bool) -> dict:
+    """Store DEDUP_VARIANTS versions of a log and compare bytes in with bytes on disk."""
+    if chunked:
+        use_chunks(server)
+    versions = [log_text(size, 0)]
+    for seed in range(1, DEDUP_VARIANTS):
+        versions.append(edit_log(versions[-1], seed))
+    latencies = []
+    for data in versions:
+        start = time.perf_counter()
+        saved, status = server.save_data(data)
+        latencies.append(time.perf_counter() - start)
+        assert status == 200, saved
+    result = summarize(latencies, sum(map(len, versions)) // len(versions))
+    stored = sum(
+        entry.stat().st_size
+        for directory in (server.RAW_DIR, server.DATA_DIR / "chunks")
+        if directory.exists()
+        for entry in directory.rglob("*")
+        if entry.is_file()
+    )
+    result["stored_bytes"] = stored
+    result["dedup_ratio"] = sum(map(len, versions)) / stored
+    return result
+
+
+def bench_similar_sign(server, size: int) -> dict:
+    """MinHash signature of a new log, as the background signer computes it."""
+    seeds = iter(range(MAX_ITERATIONS + 1))
+
+    def call(data):
+        assert server.minhash.signature(data) is not None
+
+    return summarize(measure(call, setup=lambda: log_text(size, next(seeds))), size)
+
+
+def populate_index(server, count: int) -> None:
+    """Index ``count`` pastes with random signatures, as unrelated pastes have."""
+    minhash = server.minhash
+    conn = server.index.conn
+    with conn:
+        conn.execute("BEGIN")
+        for start in range(1, count + 1, REINDEX_ROWS):
+            pastes, signatures, buckets = [], [], []
+            for seq in range(start, min(start + REINDEX_ROWS, count + 1)):
+                checksum = secrets.token_hex(32)
+                sig = minhash.from_bytes(os.urandom(minhash.NUM_HASHES * 2))
+                pastes.append((seq, checksum, checksum[:16], 4096, 0.0))
+                signatures.append((seq, sig.tobytes()))
+                buckets.extend((bucket, seq) for bucket in minhash.buckets(sig))
+            conn.executemany("INSERT INTO pastes VALUES (?, ?, ?, ?, ?)", pastes)
+            conn.executemany("INSERT INTO signatures VALUES (?, ?)", signatures)
+            conn.executemany("INSERT INTO lsh_buckets VALUES (?, ?)", buckets)
+
+
+def bench_similar_query(server, objects: int) -> dict:
+    """/similar for a crash log with near-duplicates among ``objects`` pastes."""
+    token = write_tokens(server, 1)
+    populate_index(server, objects)
+    base = log_text(65536, 0)
+    variants = [edit_log(base, seed)[:65536] if seed else base for seed in range(SIMILAR_VARIANTS + 1)]
+    shas = [server.save_data(data)[0]["meta"]["checksum"] for data in variants]
+    # Signed here rather than in the background, so all are in before timing
+    server.signer = server.minhash.Signer(server.index)
+    for sha, data in zip(shas, variants):
+        server.signer.sign(sha, data)
+
+    def call():
+        with server.app.test_request_context(headers={"Authorization": f"Bearer {token}"}):
+            result, status = server.similar(shas[0])
+            assert status == 200 and len(result["similar"]) == SIMILAR_VARIANTS, result
+
+    result = summarize(measure(call))
+    server.index.conn.execute("PRAGMA wal_checkpoint(TRUNCATE)")
+    result["index_bytes"] = server.INDEX_PATH.stat().st_size
+    result["index_bytes_per_paste"] = result["index_bytes"] / (objects + len(shas))
+    return result
+
+
+def use_compression(server, frame_size: int) -> None:
+    server.store = server.compressed_store = server.storage.CompressedStorage(server.store, frame_size=frame_size)
+
+
+def bench_compress_ingest(server, size: int) -> dict:
+    """save_data of new logs into compressed storage."""
+    use_compression(server, server.storage.FRAME_SIZE)
+    seeds = iter(range(MAX_ITERATIONS + 1))
+
+    def call(data):
+        result, status = server.save_data(data)
+        assert status == 200, result
+
+    result = summarize(measure(call, TIME_BUDGET * 2, lambda: log_text(size, next(seeds))), size)
+    entries = list(server.RAW_DIR.iterdir())
+    stored = sum(entry.stat().st_size for entry in entries)
+    pastes = sum(entry.name.endswith(server.storage.CompressedStorage.SUFFIX) for entry in entries)
+    result["compression_ratio"] = size * pastes / stored
+    return result
+
+
+def bench_compress_tail(server, size: int, layout: str) -> dict:
+    """get_raw of a log's last TAIL_LINES lines, stored plain, seekable or as one frame."""
+    if layout != "plain":
+        use_compression(server, size if layout == "one-frame" else server.storage.FRAME_SIZE)
+    data = log_text(size, 0)
+    sha = server.save_data(data)[0]["meta"]["checksum"]
+    expected = b"".join(data.splitlines(keepends=True)[-TAIL_LINES:])
+
+    def cold():
+        # Each read as the first of its paste: no cached seek table or frame
+        if layout != "plain":
+            server.compressed_store.tables.clear()
+            server.compressed_store.last_frame = (None, None, b"")
+
+    def call(_):
+        with server.app.test_request_context(f"/raw/{sha}?lines=-{TAIL_LINES}:"):
+            assert server.get_raw(sha).get_data() == expected
+
+    return summarize(measure(call, setup=cold))
+
+
+def layered(storage, backend, layout: str):
+    """``backend`` under the wrappers of ``layout``, stacked as from_env does."""
+    if layout in ("compressed", "both"):
+        backend = storage.CompressedStorage(backend)
+    if layout in ("chunked", "both"):
+        backend = storage.ChunkedStorage(backend)
+    return backend
+
+
+def bench_export_round_trip(server, layout: str) -> dict:
+    """admin.py export, then import into an empty store of the same layout.
+
+    Import checks every object against its checksum, so an archive holding
+    what is on disk instead of the pastes (chunk manifests, compressed
+    frames) fails the benchmark.
+    """
+    import admin
+
+    server.store = layered(server.storage, server.store, layout)
+    pastes = {}
+    data = log_text(2**20, 0)
+    for seed in range(1, EXPORT_PASTES + 1):
+        data = edit_log(data, seed)[: 2**20]
+        pastes[server.save_data(data)[0]["meta"]["checksum"]] = data
+    source = (server.store, server.index)
+    archive = Path("export.tar")
+    targets = iter(range(MAX_ITERATIONS + 1))
+
+    def target():
+        # Every import starts from an empty store
+        shutil.rmtree("restore", ignore_errors=True)
+        root = Path("restore") / str(next(targets))
+        return layered(server.storage, server.storage.LocalStorage(root, server.PERMISSIONS), layout), root
+
+    def call(target):
+        store, root = target
+        stdout = sys.stdout
+        with archive.open("wb") as out:
+            sys.stdout = argparse.Namespace(buffer=out)
+            try:
+                assert admin.export(argparse.Namespace(checkpoint=None, since=None)) == 0
+            finally:
+                sys.stdout = stdout
+        server.store, server.index = store, server.Index(root / "index.sqlite3")
+        try:
+            assert admin.import_archive(argparse.Namespace(file=archive)) == 0
+        finally:
+            server.store, server.index = source
+
+    latencies = measure(call, TIME_BUDGET * 2, target)
+    store, root = target()
+    call((store, root))
+    assert server.Index(root / "index.sqlite3").count() == len(pastes)
+    for sha, data in pastes.items():
+        assert store.get(server.raw_key(sha)) == data, sha
+    return summarize(latencies, sum(map(len, pastes.values())))
+
+
+def plan(args) -> list[tuple[str, str, tuple]]:
+    """Return (name, function name, arguments) for every benchmark to run."""
+    items = []
+    for count in parse_list(args.tokens):
+        items.append((f"require_auth/tokens={count}", "bench_require_auth", (count,)))
+    for size in parse_list(args.sizes):
+        items.append((f"save_data/new/{size}", "bench_save_data", (size, False)))
+        items.append((f"save_data/duplicate/{size}", "bench_save_data", (size, True)))
+        if size <= 2**20:
+            # Metadata cost only shows next to small payloads
+            items.append((f"save_data/new-xattr/{size}", "bench_save_data", (size, False, True)))
+    items.append(("get_raw/full/text", "bench_get_raw", ("full",)))
+    items.append(("get_raw/full/binary", "bench_get_raw", ("full", 0, True)))
+    for count in parse_list(args.objects):
+        items.append((f"get_raw/short/objects={count}", "bench_get_raw", ("short", count)))
+    items.append(("generate_token", "bench_generate_token", ()))
+    data_shards, parity_shards = (int(n) for n in args.ec.split("+"))
+    for size in parse_list(args.ec_sizes):
+        ec = (data_shards, parity_shards, size)
+        items.append((f"erasure/encode/{args.ec}/{size}", "bench_erasure_encode", ec))
+        for lost in range(parity_shards + 1):
+            if lost:
+                items.append((f"erasure/decode/{args.ec}/lost={lost}/{size}", "bench_erasure_decode", ec + (lost,)))
+            items.append((f"erasure/read/{args.ec}/lost={lost}/{size}", "bench_erasure_read", ec + (lost,)))
+    for size in parse_list(args.dedup_sizes):
+        for chunked, store in ((False, "whole"), (True, "chunked")):
+            items.append((f"dedup/ingest/{store}/new/{size}", "bench_dedup_ingest", (size, chunked, False)))
+            items.append((f"dedup/ingest/{store}/variant/{size}", "bench_dedup_ingest", (size, chunked, True)))
+            items.append((f"dedup/read/{store}/{size}", "bench_dedup_read", (size, chunked)))
+            items.append((f"dedup/ratio/{store}/{size}", "bench_dedup_ratio", (size, chunked)))
+    for size in parse_list(args.compress_sizes):
+        items.append((f"compress/ingest/{size}", "bench_compress_ingest", (size,)))
+        for layout in ("plain", "seekable", "one-frame"):
+            items.append((f"compress/tail/{layout}/{size}", "bench_compress_tail", (size, layout)))
+    for layout in ("plain", "chunked", "compressed", "both"):
+        items.append((f"export/round-trip/{layout}", "bench_export_round_trip", (layout,)))
+    for size in SIMILAR_SIZES:
+        items.append((f"similar/sign/{size}", "bench_similar_sign", (size,)))
+    for count in parse_list(args.objects):
+        items.append((f"similar/query/objects={count}", "bench_similar_query", (count,)))
+    if args.only:
+        items = [item for item in items if args.only in item[0]]
+    return items
+
+
+def run_one(function: str, arguments: tuple, pipe) -> None:
+    """Child process entry point: fresh data dir, fresh peak RSS."""
+    with tempfile.TemporaryDirectory(prefix="ppb-bench-") as workdir:
+        server = load_server(Path(workdir))
+        result = globals()[function](server, *arguments)
+        result["peak_rss_kb"] = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+        pipe.send(result)
+
+
+def parse_list(value: str) -> list[int]:
+    return [int(item) for item in value.split(",") if item]
+
+
+def compare(results: dict, baseline: dict, threshold: float) -> list[str]:
+    """Return a description of every metric that got worse by more than threshold."""
+    regressions = []
+    for name, current in results.items():
+        previous = baseline.get(name, {})
+        for metric in ("median_s", "peak_rss_kb"):
+            if not previous.get(metric):
+                continue
+            change = current[metric] / previous[metric] - 1
+            if change > threshold:
+                regressions.append(
+                    f"{name}: {metric} {previous[metric]:.6g} -> {current[metric]:.6g} (+{change:.0%})"
+                )
+    return regressions
+
+
+def main(argv=None) -> int:
+    parser = argparse.ArgumentParser(description="ppb-server microbenchmarks")
+    parser.add_argument("--out", default="bench-results.json", help="results file to write")
+    parser.add_argument("--baseline", help="previous results file to compare against")
+    parser.add_argument("--threshold", type=float, default=0.25, help="allowed median slowdown (fraction)")
+    parser.add_argument("--tokens", default=DEFAULT_TOKENS, help="token counts for require_auth")
+    parser.add_argument("--sizes", default=DEFAULT_SIZES, help="payload sizes for save_data (bytes)")
+    parser.add_argument("--objects", default=DEFAULT_OBJECTS, help="store sizes for short-hash lookups")
+    parser.add_argument("--ec", default=DEFAULT_EC, help="data+parity shards for the erasure benchmarks")
+    parser.add_argument("--ec-sizes", default=DEFAULT_EC_SIZES, help="object sizes for the erasure benchmarks")
+    parser.add_argument("--dedup-sizes", default=DEFAULT_DEDUP_SIZES, help="log sizes for the dedup benchmarks")
+    parser.add_argument(
+        "--compress-sizes", default=DEFAULT_COMPRESS_SIZES, help="log sizes for the compressed storage benchmarks"
+    )
+    parser.add_argument("--only", help="run only benchmarks whose name contains this")
+    args = parser.parse_args(argv)
+
+    # Each benchmark runs in its own process so peak RSS is attributable
+    context = multiprocessing.get_context("fork")
+    results = {}
+    failed = {}
+    for name, function, arguments in plan(args):
+        receiver, sender = context.Pipe(duplex=False)
+        process = context.Process(target=run_one, args=(function, arguments, sender))
+        process.start()
+        sender.close()
+        try:
+            result = receiver.recv()
+        except EOFError:
+            process.join()
+            print(f"{name:40} FAILED (exit {process.exitcode})", file=sys.stderr)
+            failed[name] = process.exitcode
+            continue
+        process.join()
+        results[name] = result
+        throughput = f"{result['mb_per_s']:10.1f} MB/s" if "mb_per_s" in result else " " * 15
+        extra = f"  dedup {result['dedup_ratio']:.2f}x" if "dedup_ratio" in result else ""
+        if "compression_ratio" in result:
+            extra = f"  compressed {result['compression_ratio']:.2f}x"
+        if "index_bytes" in result:
+            extra = f"  index {result['index_bytes'] / 2**20:.1f} MB"
+        print(
+            f"{name:40} {result['median_s'] * 1e3:10.3f} ms  p99 {result['p99_s'] * 1e3:10.3f} ms"
+            f"  {throughput}  rss {result['peak_rss_kb'] / 1024:7.1f} MB{extra}"
+        )
+
+    report = {
+        "created_at": time.time(),
+        "python": platform.python_version(),
+        "machine": platform.machine(),
+        "results": results,
+        "failed": failed,
+    }
+    Path(args.out).write_text(json.dumps(report, indent=2) + "\n")
+
+    regressions = []
+    if args.baseline:
+        baseline = json.loads(Path(args.baseline).read_text())["results"]
+        regressions = compare(results, baseline, args.threshold)
+        for line in regressions:
+            print(f"REGRESSION {line}", file=sys.stderr)
+    if failed:
+        return 2
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
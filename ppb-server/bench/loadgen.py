@@ -0,0 +1,220 @@
+"""Load generator for ppb-server, optionally over fault-injecting storage.
+
+With ``--spawn`` it starts a gunicorn server on a throwaway data directory,
+passing ``--faults`` through as PPB_FAULTS so every storage call can be
+slowed down or failed. It then drives a mix of uploads and reads from
+concurrent clients and reports latency percentiles and outcomes.
+
+Usage:
+    python bench/loadgen.py --spawn --faults "latency_ms=200,jitter_ms=200" \\
+        [--workers 4] [--concurrency 16] [--duration 30] [--read-ratio 0.8] \\
+        [--size 16384] [--timeout 10] [--out loadgen.json]
+    python bench/loadgen.py --url http://127.0.0.1:8000 --token TOKEN ...
+"""
+
+import argparse
+import collections
+import http.client
+import json
+import os
+import random
+import secrets
+import signal
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import urllib.parse
+from pathlib import Path
+
+SERVER_DIR = Path(__file__).resolve().parent.parent
+
+
+def free_port() -> int:
+    with socket.socket() as sock:
+        sock.bind(("127.0.0.1", 0))
+        return sock.getsockname()[1]
+
+
+def spawn_server(workdir: Path, args) -> tuple[subprocess.Popen, str, str]:
+    """Start gunicorn in ``workdir``; returns (process, base url, token)."""
+    token = secrets.token_urlsafe(32)
+    (workdir / "tokens.json").write_text(json.dumps([token]))
+    port = free_port()
+    env = dict(os.environ, PPB_FAULTS=args.faults or "", PYTHONPATH=str(SERVER_DIR))
+    process = subprocess.Popen(
+        [
+            sys.executable, "-m", "gunicorn",
+            "--bind", f"127.0.0.1:{port}",
+            "--workers", str(args.workers),
+            "--worker-class", "sync",
+            "--timeout", str(args.server_timeout),
+            "--log-level", "warning",
+            "server:app",
+        ],
+        cwd=workdir,
+        env=env,
+        stdout=subprocess.DEVNULL,
+        stderr=open(workdir / "server.log", "wb"),
+    )
+    base = f"http://127.0.0.1:{port}"
+    deadline = time.monotonic() + 15
+    while time.monotonic() < deadline:
+        try:
+            request(base, "GET", "/health", timeout=1)
+            return process, base, token
+        except OSError:
+            time.sleep(0.1)
+    process.kill()
+    raise RuntimeError("server did not start; see server.log")
+
+
+def request(base: str, method: str, path: str, body: bytes | None = None,
+            headers: dict | None = None, timeout: float = 10) -> tuple[int, bytes]:
+    url = urllib.parse.urlsplit(base)
+    conn = http.client.HTTPConnection(url.hostname, url.port, timeout=timeout)
+    try:
+        conn.request(method, path, body=body, headers=headers or {})
+        response = conn.getresponse()
+        return response.status, response.read()
+    finally:
+        conn.close()
+
+
+class Load:
+    def __init__(self, base: str, token: str, args):
+        self.base = base
+        self.token = token
+        self.args = args
+        self.lock = threading.Lock()
+        self.latencies = collections.defaultdict(list)
+        self.outcomes = collections.Counter()
+        self.shorts = []
+
+    def record(self, kind: str, outcome: str, latency: float) -> None:
+        with self.lock:
+            self.latencies[kind].append(latency)
+            self.outcomes[f"{kind}:{outcome}"] += 1
+
+    def upload(self, rng: random.Random) -> None:
+        body = rng.randbytes(self.args.size)
+        headers = {"Authorization": f"Bearer {self.token}"}
+        start = time.perf_counter()
+        try:
+            status, data = request(self.base, "POST", "/upload", body, headers, self.args.timeout)
+            outcome = str(status)
+            if status == 200:
+                with self.lock:
+                    self.shorts.append(json.loads(data)["meta"]["short"])
+        except socket.timeout:
+            outcome = "timeout"
+        except OSError as e:
+            outcome = type(e).__name__
+        self.record("upload", outcome, time.perf_counter() - start)
+
+    def read(self, rng: random.Random) -> None:
+        with self.lock:
+            short = rng.choice(self.shorts) if self.shorts else None
+        if short is None:
+            return self.upload(rng)
+        start = time.perf_counter()
+        try:
+            status, _ = request(self.base, "GET", f"/raw/{short}", timeout=self.args.timeout)
+            outcome = str(status)
+        except socket.timeout:
+            outcome = "timeout"
+        except OSError as e:
+            outcome = type(e).__name__
+        self.record("read", outcome, time.perf_counter() - start)
+
+    def client(self, seed: int, deadline: float) -> None:
+        rng = random.Random(seed)
+        while time.monotonic() < deadline:
+            if rng.random() < self.args.read_ratio:
+                self.read(rng)
+            else:
+                self.upload(rng)
+
+    def run(self) -> None:
+        deadline = time.monotonic() + self.args.duration
+        threads = [
+            threading.Thread(target=self.client, args=(seed, deadline))
+            for seed in range(self.args.concurrency)
+        ]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+    def report(self) -> dict:
+        kinds = {}
+        for kind, latencies in self.latencies.items():
+            latencies.sort()
+
+            def pct(p):
+                return latencies[min(len(latencies) - 1, int(len(latencies) * p))]
+
+            kinds[kind] = {
+                "requests": len(latencies),
+                "per_s": len(latencies) / self.args.duration,
+                "p50_s": statistics.median(latencies),
+                "p99_s": pct(0.99),
+                "p999_s": pct(0.999),
+                "max_s": latencies[-1],
+            }
+        return {
+            "faults": self.args.faults,
+            "workers": self.args.workers,
+            "concurrency": self.args.concurrency,
+            "duration_s": self.args.duration,
+            "latency": kinds,
+            "outcomes": dict(sorted(self.outcomes.items())),
+        }
+
+
+def main(argv=None) -> int:
+    parser = argparse.ArgumentParser(description="ppb-server load generator")
+    target = parser.add_mutually_exclusive_group(required=True)
+    target.add_argument("--spawn", action="store_true", help="start a server on a temp data dir")
+    target.add_argument("--url", help="base URL of a running server")
+    parser.add_argument("--token", help="upload token (with --url)")
+    parser.add_argument("--faults", default="", help="PPB_FAULTS spec for the spawned server")
+    parser.add_argument("--workers", type=int, default=4, help="gunicorn workers (with --spawn)")
+    parser.add_argument("--server-timeout", type=int, default=120, help="gunicorn --timeout")
+    parser.add_argument("--concurrency", type=int, default=16, help="concurrent clients")
+    parser.add_argument("--duration", type=float, default=30, help="seconds to run")
+    parser.add_argument("--read-ratio", type=float, default=0.8, help="fraction of requests that read")
+    parser.add_argument("--size", type=int, default=16384, help="upload size in bytes")
+    parser.add_argument("--timeout", type=float, default=10, help="client timeout in seconds")
+    parser.add_argument("--out", help="write the JSON report here as well")
+    args = parser.parse_args(argv)
+
+    process = None
+    with tempfile.TemporaryDirectory(prefix="ppb-load-") as workdir:
+        try:
+            if args.spawn:
+                process, base, token = spawn_server(Path(workdir), args)
+            else:
+                if not args.token:
+                    parser.error("--url requires --token")
+                base, token = args.url.rstrip("/"), args.token
+            load = Load(base, token, args)
+            load.run()
+        finally:
+            if process:
+                process.send_signal(signal.SIGTERM)
+                process.wait(timeout=30)
+
+    report = load.report()
+    text = json.dumps(report, indent=2)
+    print(text)
+    if args.out:
+        Path(args.out).write_text(text + "\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
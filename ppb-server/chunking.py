@@ -0,0 +1,85 @@
+"""Content-defined chunking.
+
+Cutting an object into fixed-size chunks finds nothing in common between
+two objects once one has a byte inserted near the start: every chunk after
+it is shifted. A content-defined chunker decides where to cut from the bytes
+around each position instead, so an edit only moves the cuts next to it, and
+two logs that share most of their lines share most of their chunks.
+
+Cuts are considered only just after newline bytes, which is where text and
+logs break naturally and which random binary data has every 256 bytes on
+average, so candidates are found with ``bytes.find`` at C speed and the
+per-candidate work is one CRC-32 call. A candidate ending a line of ``gap``
+bytes (counting back to the previous newline) is taken as a cut when the
+CRC of the line's last ``WINDOW`` bytes falls below ``gap / (avg - min)`` of
+the CRC range: the same chance per byte whatever the line lengths, so chunks
+average ``avg_size`` bytes in text and binary alike. Chunks are never
+shorter than ``min_size``, nor longer than ``max_size``, which is where data
+without newlines gets cut.
+"""
+
+import zlib
+from typing import Iterable, Iterator
+
+WINDOW = 64  # bytes before a candidate that decide whether it is a cut
+
+
+def cut_points(data: bytes, min_size: int, avg_size: int, max_size: int, final: bool = True) -> list[int]:
+    """End offsets of the chunks ``data`` splits into.
+
+    With ``final`` false, ``data`` is the start of a longer stream: only the
+    cuts that later bytes cannot change are returned, and whatever follows
+    the last one belongs to the next call.
+    """
+    if not 0 < min_size < avg_size < max_size:
+        raise ValueError("need 0 < min_size < avg_size < max_size")
+    span = avg_size - min_size
+    scale = (1 << 32) / span
+    length = len(data)
+    view = memoryview(data)
+    crc32 = zlib.crc32
+    find = data.find
+    cuts = []
+    start = 0
+    # A decision about the chunk at start needs max_size bytes, or the end
+    while length - start > min_size and (final or length - start >= max_size):
+        limit = min(start + max_size, length)
+        cut = limit
+        first = start + min_size
+        newline = data.rfind(b"\n", start, first - 1)
+        previous = newline + 1 if newline >= 0 else start
+        newline = find(b"\n", first - 1, limit)
+        while newline >= 0:
+            candidate = newline + 1
+            gap = candidate - previous
+            window = view[candidate - WINDOW : candidate] if gap > WINDOW else view[previous:candidate]
+            if crc32(window) < (gap if gap < span else span) * scale:
+                cut = candidate
+                break
+            previous = candidate
+            newline = find(b"\n", candidate, limit)
+        cuts.append(cut)
+        start = cut
+    if final and start < length:
+        cuts.append(length)
+    return cuts
+
+
+def split(blocks: Iterable[bytes], min_size: int, avg_size: int, max_size: int) -> Iterator[bytes]:
+    """Chunks of a stream given as blocks, cut as they arrive.
+
+    The cuts are the ones ``cut_points`` makes over the whole stream; no
+    more than ``max_size`` bytes plus one block are held at a time.
+    """
+    pending = b""
+    for block in blocks:
+        pending = pending + block if pending else bytes(block)
+        start = 0
+        for cut in cut_points(pending, min_size, avg_size, max_size, final=False):
+            yield pending[start:cut]
+            start = cut
+        pending = pending[start:]
+    start = 0
+    for cut in cut_points(pending, min_size, avg_size, max_size):
+        yield pending[start:cut]
+        start = cut
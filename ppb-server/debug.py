@@ -0,0 +1,243 @@
+"""Opt-in diagnostics for ppb-server workers."""
+
+import atexit
+import collections
+import fcntl
+import json
+import logging
+import os
+import signal
+import sys
+import threading
+import time
+import tracemalloc
+import uuid
+from pathlib import Path
+
+logger = logging.getLogger(__name__)
+
+PROFILE_SIGNAL = signal.SIGPROF
+PROFILE_GRACE = 2.0  # seconds to wait for workers after the sampling window
+
+
+def size_bucket(size: int) -> str:
+    """Power-of-four size class label for a payload size, e.g. '64KB-256KB'."""
+    if size <= 0:
+        return "0"
+    upper = 1024
+    while size > upper:
+        upper *= 4
+    lower = upper // 4 if upper > 1024 else 0
+    return f"{human_size(lower)}-{human_size(upper)}"
+
+
+def human_size(size: int) -> str:
+    for unit in ("B", "KB", "MB", "GB"):
+        if size < 1024 or unit == "GB":
+            return f"{size}{unit}"
+        size //= 1024
+    return f"{size}GB"
+
+
+class AllocTracker:
+    """Per-request allocation accounting built on tracemalloc.
+
+    For each request it records the peak traced memory above the level at
+    request start, and the net bytes still allocated when the response is
+    ready. tracemalloc only sees allocations made through Python's
+    allocators, which covers request bodies, decoded text and response
+    buffers. Tracing slows allocation-heavy code down noticeably, so it is
+    only enabled on demand.
+    """
+
+    def __init__(self, frames: int = 1):
+        self.frames = frames
+        self.lock = threading.Lock()
+        self.stats = {}
+        self.start_level = 0
+
+    def start(self) -> None:
+        if not tracemalloc.is_tracing():
+            tracemalloc.start(self.frames)
+
+    def begin_request(self) -> None:
+        tracemalloc.reset_peak()
+        self.start_level = tracemalloc.get_traced_memory()[0]
+
+    def end_request(self, endpoint: str, payload_size: int) -> tuple[int, int]:
+        """Record the finished request; returns (peak, net) bytes."""
+        current, peak = tracemalloc.get_traced_memory()
+        peak = max(0, peak - self.start_level)
+        net = current - self.start_level
+
+        key = (endpoint or "unknown", size_bucket(payload_size))
+        with self.lock:
+            entry = self.stats.setdefault(
+                key, {"requests": 0, "peak_max": 0, "peak_total": 0, "net_total": 0}
+            )
+            entry["requests"] += 1
+            entry["peak_max"] = max(entry["peak_max"], peak)
+            entry["peak_total"] += peak
+            entry["net_total"] += net
+        return peak, net
+
+    def snapshot(self) -> dict:
+        with self.lock:
+            endpoints = {}
+            for (endpoint, bucket), entry in sorted(self.stats.items()):
+                endpoints.setdefault(endpoint, {})[bucket] = {
+                    **entry,
+                    "peak_mean": entry["peak_total"] // entry["requests"],
+                }
+        return {
+            "pid": os.getpid(),
+            "traced_current": tracemalloc.get_traced_memory()[0],
+            "endpoints": endpoints,
+        }
+
+
+def collapse(frame) -> str:
+    """Render a stack as a root-first, semicolon-separated flamegraph line."""
+    names = []
+    while frame is not None:
+        code = frame.f_code
+        names.append(f"{code.co_name} ({Path(code.co_filename).name}:{code.co_firstlineno})")
+        frame = frame.f_back
+    return ";".join(reversed(names))
+
+
+def sample_stacks(seconds: float, interval: float, exclude=(), include_self: bool = False) -> collections.Counter:
+    """Sample every thread's stack in this process for ``seconds``.
+
+    Returns a Counter of collapsed stacks. Any thread idents in ``exclude``
+    are skipped, and so is the sampling thread itself unless ``include_self``.
+    """
+    counts = collections.Counter()
+    skip = set(exclude) if include_self else {threading.get_ident(), *exclude}
+    deadline = time.monotonic() + seconds
+    while time.monotonic() < deadline:
+        for ident, frame in sys._current_frames().items():
+            if ident not in skip:
+                counts[collapse(frame)] += 1
+        time.sleep(interval)
+    return counts
+
+
+def format_collapsed(counts: collections.Counter) -> str:
+    """Collapsed-stack text as consumed by flamegraph.pl, inferno or speedscope."""
+    return "".join(f"{stack} {count}\n" for stack, count in counts.most_common())
+
+
+class ProfileControl:
+    """Control channel for profiling every worker of a gunicorn server.
+
+    Each worker registers its pid in ``run_dir/workers`` and installs a
+    handler for PROFILE_SIGNAL. To profile, one worker writes a request file
+    and signals its peers; each peer starts a sampling thread and writes its
+    collapsed stacks next to the request, while the requesting worker samples
+    itself. No thread runs and nothing is sampled until a profile is
+    requested.
+    """
+
+    def __init__(self, run_dir: Path):
+        self.run_dir = Path(run_dir)
+        self.workers_dir = self.run_dir / "workers"
+        self.request_path = self.run_dir / "profile-request.json"
+        self.pid = None
+
+    def register(self) -> None:
+        self.workers_dir.mkdir(parents=True, exist_ok=True)
+        signal.signal(PROFILE_SIGNAL, self._handle_signal)
+        self.pid = os.getpid()
+        (self.workers_dir / str(self.pid)).write_text(_cmdline(self.pid))
+        atexit.register(self.unregister)
+
+    def unregister(self) -> None:
+        if self.pid == os.getpid():
+            (self.workers_dir / str(self.pid)).unlink(missing_ok=True)
+
+    def peers(self) -> list[int]:
+        """Live registered workers other than this one."""
+        me = os.getpid()
+        pids = []
+        for entry in self.workers_dir.iterdir():
+            if not entry.name.isdigit() or int(entry.name) == me:
+                continue
+            pid = int(entry.name)
+            # A recycled pid belongs to a different program; don't signal it
+            if _cmdline(pid) != entry.read_text():
+                entry.unlink(missing_ok=True)
+                continue
+            pids.append(pid)
+        return pids
+
+    def _handle_signal(self, signum, frame) -> None:
+        try:
+            request = json.loads(self.request_path.read_text())
+        except (OSError, ValueError):
+            return
+        thread = threading.Thread(target=self._run_request, args=(request,), daemon=True)
+        thread.start()
+
+    def _run_request(self, request: dict) -> None:
+        counts = sample_stacks(request["seconds"], request["interval"])
+        out = self.run_dir / f"profile-{request['id']}-{os.getpid()}.txt"
+        tmp = out.with_suffix(".tmp")
+        tmp.write_text(format_collapsed(counts))
+        os.replace(tmp, out)
+
+    def profile_all(self, seconds: float, interval: float) -> tuple[collections.Counter, int]:
+        """Profile every worker; returns (merged stacks, workers that answered).
+
+        The calling worker samples its own other threads while its peers
+        sample themselves. Without peers it also samples the calling thread,
+        which is all a lone sync worker is running.
+        Raises BlockingIOError if another profile is already running.
+        """
+        with open(self.run_dir / "profile.lock", "w") as lock:
+            fcntl.flock(lock, fcntl.LOCK_EX | fcntl.LOCK_NB)
+            for stale in self.run_dir.glob("profile-*-*.txt"):
+                stale.unlink(missing_ok=True)
+            request_id = uuid.uuid4().hex
+            self.request_path.write_text(
+                json.dumps({"id": request_id, "seconds": seconds, "interval": interval})
+            )
+            signalled = []
+            for pid in self.peers():
+                try:
+                    os.kill(pid, PROFILE_SIGNAL)
+                    signalled.append(pid)
+                except ProcessLookupError:
+                    (self.workers_dir / str(pid)).unlink(missing_ok=True)
+
+            merged = sample_stacks(seconds, interval, include_self=not signalled)
+            answered = 1
+            deadline = time.monotonic() + PROFILE_GRACE
+            pending = set(signalled)
+            while pending and time.monotonic() < deadline:
+                for pid in list(pending):
+                    out = self.run_dir / f"profile-{request_id}-{pid}.txt"
+                    if not out.exists():
+                        continue
+                    for line in out.read_text().splitlines():
+                        stack, _, count = line.rpartition(" ")
+                        merged[stack] += int(count)
+                    out.unlink()
+                    pending.discard(pid)
+                    answered += 1
+                time.sleep(0.05)
+            self.request_path.unlink(missing_ok=True)
+            if pending:
+                logger.warning(f"Workers {sorted(pending)} did not return a profile in time")
+            return merged, answered
+
+
+def _cmdline(pid: int) -> str:
+    """Command line of a process, or "" where /proc is unavailable."""
+    try:
+        return Path(f"/proc/{pid}/cmdline").read_bytes().decode(errors="replace")
+    except FileNotFoundError:
+        # Either the process is gone or there is no /proc at all
+        return "" if not Path("/proc/self").exists() else "<exited>"
+    except OSError:
+        return ""
@@ -0,0 +1,147 @@
+"""Reed-Solomon erasure coding over GF(2^8).
+
+An object is cut into ``k`` equal data shards and ``m`` parity shards are
+computed from them, so that any ``k`` of the ``k + m`` shards give the object
+back. The code is systematic: the data shards are the object itself, and a
+read with all of them present is a concatenation with no decoding.
+
+Parity rows come from a Cauchy matrix, every square submatrix of which is
+invertible, so any ``k`` rows of ``[I; C]`` can be inverted to decode.
+
+The arithmetic is done a whole shard at a time, the way SIMD encoders do it:
+multiplying a shard by a constant is a 256-entry table lookup per byte
+(``bytes.translate``, the same split-table trick PSHUFB is used for), and
+adding shards is XOR over them as big integers, which CPython runs a
+machine word at a time. There are no per-byte Python loops, and shards are
+worked through in blocks of ``BLOCK_SIZE`` so that every output row of a
+block is computed while its inputs are still in cache.
+"""
+
+import functools
+
+POLYNOMIAL = 0x11D  # x^8 + x^4 + x^3 + x^2 + 1
+MAX_SHARDS = 256
+BLOCK_SIZE = 1 << 20  # bytes of each shard combined at a time
+
+EXP = [0] * 512
+LOG = [0] * 256
+_value = 1
+for _power in range(255):
+    EXP[_power] = _value
+    LOG[_value] = _power
+    _value <<= 1
+    if _value & 0x100:
+        _value ^= POLYNOMIAL
+for _power in range(255, 512):
+    EXP[_power] = EXP[_power - 255]
+
+
+def gf_mul(a: int, b: int) -> int:
+    if a == 0 or b == 0:
+        return 0
+    return EXP[LOG[a] + LOG[b]]
+
+
+def gf_inv(a: int) -> int:
+    if a == 0:
+        raise ZeroDivisionError("0 has no inverse in GF(256)")
+    return EXP[255 - LOG[a]]
+
+
+@functools.cache
+def mul_table(c: int) -> bytes:
+    """Translation table multiplying every byte by ``c``."""
+    return bytes(gf_mul(c, x) for x in range(256))
+
+
+def invert(matrix: list[list[int]]) -> list[list[int]]:
+    """Invert a square matrix over GF(256) by Gauss-Jordan elimination."""
+    n = len(matrix)
+    rows = [list(row) + [int(i == j) for j in range(n)] for i, row in enumerate(matrix)]
+    for col in range(n):
+        pivot = next((r for r in range(col, n) if rows[r][col]), None)
+        if pivot is None:
+            raise ValueError("matrix is singular")
+        rows[col], rows[pivot] = rows[pivot], rows[col]
+        scale = gf_inv(rows[col][col])
+        rows[col] = [gf_mul(scale, x) for x in rows[col]]
+        for r in range(n):
+            factor = rows[r][col]
+            if r != col and factor:
+                rows[r] = [x ^ gf_mul(factor, y) for x, y in zip(rows[r], rows[col])]
+    return [row[n:] for row in rows]
+
+
+def combine(rows: list[list[int]], shards: list[bytes], size: int) -> list[bytes]:
+    """For every row, the sum over GF(256) of each shard times its coefficient."""
+    outputs = [bytearray(size) for _ in rows]
+    tables = [[mul_table(c) for c in row] for row in rows]
+    for start in range(0, size, BLOCK_SIZE):
+        end = min(start + BLOCK_SIZE, size)
+        pieces = [shard[start:end] for shard in shards]
+        for row, row_tables, output in zip(rows, tables, outputs):
+            acc = 0
+            for c, table, piece in zip(row, row_tables, pieces):
+                if c:
+                    acc ^= int.from_bytes(piece if c == 1 else piece.translate(table), "big")
+            output[start:end] = acc.to_bytes(end - start, "big")
+    return [bytes(output) for output in outputs]
+
+
+class ReedSolomon:
+    """Encoder and decoder for ``data_shards`` + ``parity_shards`` shards."""
+
+    def __init__(self, data_shards: int, parity_shards: int):
+        if data_shards < 1 or parity_shards < 0 or data_shards + parity_shards > MAX_SHARDS:
+            raise ValueError(
+                f"need 1 or more data shards, 0 or more parity shards, at most {MAX_SHARDS} in all"
+            )
+        self.data_shards = data_shards
+        self.parity_shards = parity_shards
+        k = data_shards
+        # Rows of [I; C]: row i gives shard i from the data shards. C[i][j] =
+        # 1 / (x_i + y_j) with x_i = k + i and y_j = j, all distinct
+        self.matrix = [[int(i == j) for j in range(k)] for i in range(k)]
+        self.matrix += [[gf_inv((k + i) ^ j) for j in range(k)] for i in range(parity_shards)]
+
+    @property
+    def total_shards(self) -> int:
+        return self.data_shards + self.parity_shards
+
+    def shard_size(self, length: int) -> int:
+        return max(1, -(-length // self.data_shards))
+
+    def encode(self, data: bytes) -> list[bytes]:
+        """Split ``data`` into data shards, zero-padded, and append the parity."""
+        size = self.shard_size(len(data))
+        view = memoryview(data)
+        shards = [bytes(view[i * size : (i + 1) * size]) for i in range(self.data_shards)]
+        shards = [shard.ljust(size, b"\0") for shard in shards]
+        return shards + combine(self.matrix[self.data_shards :], shards, size)
+
+    def decode(self, shards: dict[int, bytes], length: int) -> bytes:
+        """The object of ``length`` bytes from any ``data_shards`` of its shards."""
+        return b"".join(self.data(shards))[:length]
+
+    def data(self, shards: dict[int, bytes]) -> list[bytes]:
+        """The data shards, recomputing missing ones from the others."""
+        k = self.data_shards
+        if all(i in shards for i in range(k)):
+            return [shards[i] for i in range(k)]
+        if len(shards) < k:
+            raise ValueError(f"{len(shards)} shards left, {k} needed to decode")
+        # Any k shards will do; data shards first, since their rows are trivial
+        chosen = sorted(shards)[:k]
+        size = len(shards[chosen[0]])
+        inverse = invert([self.matrix[i] for i in chosen])
+        missing = [i for i in range(k) if i not in shards]
+        recovered = dict(zip(missing, combine([inverse[i] for i in missing], [shards[i] for i in chosen], size)))
+        return [shards[i] if i in shards else recovered[i] for i in range(k)]
+
+    def reconstruct(self, shards: dict[int, bytes]) -> list[bytes]:
+        """All shards, data and parity, from any ``data_shards`` of them."""
+        data = self.data(shards)
+        k = self.data_shards
+        missing = [i for i in range(k, self.total_shards) if i not in shards]
+        recovered = dict(zip(missing, combine([self.matrix[i] for i in missing], data, len(data[0]))))
+        return data + [shards[i] if i in shards else recovered[i] for i in range(k, self.total_shards)]
@@ -0,0 +1,31 @@
+"""Gunicorn hooks for ppb-server (loaded by start.sh).
+
+Settings stay on the command line in start.sh; this file only holds hooks.
+"""
+
+# Marker header telling the app that it owns the 100 Continue response
+CONTINUE_DEFERRED_HEADER = "X-PPB-CONTINUE-DEFERRED"
+
+
+def pre_request(worker, req):
+    """Hold back gunicorn's automatic 100 Continue for uploads.
+
+    Gunicorn answers "Expect: 100-continue" as soon as it has parsed the
+    headers, before the app runs, so clients start sending the body even if
+    the app is about to reject it. For /upload the app sends 100 Continue
+    itself once the token, size and rate limit have been checked.
+    """
+    worker.log.debug("%s %s", req.method, req.path)
+
+    # Never trust a marker sent by the client
+    req.headers = [(name, value) for name, value in req.headers if name != CONTINUE_DEFERRED_HEADER]
+
+    if req.path != "/upload" or req.version < (1, 1):
+        return
+    if not any(name == "EXPECT" and value.lower() == "100-continue" for name, value in req.headers):
+        return
+
+    req.headers = [(name, value) for name, value in req.headers if name != "EXPECT"]
+    if hasattr(req, "_expected_100_continue"):
+        req._expected_100_continue = False
+    req.headers.append((CONTINUE_DEFERRED_HEADER, "1"))
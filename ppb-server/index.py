@@ -0,0 +1,165 @@
+"""SQLite metadata index for ppb-server.
+
+Every saved paste gets a row with a monotonically increasing sequence
+number. Tools that need "everything since X" (incremental export, bulk
+import resume, ...) query the index instead of walking the store.
+
+Pastes that have been signed (see minhash.py) also have their MinHash
+signature, and one row per LSH band naming the bucket it hashed to, so
+near-duplicates are found with a few primary key lookups.
+"""
+
+import logging
+import os
+import sqlite3
+import threading
+from pathlib import Path
+from typing import Iterator
+
+logger = logging.getLogger(__name__)
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS pastes (
+    seq INTEGER PRIMARY KEY AUTOINCREMENT,
+    checksum TEXT NOT NULL UNIQUE,
+    short TEXT NOT NULL,
+    size INTEGER NOT NULL,
+    created_at REAL NOT NULL
+);
+CREATE TABLE IF NOT EXISTS signatures (
+    seq INTEGER PRIMARY KEY,
+    signature BLOB NOT NULL
+);
+CREATE TABLE IF NOT EXISTS lsh_buckets (
+    bucket INTEGER NOT NULL,
+    seq INTEGER NOT NULL,
+    PRIMARY KEY (bucket, seq)
+) WITHOUT ROWID;
+"""
+
+
+class Index:
+    """Metadata index backed by a SQLite database.
+
+    Connections are opened lazily per process and thread, so an index
+    created before gunicorn forks its workers is safe to use from each of
+    them, and from their background threads.
+    """
+
+    def __init__(self, path: Path):
+        self.path = Path(path)
+        self._local = threading.local()
+
+    @property
+    def conn(self) -> sqlite3.Connection:
+        local = self._local
+        if getattr(local, "conn", None) is None or local.pid != os.getpid():
+            self.path.parent.mkdir(parents=True, exist_ok=True)
+            conn = sqlite3.connect(self.path, timeout=30, isolation_level=None)
+            conn.row_factory = sqlite3.Row
+            conn.execute("PRAGMA journal_mode=WAL")
+            conn.execute("PRAGMA synchronous=NORMAL")
+            conn.executescript(SCHEMA)
+            local.conn = conn
+            local.pid = os.getpid()
+        return local.conn
+
+    def add(self, meta: dict) -> bool:
+        """Record a paste. Returns False if it was already indexed."""
+        cursor = self.conn.execute(
+            "INSERT OR IGNORE INTO pastes (checksum, short, size, created_at) VALUES (?, ?, ?, ?)",
+            (meta["checksum"], meta["short"], meta["size"], meta["created_at"]),
+        )
+        return cursor.rowcount == 1
+
+    def add_many(self, metas) -> int:
+        """Record several pastes in one transaction. Returns rows added."""
+        conn = self.conn
+        with conn:
+            conn.execute("BEGIN")
+            before = conn.total_changes
+            conn.executemany(
+                "INSERT OR IGNORE INTO pastes (checksum, short, size, created_at) VALUES (?, ?, ?, ?)",
+                ((m["checksum"], m["short"], m["size"], m["created_at"]) for m in metas),
+            )
+            return conn.total_changes - before
+
+    def get(self, checksum: str) -> dict | None:
+        row = self.conn.execute(
+            "SELECT * FROM pastes WHERE checksum = ?", (checksum,)
+        ).fetchone()
+        return dict(row) if row else None
+
+    def find(self, prefix: str) -> list[dict]:
+        """Up to two rows whose checksum starts with ``prefix``."""
+        rows = self.conn.execute(
+            "SELECT * FROM pastes WHERE checksum >= ? AND checksum < ? ORDER BY checksum LIMIT 2",
+            (prefix, prefix + "~"),
+        ).fetchall()
+        return [dict(row) for row in rows]
+
+    def since(self, seq: int = 0) -> Iterator[dict]:
+        """Yield rows with a sequence number greater than ``seq``, in order."""
+        cursor = self.conn.execute(
+            "SELECT * FROM pastes WHERE seq > ? ORDER BY seq", (seq,)
+        )
+        for row in cursor:
+            yield dict(row)
+
+    def last_seq(self) -> int:
+        row = self.conn.execute("SELECT MAX(seq) FROM pastes").fetchone()
+        return row[0] or 0
+
+    def count(self) -> int:
+        return self.conn.execute("SELECT COUNT(*) FROM pastes").fetchone()[0]
+
+    def add_signature(self, checksum: str, signature: bytes, buckets: list[int]) -> bool:
+        """Record a paste's signature and LSH buckets.
+
+        An empty signature marks a paste with nothing to compare. Returns
+        False if the paste is not in the index.
+        """
+        conn = self.conn
+        with conn:
+            # Take the write lock before reading, or a concurrent writer
+            # makes the upgrade fail without waiting
+            conn.execute("BEGIN IMMEDIATE")
+            row = conn.execute("SELECT seq FROM pastes WHERE checksum = ?", (checksum,)).fetchone()
+            if row is None:
+                return False
+            seq = row[0]
+            conn.execute("INSERT OR REPLACE INTO signatures (seq, signature) VALUES (?, ?)", (seq, signature))
+            conn.executemany(
+                "INSERT OR IGNORE INTO lsh_buckets (bucket, seq) VALUES (?, ?)",
+                ((bucket, seq) for bucket in buckets),
+            )
+            return True
+
+    def signature(self, seq: int) -> bytes | None:
+        row = self.conn.execute("SELECT signature FROM signatures WHERE seq = ?", (seq,)).fetchone()
+        return row[0] if row else None
+
+    def candidates(self, buckets: list[int], limit: int) -> list[dict]:
+        """Up to ``limit`` pastes sharing a bucket, with their signatures."""
+        marks = ",".join("?" * len(buckets))
+        rows = self.conn.execute(
+            f"SELECT p.*, s.signature FROM pastes p JOIN signatures s ON s.seq = p.seq "
+            f"WHERE p.seq IN (SELECT DISTINCT seq FROM lsh_buckets WHERE bucket IN ({marks}) LIMIT ?)",
+            (*buckets, limit),
+        )
+        return [dict(row) for row in rows]
+
+    def unsigned(self, seq: int = 0, limit: int = 1000) -> list[dict]:
+        """Up to ``limit`` pastes after ``seq`` that have no signature yet, in order."""
+        rows = self.conn.execute(
+            "SELECT p.* FROM pastes p LEFT JOIN signatures s ON s.seq = p.seq "
+            "WHERE p.seq > ? AND s.seq IS NULL ORDER BY p.seq LIMIT ?",
+            (seq, limit),
+        ).fetchall()
+        return [dict(row) for row in rows]
+
+    def close(self) -> None:
+        """Close the calling thread's connection."""
+        if getattr(self._local, "conn", None) is not None:
+            self._local.conn.close()
+            self._local.conn = None
@@ -0,0 +1,41 @@
+"""Per-token upload rate limiting for ppb-server."""
+
+import threading
+import time
+from collections import OrderedDict
+
+
+class RateLimiter:
+    """Token bucket per key, allowing ``per_minute`` events with bursts of ``burst``.
+
+    State is per worker process, so the effective server-wide limit is up to
+    ``workers`` times higher. At most ``max_keys`` buckets are kept; the least
+    recently used ones are dropped first.
+    """
+
+    def __init__(self, per_minute: float, burst: int | None = None, max_keys: int = 10000):
+        self.rate = per_minute / 60
+        self.burst = burst if burst is not None else max(1, int(per_minute))
+        self.max_keys = max_keys
+        self.buckets = OrderedDict()  # key -> (tokens, last update)
+        self.lock = threading.Lock()
+
+    def allow(self, key: str) -> bool:
+        """Take one event from key's bucket; False if it is empty."""
+        now = time.monotonic()
+        with self.lock:
+            tokens, last = self.buckets.pop(key, (self.burst, now))
+            tokens = min(self.burst, tokens + (now - last) * self.rate)
+            allowed = tokens >= 1
+            if allowed:
+                tokens -= 1
+            self.buckets[key] = (tokens, now)
+            if len(self.buckets) > self.max_keys:
+                self.buckets.popitem(last=False)
+            return allowed
+
+    def retry_after(self, key: str) -> int:
+        """Seconds until key's bucket holds a whole token again."""
+        with self.lock:
+            tokens, _ = self.buckets.get(key, (self.burst, 0))
+        return max(1, int((1 - tokens) / self.rate + 0.999)) if self.rate else 60
@@ -0,0 +1,151 @@
+"""MinHash signatures and LSH bucketing for near-duplicate pastes.
+
+A paste is reduced to the set of its shingles, runs of ``SHINGLE`` words
+with every number and ``0x`` address replaced by ``0``, so that two crash
+logs that differ only in timestamps, pids and pointers have the same set.
+The Jaccard similarity of two such sets is estimated from signatures of
+``NUM_HASHES`` values: the fraction of positions where they agree.
+
+Signatures use one-permutation hashing: each shingle is hashed once, the
+top bits of the hash pick one of ``NUM_HASHES`` bins and each bin keeps its
+smallest value. Computing ``NUM_HASHES`` independent minima would cost that
+many passes over the shingles in Python; here the shingles are built and
+hashed at C speed (``re``, ``map``, ``zlib.crc32``) and only the binning is
+a Python loop, over distinct shingles. Bins no shingle fell into borrow the
+value of the next filled bin (rotation densification), so small pastes still
+get comparable signatures. Only the low 16 bits of each value are kept: two
+different minima agree on them once in 65536 comparisons, which moves the
+estimate by nothing measurable and halves what the index stores per paste.
+
+For lookup the signature is cut into ``BANDS`` bands of ``ROWS`` values and
+each band is hashed to a bucket. Two pastes share at least one bucket with
+probability ``1 - (1 - s**ROWS)**BANDS`` at similarity ``s``: 5% at 0.25,
+64% at 0.5 and 99.5% at 0.75. Only pastes in a shared bucket are compared.
+Bucket numbers fit in 31 bits, which SQLite stores in 4 bytes.
+"""
+
+import logging
+import queue
+import re
+import threading
+import zlib
+from array import array
+
+logger = logging.getLogger(__name__)
+
+NUM_HASHES = 64
+BANDS = 16
+ROWS = NUM_HASHES // BANDS
+SHINGLE = 4  # words per shingle
+MAX_BYTES = 2**20  # only the start of larger pastes is signed
+BIN_BITS = 6  # log2(NUM_HASHES)
+VALUE_BITS = 32 - BIN_BITS
+VALUE_MASK = (1 << VALUE_BITS) - 1
+EMPTY = 0xFFFFFFFF
+BUCKET_BITS = 27  # hash bits of a bucket number, below the band's
+
+NUMBERS = re.compile(rb"0[xX][0-9a-fA-F]+|[0-9]+")
+WORDS = re.compile(rb"\w+")
+
+
+def shingles(data: bytes) -> set[int]:
+    """Hashes of the distinct shingles of ``data``, 32 bits each."""
+    words = WORDS.findall(NUMBERS.sub(b"0", data[:MAX_BYTES]))
+    if len(words) < SHINGLE:
+        return set()
+    runs = zip(*(words[i:] for i in range(SHINGLE)))
+    return set(map(zlib.crc32, map(b" ".join, runs)))
+
+
+def signature(data: bytes) -> array | None:
+    """MinHash signature of ``data`` (16-bit values), or None if it has no shingles."""
+    hashes = shingles(data)
+    if not hashes:
+        return None
+    bins = [EMPTY] * NUM_HASHES
+    for h in hashes:
+        # CRC-32 is linear; multiplying by an odd constant spreads every
+        # input bit into the top bits that pick the bin
+        h = (h * 0x9E3779B1) & 0xFFFFFFFF
+        b = h >> VALUE_BITS
+        v = h & VALUE_MASK
+        if v < bins[b]:
+            bins[b] = v
+    sig = array("H", bytes(2 * NUM_HASHES))
+    for i in range(NUM_HASHES):
+        value = bins[i]
+        distance = 0
+        while value == EMPTY:
+            distance += 1
+            value = bins[(i + distance) % NUM_HASHES]
+        # A bin as far from the filled one in both pastes gets the same value,
+        # and the distance goes into the kept bits so that an empty bin next
+        # to a filled one does not just agree wherever its neighbour does
+        sig[i] = (value ^ (distance * 0x9E37)) & 0xFFFF
+    return sig
+
+
+def buckets(sig: array) -> list[int]:
+    """One LSH bucket per band: the band number above a hash of its values."""
+    raw = sig.tobytes()
+    width = ROWS * sig.itemsize
+    mask = (1 << BUCKET_BITS) - 1
+    return [
+        (band << BUCKET_BITS) | (zlib.crc32(raw[band * width : (band + 1) * width]) & mask) for band in range(BANDS)
+    ]
+
+
+def similarity(a: array, b: array) -> float:
+    """Estimated Jaccard similarity of the pastes two signatures came from."""
+    return sum(x == y for x, y in zip(a, b)) / NUM_HASHES
+
+
+def from_bytes(raw: bytes) -> array:
+    sig = array("H")
+    sig.frombytes(raw)
+    return sig
+
+
+class Signer:
+    """Signs new pastes in a background thread and records them in the index.
+
+    Uploads only queue the paste; when the queue is full the paste is left
+    unsigned, and ``admin.py index-similar`` signs whatever was skipped.
+    """
+
+    QUEUE_SIZE = 64
+
+    def __init__(self, index):
+        self.index = index
+        self.pending = queue.Queue(self.QUEUE_SIZE)
+        self.lock = threading.Lock()
+        self.worker = None
+
+    def sign(self, checksum: str, data: bytes) -> array | None:
+        """Compute and record the signature of a paste already in the index."""
+        sig = signature(data)
+        self.index.add_signature(checksum, sig.tobytes() if sig else b"", buckets(sig) if sig else [])
+        return sig
+
+    def schedule(self, checksum: str, data: bytes) -> bool:
+        """Sign a paste in the background. Returns False if the queue is full."""
+        with self.lock:
+            if self.worker is None:
+                self.worker = threading.Thread(target=self._sign_loop, name="ppb-minhash", daemon=True)
+                self.worker.start()
+        try:
+            self.pending.put_nowait((checksum, data[:MAX_BYTES]))
+        except queue.Full:
+            logger.debug(f"Signature queue full, leaving {checksum[:16]} unsigned")
+            return False
+        return True
+
+    def _sign_loop(self) -> None:
+        while True:
+            checksum, data = self.pending.get()
+            try:
+                self.sign(checksum, data)
+            except Exception as e:
+                logger.error(f"Signing {checksum[:16]} failed: {e}")
+            finally:
+                self.pending.task_done()
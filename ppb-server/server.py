@@ -1,12 +1,25 @@
-from flask import Flask, request, Response
-from time import time
+from flask import Flask, g, request, Response
+from werkzeug.datastructures import ContentRange
+from time import monotonic, time
 from functools import wraps
+import atexit
+import errno
 import hashlib
 import json
 import secrets
 import logging
+import os
+import sqlite3
+import threading
 from pathlib import Path
 
+import debug
+import minhash
+import storage
+from index import Index
+from limits import RateLimiter
+from sketches import AccessStats, FrequencySketch
+
 # Configuration
 MAX_SIZE = 100 * (2**20)  # 100 MB
 PERMISSIONS = 0o600
@@ -14,6 +27,20 @@ DATA_DIR = Path("data")
 RAW_DIR = DATA_DIR / "raw"
 META_DIR = DATA_DIR / "meta"
 TOKENS_PATH = Path("tokens.json")
+INDEX_PATH = Path(os.environ.get("PPB_INDEX_PATH", DATA_DIR / "index.sqlite3"))
+RUN_DIR = Path(os.environ.get("PPB_RUN_DIR", DATA_DIR / "run"))
+MAX_PROFILE_SECONDS = 60
+META_XATTR = "user.ppb.meta"  # metadata record on the raw object in xattr mode
+META_IN_XATTR = os.environ.get("PPB_META_XATTR", "0") not in ("", "0")
+DEADLINE_HEADER = "X-PPB-Deadline-Ms"  # client's remaining time budget
+UPLOADS_PER_MINUTE = float(os.environ.get("PPB_UPLOADS_PER_MINUTE", 0))  # per token, 0 = off
+HOT_READS = int(os.environ.get("PPB_HOT_READS", 8))  # reads before a paste is cached
+HOT_CACHE_SIZE = int(os.environ.get("PPB_HOT_CACHE_MB", 0)) * (2**20)  # per worker, 0 = off
+HOT_CACHE_MAX_OBJECT = 4 * (2**20)
+TRACE_ALLOC = os.environ.get("PPB_TRACE_ALLOC", "0") not in ("", "0")
+SIMILAR = os.environ.get("PPB_SIMILAR", "0") not in ("", "0")  # sign pastes for /similar
+SIMILAR_CANDIDATES = 1000  # most pastes compared per /similar query
+SIMILAR_MAX_RESULTS = 100
 
 # Setup logging
 logging.basicConfig(
@@ -27,11 +54,80 @@ _valid_tokens = set()
 
 def ensure_struct():
     """Create necessary directory structure if it doesn't exist."""
+    if local_store() is None:
+        return
     RAW_DIR.mkdir(parents=True, exist_ok=True)
     META_DIR.mkdir(parents=True, exist_ok=True)
     logger.info(f"Ensured directory structure exists at {DATA_DIR}")
 
 
+def raw_key(sha: str) -> str:
+    """Storage key of the raw object for a checksum."""
+    return f"{RAW_DIR.name}/{sha}"
+
+
+def meta_key(sha: str) -> str:
+    """Storage key of the metadata record for a checksum."""
+    return f"{META_DIR.name}/{sha}.json"
+
+
+def local_store() -> storage.LocalStorage | None:
+    """The local filesystem backend behind ``store``, if there is one."""
+    return storage.find_backend(store, storage.LocalStorage)
+
+
+def resolve_meta_mode() -> bool:
+    """Whether metadata goes into xattrs; falls back to files if unsupported."""
+    if not META_IN_XATTR:
+        return False
+    backend = local_store()
+    if backend is None:
+        logger.warning("PPB_META_XATTR needs local storage, keeping metadata in files")
+        return False
+    if not backend.supports_xattrs(RAW_DIR.name):
+        logger.warning(f"{DATA_DIR} does not support user xattrs, keeping metadata in files")
+        return False
+    logger.info("Storing metadata in extended attributes")
+    return True
+
+
+def object_stored(sha: str) -> bool:
+    """Whether both the object and its metadata are in the store."""
+    if meta_in_xattr:
+        # The xattr is set before the object appears, and objects written
+        # earlier in file mode still have their meta file
+        return store.exists(raw_key(sha))
+    return store.exists(raw_key(sha)) and store.exists(meta_key(sha))
+
+
+def store_object(data, meta: dict) -> None:
+    """Write an object and its metadata record."""
+    record = json.dumps(meta, indent=2).encode()
+    if meta_in_xattr:
+        # One file: the record rides along as an xattr, set before the rename
+        store.put(raw_key(meta["checksum"]), data, xattrs={META_XATTR: record})
+        return
+    # Write data first so a metadata record never points at a missing object
+    store.put(raw_key(meta["checksum"]), data)
+    store.put(meta_key(meta["checksum"]), record)
+
+
+def read_meta(sha: str) -> dict | None:
+    """Metadata record of a stored object, from its xattr or its meta file."""
+    backend = local_store()
+    if backend is not None:
+        try:
+            record = backend.get_xattr(raw_key(sha), META_XATTR)
+        except FileNotFoundError:
+            return None
+        if record is not None:
+            return json.loads(record)
+    try:
+        return json.loads(store.get(meta_key(sha)))
+    except FileNotFoundError:
+        return None
+
+
 def generate_sha256(input_bytes: bytes) -> tuple[int, str]:
     """Generate SHA256 hash and size for input bytes."""
     size = len(input_bytes)
@@ -45,41 +141,76 @@ def generate_meta(size: int, sha: str) -> dict:
     return {"created_at": time(), "size": size, "checksum": sha, "short": sha[:16]}
 
 
-def save_data(data: bytes, base_url: str = "") -> tuple[dict, int]:
-    """Save data and metadata to disk."""
+def request_deadline() -> float | None:
+    """Monotonic time by which the client needs an answer, if it sent one."""
+    value = request.headers.get(DEADLINE_HEADER)
+    if value is None:
+        return None
+    try:
+        return monotonic() + max(0, int(value)) / 1000
+    except ValueError:
+        return None
+
+
+def deadline_passed(deadline: float | None) -> bool:
+    return deadline is not None and monotonic() >= deadline
+
+
+def shed(phase: str, nbytes: int) -> tuple[dict, int]:
+    """Abandon a request whose client has given up, and count the work shed."""
+    logger.warning(f"Deadline exceeded before {phase}, shedding {nbytes} bytes")
+    access_stats.record_shed(phase, nbytes)
+    return {"error": "deadline exceeded"}, 504
+
+
+def send_continue():
+    """Send the 100 Continue that gunicorn.conf.py held back, if it did."""
+    if request.environ.get("HTTP_X_PPB_CONTINUE_DEFERRED") != "1":
+        return
+    sock = request.environ.get("gunicorn.socket")
+    if sock is not None:
+        sock.sendall(b"HTTP/1.1 100 Continue\r\n\r\n")
+
+
+def save_data(data: bytes, base_url: str = "", deadline: float | None = None) -> tuple[dict, int]:
+    """Save data and metadata to disk.
+
+    If ``deadline`` (a time.monotonic() value) passes before the write
+    starts, nothing is written and 504 is returned.
+    """
     if len(data) > MAX_SIZE:
         logger.warning(f"Upload rejected: size {len(data)} exceeds max {MAX_SIZE}")
         return {"error": "file too large"}, 413
 
     size, sha = generate_sha256(data)
     meta = generate_meta(size, sha)
-
-    data_path = RAW_DIR / meta["checksum"]
-    meta_path = META_DIR / f"{meta['checksum']}.json"
+    if deadline_passed(deadline):
+        return shed("write", size)
 
     result = {"meta": meta}
     if base_url:
         result["url"] = f"{base_url}/raw/{meta['short']}"
 
     # Check if files already exist
-    if data_path.exists() and meta_path.exists():
-        logger.info(f"File {sha[:16]} already exists, skipping save")
-        return result, 200
-
     try:
-        # Write data file
-        data_path.write_bytes(data)
-        data_path.chmod(PERMISSIONS)
-
-        # Write metadata file
-        with open(meta_path, "w") as file:
-            json.dump(meta, file, indent=2)
-        meta_path.chmod(PERMISSIONS)
+        if object_stored(sha):
+            logger.info(f"File {sha[:16]} already exists, skipping save")
+            # Objects stored before the index existed are picked up here
+            if index.get(sha) is None:
+                index.add(read_meta(sha) or meta)
+            return result, 200
+
+        store_object(data, meta)
+        index.add(meta)
+        if signer:
+            signer.schedule(sha, data)
 
         logger.info(f"Saved file {sha[:16]} ({size} bytes)")
         return result, 200
-    except (IOError, OSError) as e:
+    except (IOError, OSError, sqlite3.Error) as e:
         logger.error(f"Failed to save file: {e}")
+        if getattr(e, "errno", None) == errno.ENOSPC:
+            return {"error": "storage full"}, 507
         return {"error": "upload failed"}, 500
 
 
@@ -125,27 +256,87 @@ def require_auth(f):
             logger.warning(f"Invalid token attempt from {request.remote_addr}")
             return {"error": "invalid token"}, 401
 
+        g.token = token
         return f(*args, **kwargs)
 
     return decorated
 
 
 # Initialize
+store = storage.from_env(DATA_DIR, PERMISSIONS)
+index = Index(INDEX_PATH)
 ensure_struct()
+meta_in_xattr = resolve_meta_mode()
+chunked_store = storage.find_backend(store, storage.ChunkedStorage)
+compressed_store = storage.find_backend(store, storage.CompressedStorage)
+signer = minhash.Signer(index) if SIMILAR else None
 
 app = Flask(__name__)
 
+alloc_tracker = debug.AllocTracker() if TRACE_ALLOC else None
+
+
+def begin_alloc_tracking():
+    """Mark the allocation level at request start."""
+    alloc_tracker.begin_request()
+
+
+def end_alloc_tracking(response):
+    """Account the request's allocations and expose them to the access log."""
+    payload_size = max(request.content_length or 0, response.content_length or 0)
+    peak, net = alloc_tracker.end_request(request.endpoint, payload_size)
+    response.headers["X-PPB-Alloc-Peak"] = str(peak)
+    response.headers["X-PPB-Alloc-Net"] = str(net)
+    return response
+
+
+# Hooks are only registered when tracing, so the default path pays nothing
+if alloc_tracker:
+    alloc_tracker.start()
+    app.before_request(begin_alloc_tracking)
+    app.after_request(end_alloc_tracking)
+    logger.info("Allocation tracing enabled")
+
+profile_control = debug.ProfileControl(RUN_DIR)
+profile_control.register()
+
+access_stats = AccessStats(RUN_DIR)
+atexit.register(access_stats.flush)
+hot_cache = storage.ObjectCache(HOT_CACHE_SIZE, HOT_CACHE_MAX_OBJECT) if HOT_CACHE_SIZE else None
+hot_reads = FrequencySketch() if hot_cache is not None else None
+upload_limiter = RateLimiter(UPLOADS_PER_MINUTE) if UPLOADS_PER_MINUTE > 0 else None
+
 
 @app.post("/upload")
 @require_auth
 def upload():
     """Handle file upload."""
+    # Everything up to send_continue() only looks at headers, so rejected
+    # clients that sent "Expect: 100-continue" never transmit the body
+    if request.content_length is not None and request.content_length > MAX_SIZE:
+        logger.warning(f"Upload rejected: declared size {request.content_length} exceeds max {MAX_SIZE}")
+        return {"error": "file too large"}, 413
+
+    if upload_limiter and not upload_limiter.allow(g.token):
+        logger.warning(f"Upload rate limit exceeded from {request.remote_addr}")
+        retry_after = upload_limiter.retry_after(g.token)
+        return {"error": "rate limit exceeded"}, 429, {"Retry-After": str(retry_after)}
+
+    deadline = request_deadline()
+    if deadline_passed(deadline):
+        return shed("body", request.content_length or 0)
+
+    send_continue()
     data = request.get_data()
+    if deadline_passed(deadline):
+        return shed("hash", len(data))
+
     base_url = request.host_url.rstrip("/")
-    result, status_code = save_data(data, base_url)
+    result, status_code = save_data(data, base_url, deadline)
 
     if status_code == 200:
         logger.info(f"Upload successful from {request.remote_addr}")
+        access_stats.record_upload(g.token, request.remote_addr or "", len(data))
 
     return result, status_code
 
@@ -172,50 +363,230 @@ def generate_token():
     return {"token": token}, 201
 
 
+def stream_chunks(stream: storage.ChunkStream) -> Response:
+    """Response that reads a chunked or compressed object while it is sent."""
+
+    def body():
+        with stream:
+            yield from storage.iter_chunks(stream)
+
+    # The manifest or seek table records whether the object is text, as
+    # decoding it would tell
+    mimetype = "text/plain; charset=utf-8" if stream.text else "application/octet-stream"
+    response = Response(body(), mimetype=mimetype)
+    response.content_length = stream.size
+    response.accept_ranges = "bytes"
+    return response
+
+
+def raw_response(data: bytes, status: int = 200) -> Response:
+    """Text if the bytes are UTF-8, binary otherwise."""
+    try:
+        text = data.decode("utf-8")
+        response = Response(text, status=status, mimetype="text/plain; charset=utf-8")
+    except UnicodeDecodeError:
+        response = Response(data, status=status, mimetype="application/octet-stream")
+    response.accept_ranges = "bytes"
+    return response
+
+
+def parse_lines(value: str) -> tuple[int | None, int | None]:
+    """``START:STOP`` line indexes as in a Python slice; either may be empty."""
+    start, colon, stop = value.partition(":")
+    if not colon:
+        raise ValueError(value)
+    return int(start) if start else None, int(stop) if stop else None
+
+
+def read_part(key: str, checksum: str) -> Response | tuple[dict, int]:
+    """The lines (``?lines=``) or bytes (``Range``) of an object a request asks for.
+
+    Only the part is read, so with compressed storage only the frames
+    holding it are decompressed. Parts are never put in the hot cache.
+    """
+    lines = request.args.get("lines")
+    if lines is not None:
+        try:
+            start, stop = parse_lines(lines)
+        except ValueError:
+            return {"error": "lines must be START:STOP"}, 400
+        data = storage.get_lines(store, key, start, stop)
+        response = raw_response(data)
+    else:
+        size = store.size(key)
+        start, stop = request.range.ranges[0]
+        if start < 0:
+            # The last -start bytes, or all of a shorter object
+            start, stop = max(size + start, 0), size
+        stop = size if stop is None else min(stop, size)
+        if start >= stop:
+            return {"error": "range not satisfiable"}, 416, {"Content-Range": f"bytes */{size}"}
+        data = store.get_range(key, start, stop)
+        response = raw_response(data, 206)
+        response.content_range = ContentRange("bytes", start, stop, size)
+    access_stats.record_read(checksum, request.remote_addr or "", len(data))
+    return response
+
+
 @app.get("/raw/<sha>")
 def get_raw(sha):
-    """Retrieve raw file by SHA256 hash or short hash."""
-    data_path = RAW_DIR / sha
+    """Retrieve raw file by SHA256 hash or short hash, or the part a request asks for."""
+    if "/" in sha or sha.startswith("."):
+        return {"error": "not found"}, 404
+
+    key = raw_key(sha)
 
-    # Try exact match first
-    if data_path.exists():
+    # Try exact match first, then short hash matching (if hash is <= 16 chars)
+    if not store.exists(key):
+        if len(sha) > 16:
+            return {"error": "not found"}, 404
         try:
-            data = data_path.read_bytes()
+            matches = list(store.list(raw_key(sha)))
+        except (IOError, OSError) as e:
+            logger.error(f"Failed to list files for {sha}: {e}")
+            return {"error": "read failed"}, 500
+
+        if len(matches) == 0:
+            return {"error": "not found"}, 404
+        elif len(matches) > 1:
+            logger.warning(f"Ambiguous short hash: {sha}")
+            return {"error": "ambiguous short hash"}, 400
 
-            try:
-                text = data.decode("utf-8")
-                return Response(text, mimetype="text/plain; charset=utf-8")
-            except UnicodeDecodeError:
-                return Response(data, mimetype="application/octet-stream")
+        # Exactly one match
+        key = matches[0]
+
+    checksum = key.rpartition("/")[2]
+    # Several ranges in one request are answered with the whole object
+    if "lines" in request.args or (request.range is not None and len(request.range.ranges) == 1):
+        try:
+            return read_part(key, checksum)
+        except FileNotFoundError:
+            return {"error": "not found"}, 404
         except (IOError, OSError) as e:
-            logger.error(f"Failed to read file {sha}: {e}")
+            logger.error(f"Failed to read part of file {sha}: {e}")
             return {"error": "read failed"}, 500
 
-    # Try short hash matching (if hash is <= 16 chars)
-    if len(sha) <= 16:
+    data = hot_cache.get(checksum) if hot_cache is not None else None
+    if data is None:
         try:
-            files = list(RAW_DIR.iterdir())
-            matches = [f for f in files if f.name.startswith(sha)]
+            if chunked_store is None and compressed_store is None:
+                data = store.get(key)
+            else:
+                stream = store.open(key)
+                if isinstance(stream, storage.ChunkStream) and stream.size > HOT_CACHE_MAX_OBJECT:
+                    # Never cached anyway: send it as the pieces are read
+                    access_stats.record_read(checksum, request.remote_addr or "", stream.size)
+                    return stream_chunks(stream)
+                with stream:
+                    data = stream.read()
+        except FileNotFoundError:
+            return {"error": "not found"}, 404
+        except (IOError, OSError) as e:
+            logger.error(f"Failed to read file {sha}: {e}")
+            return {"error": "read failed"}, 500
+
+    access_stats.record_read(checksum, request.remote_addr or "", len(data))
+    # Pastes read often lately are kept in memory for the following reads
+    if hot_cache is not None and hot_reads.add(checksum) >= HOT_READS:
+        hot_cache.put(checksum, data)
+
+    return raw_response(data)
 
+
+@app.get("/similar/<sha>")
+@require_auth
+def similar(sha):
+    """Pastes with nearly the same content as this one, most similar first."""
+    if signer is None:
+        return {"error": "similarity index disabled"}, 404
+    try:
+        limit = min(max(int(request.args.get("limit", 10)), 1), SIMILAR_MAX_RESULTS)
+        threshold = float(request.args.get("threshold", 0.5))
+    except ValueError:
+        return {"error": "limit and threshold must be numbers"}, 400
+
+    try:
+        paste = index.get(sha)
+        if paste is None:
+            matches = index.find(sha) if len(sha) <= 16 else []
             if len(matches) == 0:
                 return {"error": "not found"}, 404
             elif len(matches) > 1:
-                logger.warning(f"Ambiguous short hash: {sha}")
                 return {"error": "ambiguous short hash"}, 400
+            paste = matches[0]
 
-            # Exactly one match
-            data = matches[0].read_bytes()
+        raw = index.signature(paste["seq"])
+        if raw is None:
+            # Still queued, or skipped while the queue was full
+            data = store.get_range(raw_key(paste["checksum"]), 0, minhash.MAX_BYTES)
+            sig = signer.sign(paste["checksum"], data)
+        else:
+            sig = minhash.from_bytes(raw) if raw else None
+        candidates = index.candidates(minhash.buckets(sig), SIMILAR_CANDIDATES) if sig else []
+    except FileNotFoundError:
+        return {"error": "not found"}, 404
+    except (IOError, OSError, sqlite3.Error) as e:
+        logger.error(f"Failed to look up pastes similar to {sha}: {e}")
+        return {"error": "lookup failed"}, 500
+
+    found = []
+    for row in candidates:
+        if row["seq"] == paste["seq"]:
+            continue
+        score = minhash.similarity(sig, minhash.from_bytes(row["signature"]))
+        if score >= threshold:
+            found.append(
+                {"checksum": row["checksum"], "short": row["short"], "size": row["size"], "similarity": score}
+            )
+    found.sort(key=lambda match: match["similarity"], reverse=True)
+    return {"checksum": paste["checksum"], "similar": found[:limit]}, 200
+
+
+@app.get("/debug/alloc")
+@require_auth
+def debug_alloc():
+    """Per-endpoint allocation statistics for this worker."""
+    if not alloc_tracker:
+        return {"error": "allocation tracing disabled (set PPB_TRACE_ALLOC=1)"}, 404
+    return alloc_tracker.snapshot(), 200
 
-            try:
-                text = data.decode("utf-8")
-                return Response(text, mimetype="text/plain; charset=utf-8")
-            except UnicodeDecodeError:
-                return Response(data, mimetype="application/octet-stream")
-        except (IOError, OSError) as e:
-            logger.error(f"Failed to read file {sha}: {e}")
-            return {"error": "read failed"}, 500
 
-    return {"error": "not found"}, 404
+@app.get("/debug/profile")
+@require_auth
+def debug_profile():
+    """Sample stacks for N seconds and return them in collapsed format."""
+    try:
+        seconds = float(request.args.get("seconds", 10))
+        interval = float(request.args.get("interval_ms", 10)) / 1000
+    except ValueError:
+        return {"error": "invalid seconds or interval_ms"}, 400
+    if not 0 < seconds <= MAX_PROFILE_SECONDS or not 0.001 <= interval <= 1:
+        return {"error": f"seconds must be in (0, {MAX_PROFILE_SECONDS}], interval_ms in [1, 1000]"}, 400
+
+    scope = request.args.get("scope", "all")
+    if scope == "worker":
+        # Only useful with threaded workers: sample this process's other threads
+        counts = debug.sample_stacks(seconds, interval, exclude={threading.get_ident()})
+        workers = 1
+    elif scope == "all":
+        try:
+            counts, workers = profile_control.profile_all(seconds, interval)
+        except BlockingIOError:
+            return {"error": "a profile is already running"}, 409
+    else:
+        return {"error": "scope must be 'all' or 'worker'"}, 400
+
+    logger.info(f"Profiled {workers} worker(s) for {seconds}s from {request.remote_addr}")
+    response = Response(debug.format_collapsed(counts), mimetype="text/plain")
+    response.headers["X-PPB-Profile-Workers"] = str(workers)
+    return response
+
+
+@app.get("/stats")
+@require_auth
+def stats():
+    """Access analytics merged across all workers."""
+    return access_stats.merged().summary(), 200
 
 
 @app.get("/health")
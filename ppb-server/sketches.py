@@ -0,0 +1,413 @@
+"""Bounded-memory access analytics for ppb-server.
+
+Each worker keeps its own sketches and periodically writes them to
+``run_dir/stats/<pid>.json``. All sketches here merge losslessly (sums,
+maxima), so the ``/stats`` endpoint combines the files of every worker into
+one view.
+"""
+
+import base64
+import fcntl
+import hashlib
+import json
+import math
+import os
+import threading
+from array import array
+from collections import Counter, OrderedDict
+from pathlib import Path
+
+
+def _hashes(key: str, count: int, modulus: int) -> list[int]:
+    """``count`` independent bucket indexes for key (Kirsch-Mitzenmacher)."""
+    digest = hashlib.blake2b(key.encode(), digest_size=16).digest()
+    h1 = int.from_bytes(digest[:8], "little")
+    h2 = int.from_bytes(digest[8:], "little") | 1
+    return [(h1 + i * h2) % modulus for i in range(count)]
+
+
+def _pack(values: array) -> str:
+    return base64.b64encode(values.tobytes()).decode()
+
+
+def _unpack(typecode: str, data: str) -> array:
+    values = array(typecode)
+    values.frombytes(base64.b64decode(data))
+    return values
+
+
+class CountMinSketch:
+    """Frequency estimates with one-sided error of about ``2/width * total``."""
+
+    def __init__(self, width: int = 2048, depth: int = 4):
+        self.width = width
+        self.depth = depth
+        self.counters = array("Q", bytes(8 * width * depth))
+
+    def add(self, key: str, count: int = 1) -> int:
+        """Add to key's count and return its new estimate."""
+        estimate = None
+        for row, index in enumerate(_hashes(key, self.depth, self.width)):
+            slot = row * self.width + index
+            self.counters[slot] += count
+            value = self.counters[slot]
+            estimate = value if estimate is None else min(estimate, value)
+        return estimate
+
+    def estimate(self, key: str) -> int:
+        return min(
+            self.counters[row * self.width + index]
+            for row, index in enumerate(_hashes(key, self.depth, self.width))
+        )
+
+    def merge(self, other: "CountMinSketch") -> None:
+        for slot, value in enumerate(other.counters):
+            self.counters[slot] += value
+
+    def halve(self) -> None:
+        self.counters = array("Q", (value >> 1 for value in self.counters))
+
+    def to_dict(self) -> dict:
+        return {"width": self.width, "depth": self.depth, "counters": _pack(self.counters)}
+
+    @classmethod
+    def from_dict(cls, data: dict) -> "CountMinSketch":
+        sketch = cls(data["width"], data["depth"])
+        sketch.counters = _unpack("Q", data["counters"])
+        return sketch
+
+
+class FrequencySketch:
+    """Recent read counts for cache admission, as in TinyLFU.
+
+    A Count-Min sketch whose counters are all halved every ``window``
+    additions, so a key's estimate reflects its reads in roughly the last
+    two windows and the noise from other keys stays near ``window / width``
+    instead of growing with uptime.
+    """
+
+    def __init__(self, width: int = 4096, depth: int = 4, window: int | None = None):
+        self.sketch = CountMinSketch(width, depth)
+        self.window = window or width
+        self.added = 0
+
+    def add(self, key: str) -> int:
+        """Count a read of key and return its estimated recent reads."""
+        estimate = self.sketch.add(key)
+        self.added += 1
+        if self.added >= self.window:
+            self.sketch.halve()
+            self.added = 0
+        return estimate
+
+
+class HyperLogLog:
+    """Cardinality estimate with a standard error of about ``1.04 / sqrt(2**p)``."""
+
+    def __init__(self, p: int = 10):
+        self.p = p
+        self.registers = bytearray(1 << p)
+
+    def add(self, key: str) -> None:
+        value = int.from_bytes(hashlib.blake2b(key.encode(), digest_size=8).digest(), "little")
+        index = value & ((1 << self.p) - 1)
+        rest = value >> self.p
+        rank = (64 - self.p) - rest.bit_length() + 1
+        if rank > self.registers[index]:
+            self.registers[index] = rank
+
+    def count(self) -> int:
+        m = len(self.registers)
+        alpha = 0.7213 / (1 + 1.079 / m)
+        estimate = alpha * m * m / sum(2.0**-r for r in self.registers)
+        zeros = self.registers.count(0)
+        if estimate <= 2.5 * m and zeros:
+            estimate = m * math.log(m / zeros)  # small-range correction
+        return round(estimate)
+
+    def merge(self, other: "HyperLogLog") -> None:
+        self.registers = bytearray(max(a, b) for a, b in zip(self.registers, other.registers))
+
+    def to_dict(self) -> dict:
+        return {"p": self.p, "registers": base64.b64encode(self.registers).decode()}
+
+    @classmethod
+    def from_dict(cls, data: dict) -> "HyperLogLog":
+        sketch = cls(data["p"])
+        sketch.registers = bytearray(base64.b64decode(data["registers"]))
+        return sketch
+
+
+class SizeHistogram:
+    """Request counts and bytes per power-of-two size bucket."""
+
+    BUCKETS = 40
+
+    def __init__(self):
+        self.counts = array("Q", bytes(8 * self.BUCKETS))
+        self.bytes = array("Q", bytes(8 * self.BUCKETS))
+
+    def add(self, size: int) -> None:
+        bucket = min(size.bit_length(), self.BUCKETS - 1)
+        self.counts[bucket] += 1
+        self.bytes[bucket] += size
+
+    def merge(self, other: "SizeHistogram") -> None:
+        for bucket in range(self.BUCKETS):
+            self.counts[bucket] += other.counts[bucket]
+            self.bytes[bucket] += other.bytes[bucket]
+
+    def summary(self) -> list[dict]:
+        return [
+            {"le": (1 << bucket) - 1, "requests": self.counts[bucket], "bytes": self.bytes[bucket]}
+            for bucket in range(self.BUCKETS)
+            if self.counts[bucket]
+        ]
+
+    def to_dict(self) -> dict:
+        return {"counts": _pack(self.counts), "bytes": _pack(self.bytes)}
+
+    @classmethod
+    def from_dict(cls, data: dict) -> "SizeHistogram":
+        histogram = cls()
+        histogram.counts = _unpack("Q", data["counts"])
+        histogram.bytes = _unpack("Q", data["bytes"])
+        return histogram
+
+
+class TopK:
+    """Heavy hitters on top of a Count-Min sketch, with per-key unique clients.
+
+    Only the current top candidates carry a HyperLogLog, so memory stays
+    bounded by ``k`` no matter how many distinct keys are seen.
+    """
+
+    def __init__(self, k: int = 50, width: int = 2048, depth: int = 4, hll_p: int = 8):
+        self.k = k
+        self.hll_p = hll_p
+        self.sketch = CountMinSketch(width, depth)
+        self.candidates = {}  # key -> HyperLogLog of clients
+
+    def add(self, key: str, client: str) -> int:
+        estimate = self.sketch.add(key)
+        clients = self.candidates.get(key)
+        if clients is None:
+            if len(self.candidates) >= 2 * self.k:
+                self._prune()
+            clients = self.candidates[key] = HyperLogLog(self.hll_p)
+        clients.add(client)
+        return estimate
+
+    def estimate(self, key: str) -> int:
+        return self.sketch.estimate(key)
+
+    def _prune(self) -> None:
+        keep = sorted(self.candidates, key=self.sketch.estimate, reverse=True)[: self.k]
+        self.candidates = {key: self.candidates[key] for key in keep}
+
+    def merge(self, other: "TopK") -> None:
+        self.sketch.merge(other.sketch)
+        for key, clients in other.candidates.items():
+            if key in self.candidates:
+                self.candidates[key].merge(clients)
+            else:
+                self.candidates[key] = clients
+        if len(self.candidates) > 2 * self.k:
+            self._prune()
+
+    def top(self) -> list[tuple[str, int, int]]:
+        """(key, estimated count, estimated unique clients), hottest first."""
+        ranked = sorted(self.candidates, key=self.sketch.estimate, reverse=True)[: self.k]
+        return [(key, self.sketch.estimate(key), self.candidates[key].count()) for key in ranked]
+
+    def to_dict(self) -> dict:
+        return {
+            "k": self.k,
+            "sketch": self.sketch.to_dict(),
+            "candidates": {key: hll.to_dict() for key, hll in self.candidates.items()},
+        }
+
+    @classmethod
+    def from_dict(cls, data: dict) -> "TopK":
+        top = cls(data["k"])
+        top.sketch = CountMinSketch.from_dict(data["sketch"])
+        top.candidates = {key: HyperLogLog.from_dict(h) for key, h in data["candidates"].items()}
+        if top.candidates:
+            top.hll_p = next(iter(top.candidates.values())).p
+        return top
+
+
+class AccessStats:
+    """Per-worker access analytics, persisted for cross-worker merging.
+
+    After the first change, a one-shot timer writes the worker's file within
+    FLUSH_INTERVAL seconds, so idle workers run no threads and readers see
+    data at most that old.
+    """
+
+    FLUSH_INTERVAL = 5.0  # seconds
+    MAX_TOKENS = 1024
+
+    def __init__(self, run_dir: Path):
+        self.stats_dir = Path(run_dir) / "stats"
+        self.reads = TopK()
+        self.clients = HyperLogLog(12)
+        self.served = SizeHistogram()
+        self.uploaded = SizeHistogram()
+        self.tokens = OrderedDict()  # token label -> HyperLogLog, least recent first
+        self.shed = Counter()  # "<phase>:requests" / "<phase>:bytes" for deadline shedding
+        self.lock = threading.Lock()
+        self.timer = None
+
+    def record_read(self, checksum: str, client: str, size: int) -> int:
+        """Account a served paste; returns the paste's estimated read count."""
+        with self.lock:
+            self.clients.add(client)
+            self.served.add(size)
+            estimate = self.reads.add(checksum, client)
+        self.schedule_flush()
+        return estimate
+
+    def record_upload(self, token: str, client: str, size: int) -> None:
+        # Never keep tokens themselves in stats files
+        label = hashlib.sha256(token.encode()).hexdigest()[:12]
+        with self.lock:
+            clients = self.tokens.pop(label, None)
+            if clients is None:
+                if len(self.tokens) >= self.MAX_TOKENS:
+                    self.tokens.popitem(last=False)
+                clients = HyperLogLog(8)
+            self.tokens[label] = clients
+            clients.add(client)
+            self.clients.add(client)
+            self.uploaded.add(size)
+        self.schedule_flush()
+
+    def record_shed(self, phase: str, nbytes: int) -> None:
+        """Account a request abandoned because its deadline passed before ``phase``."""
+        with self.lock:
+            self.shed[f"{phase}:requests"] += 1
+            self.shed[f"{phase}:bytes"] += nbytes
+        self.schedule_flush()
+
+    def schedule_flush(self) -> None:
+        if self.timer is None:
+            self.timer = threading.Timer(self.FLUSH_INTERVAL, self.flush)
+            self.timer.daemon = True
+            self.timer.start()
+
+    def flush(self) -> None:
+        self.timer = None
+        self.stats_dir.mkdir(parents=True, exist_ok=True)
+        path = self.stats_dir / f"{os.getpid()}.json"
+        tmp = path.with_suffix(".tmp")
+        with self.lock:
+            data = json.dumps(self.to_dict())
+        tmp.write_text(data)
+        os.replace(tmp, path)
+
+    def merge(self, other: "AccessStats") -> None:
+        self.reads.merge(other.reads)
+        self.clients.merge(other.clients)
+        self.served.merge(other.served)
+        self.uploaded.merge(other.uploaded)
+        for label, clients in other.tokens.items():
+            if label in self.tokens:
+                self.tokens[label].merge(clients)
+            else:
+                self.tokens[label] = clients
+        self.shed.update(other.shed)
+
+    def to_dict(self) -> dict:
+        return {
+            "reads": self.reads.to_dict(),
+            "clients": self.clients.to_dict(),
+            "served": self.served.to_dict(),
+            "uploaded": self.uploaded.to_dict(),
+            "tokens": {label: hll.to_dict() for label, hll in self.tokens.items()},
+            "shed": dict(self.shed),
+        }
+
+    def load(self, data: dict) -> None:
+        self.reads = TopK.from_dict(data["reads"])
+        self.clients = HyperLogLog.from_dict(data["clients"])
+        self.served = SizeHistogram.from_dict(data["served"])
+        self.uploaded = SizeHistogram.from_dict(data["uploaded"])
+        self.tokens = OrderedDict(
+            (label, HyperLogLog.from_dict(h)) for label, h in data["tokens"].items()
+        )
+        self.shed = Counter(data.get("shed", {}))
+
+    def merged(self) -> "AccessStats":
+        """Combine the stats of every worker, live or exited.
+
+        Files of exited workers are folded into ``archive.json`` so the
+        directory does not grow with worker restarts.
+        """
+        self.flush()
+        total = AccessStats(self.stats_dir.parent)
+        with open(self.stats_dir / "merge.lock", "w") as lock:
+            fcntl.flock(lock, fcntl.LOCK_EX)
+            archive = AccessStats(self.stats_dir.parent)
+            archive_path = self.stats_dir / "archive.json"
+            if archive_path.exists():
+                archive.load(json.loads(archive_path.read_text()))
+            archived = False
+
+            for path in self.stats_dir.glob("*.json"):
+                if not path.stem.isdigit():
+                    continue
+                worker = AccessStats(self.stats_dir.parent)
+                try:
+                    worker.load(json.loads(path.read_text()))
+                except (OSError, ValueError):
+                    continue
+                if _alive(int(path.stem)):
+                    total.merge(worker)
+                else:
+                    archive.merge(worker)
+                    path.unlink()
+                    archived = True
+
+            if archived:
+                tmp = archive_path.with_suffix(".tmp")
+                tmp.write_text(json.dumps(archive.to_dict()))
+                os.replace(tmp, archive_path)
+            total.merge(archive)
+        return total
+
+    def summary(self) -> dict:
+        return {
+            "unique_clients": self.clients.count(),
+            "hot": [
+                {"checksum": key, "reads": reads, "unique_clients": clients}
+                for key, reads, clients in self.reads.top()
+            ],
+            "tokens": sorted(
+                ({"token": label, "unique_clients": hll.count()} for label, hll in self.tokens.items()),
+                key=lambda item: item["unique_clients"],
+                reverse=True,
+            ),
+            "served": self.served.summary(),
+            "uploaded": self.uploaded.summary(),
+            "deadline_shed": _shed_summary(self.shed),
+        }
+
+
+def _shed_summary(shed: Counter) -> dict:
+    """{"<phase>:requests": n, "<phase>:bytes": b} -> {phase: {"requests", "bytes"}}."""
+    phases = {}
+    for key, value in shed.items():
+        phase, _, field = key.partition(":")
+        phases.setdefault(phase, {"requests": 0, "bytes": 0})[field] = value
+    return phases
+
+
+def _alive(pid: int) -> bool:
+    try:
+        os.kill(pid, 0)
+    except ProcessLookupError:
+        return False
+    except PermissionError:
+        pass
+    return True
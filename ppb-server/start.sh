@@ -24,13 +24,22 @@ if [ ! -f "tokens.json" ]; then
     echo '[]' > tokens.json
 fi
 
+# With allocation tracing on, log each request's peak/net allocated bytes
+ACCESS_LOG_FORMAT='%(h)s %(l)s %(u)s %(t)s "%(r)s" %(s)s %(b)s "%(f)s" "%(a)s"'
+if [ -n "$PPB_TRACE_ALLOC" ] && [ "$PPB_TRACE_ALLOC" != "0" ]; then
+    echo "Allocation tracing: enabled"
+    ACCESS_LOG_FORMAT="$ACCESS_LOG_FORMAT alloc_peak=%({x-ppb-alloc-peak}o)s alloc_net=%({x-ppb-alloc-net}o)s"
+fi
+
 # Start Gunicorn
 exec gunicorn \
+    --config gunicorn.conf.py \
     --bind "$HOST:$PORT" \
     --workers "$WORKERS" \
     --worker-class sync \
     --log-level "$LOG_LEVEL" \
     --access-logfile - \
+    --access-logformat "$ACCESS_LOG_FORMAT" \
     --error-logfile - \
     --timeout 120 \
     server:app
\ No newline at end of file
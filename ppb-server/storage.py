@@ -0,0 +1,1373 @@
+"""Object storage backends for ppb-server.
+
+Objects are addressed by slash-separated keys such as ``raw/<sha>`` and
+``meta/<sha>.json``. The server only talks to the ``StorageBackend``
+interface, so the same code runs against a local data directory or an
+S3-compatible bucket (AWS S3, MinIO, Ceph RGW, ...), or across several
+local volumes with erasure coding. Any of them can store objects as
+deduplicated chunks, compressed, or both.
+"""
+
+import bisect
+import codecs
+import errno
+import functools
+import hashlib
+import io
+import itertools
+import logging
+import os
+import queue
+import random
+import struct
+import tempfile
+import threading
+import time
+import zlib
+from collections import OrderedDict
+from pathlib import Path
+from typing import BinaryIO, Iterator
+
+import chunking
+from erasure import ReedSolomon
+
+try:
+    from compression import zstd
+except ImportError:  # Python built without zstd support
+    zstd = None
+
+logger = logging.getLogger(__name__)
+
+CHUNK_SIZE = 1 << 20  # 1 MB
+FRAME_SIZE = 256 * 1024  # bytes compressed into each independent frame
+LINE_BLOCK = FRAME_SIZE  # reads of a line scan, one frame each in a compressed object
+
+
+def iter_chunks(data, chunk_size: int = CHUNK_SIZE) -> Iterator[bytes]:
+    """Yield chunks from bytes, a binary file object or an iterable of bytes."""
+    if isinstance(data, (bytes, bytearray, memoryview)):
+        view = memoryview(data)
+        for offset in range(0, len(view), chunk_size):
+            yield bytes(view[offset : offset + chunk_size])
+    elif hasattr(data, "read"):
+        while True:
+            chunk = data.read(chunk_size)
+            if not chunk:
+                break
+            yield chunk
+    else:
+        for chunk in data:
+            if chunk:
+                yield chunk
+
+
+def reblock(blocks, size: int) -> Iterator[bytes]:
+    """The bytes of ``blocks`` in pieces of exactly ``size``, but for the last."""
+    pending = bytearray()
+    for block in blocks:
+        pending += block
+        while len(pending) >= size:
+            yield bytes(pending[:size])
+            del pending[:size]
+    if pending:
+        yield bytes(pending)
+
+
+class StorageBackend:
+    """Interface every storage backend implements."""
+
+    def put(self, key: str, data) -> int:
+        """Store ``data`` (bytes, file object or iterable of bytes) under key.
+
+        Returns the number of bytes written.
+        """
+        raise NotImplementedError
+
+    def get(self, key: str) -> bytes:
+        """Return the whole object. Raises FileNotFoundError if missing."""
+        with self.open(key) as stream:
+            return stream.read()
+
+    def open(self, key: str) -> BinaryIO:
+        """Return a readable binary stream for the object."""
+        raise NotImplementedError
+
+    def get_range(self, key: str, start: int, end: int | None = None) -> bytes:
+        """Return bytes ``[start, end)`` of the object (to EOF if end is None)."""
+        raise NotImplementedError
+
+    def size(self, key: str) -> int:
+        """Return the object size in bytes."""
+        raise NotImplementedError
+
+    def exists(self, key: str) -> bool:
+        raise NotImplementedError
+
+    def delete(self, key: str) -> None:
+        """Remove the object; missing objects are not an error."""
+        raise NotImplementedError
+
+    def list(self, prefix: str = "") -> Iterator[str]:
+        """Yield keys starting with ``prefix``."""
+        raise NotImplementedError
+
+
+class LocalStorage(StorageBackend):
+    """Stores objects as files below a root directory."""
+
+    def __init__(self, root: Path, permissions: int = 0o600):
+        self.root = Path(root)
+        self.permissions = permissions
+
+    def path(self, key: str) -> Path:
+        if key.startswith("/") or ".." in key.split("/"):
+            raise ValueError(f"invalid key: {key!r}")
+        return self.root / key
+
+    def put(self, key: str, data, xattrs: dict[str, bytes] | None = None) -> int:
+        """Store data; ``xattrs`` are set on the file before it becomes visible."""
+        path = self.path(key)
+        path.parent.mkdir(parents=True, exist_ok=True)
+
+        # Write to a temp file and rename, so readers never see partial objects
+        fd, tmp_name = tempfile.mkstemp(dir=path.parent, prefix=".tmp-")
+        written = 0
+        try:
+            with os.fdopen(fd, "wb") as file:
+                for chunk in iter_chunks(data):
+                    file.write(chunk)
+                    written += len(chunk)
+                for name, value in (xattrs or {}).items():
+                    os.setxattr(file.fileno(), name, value)
+            os.chmod(tmp_name, self.permissions)
+            os.replace(tmp_name, path)
+        except BaseException:
+            try:
+                os.unlink(tmp_name)
+            except FileNotFoundError:
+                pass
+            raise
+        return written
+
+    def get(self, key: str) -> bytes:
+        return self.path(key).read_bytes()
+
+    def open(self, key: str) -> BinaryIO:
+        return open(self.path(key), "rb")
+
+    def get_range(self, key: str, start: int, end: int | None = None) -> bytes:
+        with self.open(key) as file:
+            file.seek(start)
+            return file.read() if end is None else file.read(max(0, end - start))
+
+    def size(self, key: str) -> int:
+        return self.path(key).stat().st_size
+
+    def exists(self, key: str) -> bool:
+        return self.path(key).exists()
+
+    def delete(self, key: str) -> None:
+        self.path(key).unlink(missing_ok=True)
+
+    def get_xattr(self, key: str, name: str) -> bytes | None:
+        """Extended attribute of an object, or None if it is not set."""
+        try:
+            return os.getxattr(self.path(key), name)
+        except OSError as e:
+            if e.errno in (errno.ENODATA, errno.ENOTSUP):
+                return None
+            raise
+
+    def set_xattr(self, key: str, name: str, value: bytes) -> None:
+        os.setxattr(self.path(key), name, value)
+
+    def remove_xattr(self, key: str, name: str) -> None:
+        try:
+            os.removexattr(self.path(key), name)
+        except OSError as e:
+            if e.errno not in (errno.ENODATA, errno.ENOTSUP):
+                raise
+
+    def open_with_xattr(self, key: str, name: str) -> tuple[BinaryIO, bytes | None]:
+        """Open an object and read one extended attribute from the same fd."""
+        file = self.open(key)
+        try:
+            return file, os.getxattr(file.fileno(), name)
+        except OSError as e:
+            if e.errno in (errno.ENODATA, errno.ENOTSUP):
+                return file, None
+            file.close()
+            raise
+
+    def supports_xattrs(self, directory: str) -> bool:
+        """Probe whether the filesystem below ``directory`` takes user xattrs."""
+        base = self.path(directory)
+        base.mkdir(parents=True, exist_ok=True)
+        try:
+            with tempfile.NamedTemporaryFile(dir=base, prefix=".tmp-") as probe:
+                os.setxattr(probe.fileno(), "user.ppb.probe", b"1")
+            return True
+        except OSError:
+            return False
+
+    def list(self, prefix: str = "") -> Iterator[str]:
+        directory, _, name_prefix = prefix.rpartition("/")
+        base = self.path(directory) if directory else self.root
+        try:
+            entries = os.scandir(base)
+        except FileNotFoundError:
+            return
+        with entries:
+            for entry in entries:
+                if not entry.name.startswith(name_prefix) or entry.name.startswith(".tmp-"):
+                    continue
+                key = f"{directory}/{entry.name}" if directory else entry.name
+                if entry.is_dir():
+                    yield from self.list(f"{key}/")
+                else:
+                    yield key
+
+
+class S3Storage(StorageBackend):
+    """Stores objects in an S3-compatible bucket.
+
+    Large objects are uploaded with multipart uploads streamed in
+    ``part_size`` pieces, and reads use HTTP range requests, so neither
+    direction needs the whole object in memory. Point ``endpoint_url`` at a
+    MinIO instance to run against a local stand-in.
+    """
+
+    MIN_PART_SIZE = 5 * (2**20)  # S3 minimum for all but the last part
+
+    def __init__(
+        self,
+        bucket: str,
+        prefix: str = "",
+        endpoint_url: str | None = None,
+        region: str | None = None,
+        part_size: int = 8 * (2**20),
+        client=None,
+    ):
+        if client is None:
+            import boto3  # optional dependency, only needed for this backend
+
+            client = boto3.client("s3", endpoint_url=endpoint_url, region_name=region)
+        self.client = client
+        self.bucket = bucket
+        self.prefix = prefix.strip("/") + "/" if prefix.strip("/") else ""
+        self.part_size = max(part_size, self.MIN_PART_SIZE)
+
+    def _key(self, key: str) -> str:
+        return self.prefix + key
+
+    @staticmethod
+    def _is_missing(error) -> bool:
+        code = getattr(error, "response", {}).get("Error", {}).get("Code")
+        return code in ("404", "NoSuchKey", "NotFound")
+
+    def put(self, key: str, data) -> int:
+        if isinstance(data, (bytes, bytearray, memoryview)) and len(data) <= self.part_size:
+            self.client.put_object(Bucket=self.bucket, Key=self._key(key), Body=bytes(data))
+            return len(data)
+
+        chunks = iter_chunks(data, self.part_size)
+        first = next(chunks, b"")
+        second = next(chunks, None)
+        if second is None:
+            self.client.put_object(Bucket=self.bucket, Key=self._key(key), Body=first)
+            return len(first)
+
+        upload = self.client.create_multipart_upload(Bucket=self.bucket, Key=self._key(key))
+        upload_id = upload["UploadId"]
+        parts = []
+        written = 0
+        try:
+            pending = bytearray()
+            for chunk in itertools.chain((first, second), chunks):
+                pending += chunk
+                # Parts must be at least MIN_PART_SIZE except the last one
+                while len(pending) >= self.part_size:
+                    written += self._upload_part(key, upload_id, parts, bytes(pending[: self.part_size]))
+                    del pending[: self.part_size]
+            if pending or not parts:
+                written += self._upload_part(key, upload_id, parts, bytes(pending))
+            self.client.complete_multipart_upload(
+                Bucket=self.bucket,
+                Key=self._key(key),
+                UploadId=upload_id,
+                MultipartUpload={"Parts": parts},
+            )
+        except BaseException:
+            self.client.abort_multipart_upload(
+                Bucket=self.bucket, Key=self._key(key), UploadId=upload_id
+            )
+            raise
+        return written
+
+    def _upload_part(self, key: str, upload_id: str, parts: list, body: bytes) -> int:
+        number = len(parts) + 1
+        response = self.client.upload_part(
+            Bucket=self.bucket,
+            Key=self._key(key),
+            UploadId=upload_id,
+            PartNumber=number,
+            Body=body,
+        )
+        parts.append({"ETag": response["ETag"], "PartNumber": number})
+        return len(body)
+
+    def open(self, key: str) -> BinaryIO:
+        try:
+            response = self.client.get_object(Bucket=self.bucket, Key=self._key(key))
+        except Exception as e:
+            if self._is_missing(e):
+                raise FileNotFoundError(key) from e
+            raise
+        return response["Body"]
+
+    def get_range(self, key: str, start: int, end: int | None = None) -> bytes:
+        if end is not None and end <= start:
+            return b""
+        byte_range = f"bytes={start}-" if end is None else f"bytes={start}-{end - 1}"
+        try:
+            response = self.client.get_object(
+                Bucket=self.bucket, Key=self._key(key), Range=byte_range
+            )
+        except Exception as e:
+            if self._is_missing(e):
+                raise FileNotFoundError(key) from e
+            if getattr(e, "response", {}).get("Error", {}).get("Code") == "InvalidRange":
+                return b""
+            raise
+        return response["Body"].read()
+
+    def size(self, key: str) -> int:
+        try:
+            response = self.client.head_object(Bucket=self.bucket, Key=self._key(key))
+        except Exception as e:
+            if self._is_missing(e):
+                raise FileNotFoundError(key) from e
+            raise
+        return response["ContentLength"]
+
+    def exists(self, key: str) -> bool:
+        try:
+            self.size(key)
+            return True
+        except FileNotFoundError:
+            return False
+
+    def delete(self, key: str) -> None:
+        self.client.delete_object(Bucket=self.bucket, Key=self._key(key))
+
+    def list(self, prefix: str = "") -> Iterator[str]:
+        paginator = self.client.get_paginator("list_objects_v2")
+        for page in paginator.paginate(Bucket=self.bucket, Prefix=self._key(prefix)):
+            for item in page.get("Contents", []):
+                yield item["Key"][len(self.prefix) :]
+
+
+class ErasureStorage(StorageBackend):
+    """Stores objects across several local volumes (one per disk).
+
+    Objects of ``min_size`` bytes or more are split into ``data_shards`` data
+    and ``parity_shards`` parity shards with Reed-Solomon coding, each shard on
+    a different volume, and can be read back from any ``data_shards`` of them:
+    ``parity_shards`` volumes can be lost at a storage cost of
+    ``(k + m) / k``. Smaller objects, where a shard would cost more in files
+    than it saves in bytes, are stored whole on ``parity_shards + 1`` volumes,
+    which survives the same losses.
+
+    Each object's volumes are ranked by rendezvous hashing of its key, and
+    shard ``i`` goes to the ``i``-th volume that takes it. Every shard file
+    has a header with the object's size, the shard's index and a CRC-32 of
+    the shard, so corrupt shards count as missing.
+
+    A volume whose root directory is gone (a dead or unmounted disk) is
+    skipped. A read that finds a piece missing or corrupt on a live volume
+    queues the object for repair in a background thread. Repairing every
+    object (``admin.py repair``) rebuilds what a lost volume held, on spare
+    volumes or on its replacement.
+    """
+
+    HEADER = struct.Struct("<8sBBBBQI")  # magic, kind, k, m, index, object size, crc32
+    MAGIC = b"PPBSHARD"
+    REPLICA, SHARD = 0, 1
+
+    def __init__(
+        self,
+        volumes: list[Path],
+        data_shards: int = 4,
+        parity_shards: int = 2,
+        min_size: int = 2**20,
+        permissions: int = 0o600,
+    ):
+        if len(volumes) < data_shards + parity_shards:
+            raise ValueError(f"{data_shards}+{parity_shards} erasure coding needs as many volumes, got {len(volumes)}")
+        self.volumes = [LocalStorage(Path(volume), permissions) for volume in volumes]
+        self.codec = ReedSolomon(data_shards, parity_shards)
+        self.min_size = min_size
+        self.repairs = queue.Queue()
+        self.pending = set()
+        self.pending_lock = threading.Lock()
+        self.repairer = None
+
+    def placement(self, key: str) -> list[LocalStorage]:
+        """Every volume, in the order the key's shards are placed on them."""
+        return sorted(
+            self.volumes,
+            key=lambda volume: hashlib.sha256(f"{volume.root}\0{key}".encode()).digest(),
+            reverse=True,
+        )
+
+    def _pieces(self, data: bytes) -> tuple[int, list[bytes]]:
+        if len(data) < self.min_size:
+            return self.REPLICA, [data] * (self.codec.parity_shards + 1)
+        return self.SHARD, self.codec.encode(data)
+
+    def _header(self, kind: int, index: int, size: int, piece: bytes) -> bytes:
+        codec = self.codec
+        return self.HEADER.pack(
+            self.MAGIC, kind, codec.data_shards, codec.parity_shards, index, size, zlib.crc32(piece)
+        )
+
+    def _write(
+        self, key: str, kind: int, size: int, pieces: dict[int, bytes], taken: set
+    ) -> tuple[list[LocalStorage], OSError | None]:
+        """Write pieces to live volumes whose root is not in ``taken``.
+
+        Volumes are tried in placement order; one that fails the write is
+        passed over for the next. Returns the volumes written, fewer than
+        the pieces if volumes ran out, and the last write error.
+        """
+        written = []
+        remaining = list(pieces.items())
+        error = None
+        for volume in self.placement(key):
+            if not remaining:
+                break
+            if volume.root in taken or not volume.root.is_dir():
+                continue
+            index, piece = remaining[0]
+            try:
+                volume.put(key, (self._header(kind, index, size, piece), piece))
+            except OSError as e:
+                logger.warning(f"Volume {volume.root} failed writing {key}: {e}")
+                error = e
+                continue
+            written.append(volume)
+            remaining.pop(0)
+        return written, error
+
+    def put(self, key: str, data) -> int:
+        data = bytes(data) if isinstance(data, (bytes, bytearray, memoryview)) else b"".join(iter_chunks(data))
+        kind, pieces = self._pieces(data)
+        written, error = self._write(key, kind, len(data), dict(enumerate(pieces)), set())
+
+        # With volumes down, a write still succeeds if it stored one piece
+        # more than a read needs; repair() restores the rest
+        parity = self.codec.parity_shards
+        needed = len(pieces) - parity + 1 if parity else len(pieces)
+        if len(written) < needed:
+            for volume in written:
+                volume.delete(key)
+            if error is not None:
+                raise error
+            raise OSError(errno.EIO, f"only {len(written)} of {len(pieces)} pieces of {key} could be stored")
+        if len(written) < len(pieces):
+            logger.warning(f"Stored {len(written)} of {len(pieces)} pieces of {key}, volumes are down")
+        return len(data)
+
+    def _read_piece(self, volume: LocalStorage, key: str) -> tuple[tuple, bytes] | None:
+        """Header fields and payload of the key's piece on a volume, if intact."""
+        try:
+            blob = volume.get(key)
+        except FileNotFoundError:
+            return None
+        except OSError as e:
+            logger.warning(f"Volume {volume.root} failed reading {key}: {e}")
+            return None
+        if len(blob) < self.HEADER.size:
+            return None
+        header = self.HEADER.unpack_from(blob)
+        payload = blob[self.HEADER.size :]
+        if header[0] != self.MAGIC or zlib.crc32(payload) != header[6]:
+            logger.warning(f"Corrupt piece of {key} on {volume.root}")
+            return None
+        return header, payload
+
+    def _collect(self, key: str, everything: bool = False) -> tuple[dict, int | None, int, set]:
+        """Read pieces until the object can be rebuilt, or all with ``everything``.
+
+        Returns the payloads by index, the kind (None if no piece was
+        found), the object size and the roots of the volumes holding an
+        intact piece. A live volume passed over on the way, before enough
+        pieces were found, means the object needs repair.
+        """
+        pieces = {}
+        kind = None
+        size = needed = 0
+        holders = set()
+        missing = False
+        for volume in self.placement(key):
+            if not volume.root.is_dir():
+                continue
+            found = self._read_piece(volume, key)
+            if found is None:
+                missing = True
+                continue
+            header, payload = found
+            if kind is None:
+                kind, size = header[1], header[5]
+                needed = 1 if kind == self.REPLICA else header[2]
+            elif header[1] != kind or header[5] != size:
+                logger.warning(f"Piece of {key} on {volume.root} is from another upload, ignoring it")
+                continue
+            pieces.setdefault(header[4], payload)
+            holders.add(volume.root)
+            if not everything and len(pieces) >= needed:
+                break
+        if kind is not None and missing and not everything:
+            self.schedule_repair(key)
+        return pieces, kind, size, holders
+
+    def get(self, key: str) -> bytes:
+        pieces, kind, size, _ = self._collect(key)
+        if kind is None:
+            raise FileNotFoundError(key)
+        if kind == self.REPLICA:
+            return next(iter(pieces.values()))
+        codec = self.codec
+        if len(pieces) < codec.data_shards:
+            raise OSError(errno.EIO, f"{key}: {len(pieces)} of {codec.data_shards} shards readable")
+        return codec.decode(pieces, size)
+
+    def open(self, key: str) -> BinaryIO:
+        return io.BytesIO(self.get(key))
+
+    def get_range(self, key: str, start: int, end: int | None = None) -> bytes:
+        # Shards are checked whole, so a range costs a full read
+        return self.get(key)[start:end]
+
+    def size(self, key: str) -> int:
+        for volume in self.placement(key):
+            try:
+                header = volume.get_range(key, 0, self.HEADER.size)
+            except OSError:
+                continue
+            if len(header) == self.HEADER.size and header.startswith(self.MAGIC):
+                return self.HEADER.unpack(header)[5]
+        raise FileNotFoundError(key)
+
+    def exists(self, key: str) -> bool:
+        return any(volume.exists(key) for volume in self.placement(key))
+
+    def delete(self, key: str) -> None:
+        for volume in self.volumes:
+            try:
+                volume.delete(key)
+            except OSError as e:
+                logger.warning(f"Volume {volume.root} failed deleting {key}: {e}")
+
+    def list(self, prefix: str = "") -> Iterator[str]:
+        seen = set()
+        for volume in self.volumes:
+            for key in volume.list(prefix):
+                if key not in seen:
+                    seen.add(key)
+                    yield key
+
+    def repair(self, key: str) -> int:
+        """Rewrite missing or corrupt pieces of an object; returns how many."""
+        pieces, kind, size, holders = self._collect(key, everything=True)
+        if kind is None:
+            return 0
+        codec = self.codec
+        if kind == self.REPLICA:
+            wanted = dict.fromkeys(range(codec.parity_shards + 1), next(iter(pieces.values())))
+            # Replicas are interchangeable: only the count matters
+            for index in range(len(holders)):
+                wanted.pop(index, None)
+        else:
+            if len(pieces) < codec.data_shards:
+                raise OSError(errno.EIO, f"{key}: {len(pieces)} of {codec.data_shards} shards left, cannot repair")
+            if len(pieces) == codec.total_shards:
+                return 0
+            everything = codec.reconstruct(pieces)
+            wanted = {i: everything[i] for i in range(codec.total_shards) if i not in pieces}
+        if not wanted:
+            return 0
+        written, _ = self._write(key, kind, size, wanted, holders)
+        if len(written) < len(wanted):
+            logger.warning(f"Repaired {len(written)} of {len(wanted)} pieces of {key}, out of volumes")
+        else:
+            logger.info(f"Repaired {len(written)} pieces of {key}")
+        return len(written)
+
+    def schedule_repair(self, key: str) -> None:
+        """Repair an object in the background, once however often it is asked."""
+        with self.pending_lock:
+            if key in self.pending:
+                return
+            self.pending.add(key)
+            if self.repairer is None:
+                self.repairer = threading.Thread(target=self._repair_loop, name="ppb-repair", daemon=True)
+                self.repairer.start()
+        self.repairs.put(key)
+
+    def _repair_loop(self) -> None:
+        while True:
+            key = self.repairs.get()
+            try:
+                self.repair(key)
+            except Exception as e:
+                logger.error(f"Repair of {key} failed: {e}")
+            finally:
+                with self.pending_lock:
+                    self.pending.discard(key)
+                self.repairs.task_done()
+
+
+class ChunkManifest:
+    """Where the chunks of a chunked object are, in order."""
+
+    def __init__(self, text: bool, size: int, entries: list[tuple[bytes, int]]):
+        self.text = text  # the object is valid UTF-8
+        self.size = size
+        self.digests = [digest for digest, _ in entries]
+        self.lengths = [length for _, length in entries]
+        self.offsets = list(itertools.accumulate(self.lengths, initial=0))
+
+
+class ChunkStream(io.RawIOBase):
+    """Reads an object stored in pieces (chunks, compressed frames) one at a time.
+
+    ``read_piece(i)`` returns the ``i``-th of ``count`` pieces; ``size`` and
+    ``text`` describe the whole object.
+    """
+
+    def __init__(self, read_piece, count: int, size: int, text: bool):
+        self.read_piece = read_piece
+        self.count = count
+        self.size = size
+        self.text = text  # the object is valid UTF-8
+        self.index = 0
+        self.buffer = memoryview(b"")
+
+    def readable(self) -> bool:
+        return True
+
+    def _fill(self) -> bool:
+        while not self.buffer and self.index < self.count:
+            self.buffer = memoryview(self.read_piece(self.index))
+            self.index += 1
+        return bool(self.buffer)
+
+    def read(self, size: int = -1) -> bytes:
+        """``size`` bytes, fewer only at the end, as from a buffered file.
+
+        Readers such as ``tarfile`` take a short read for the end of the data.
+        """
+        if size is None or size < 0:
+            return self.readall()
+        parts = []
+        while size and self._fill():
+            part = self.buffer[:size]
+            self.buffer = self.buffer[len(part) :]
+            parts.append(bytes(part))
+            size -= len(part)
+        return b"".join(parts)
+
+    def readinto(self, target) -> int:
+        data = self.read(len(target))
+        target[: len(data)] = data
+        return len(data)
+
+    def readall(self) -> bytes:
+        parts = []
+        while self._fill():
+            parts.append(bytes(self.buffer))
+            self.buffer = memoryview(b"")
+        return b"".join(parts)
+
+
+class ChunkedStorage(StorageBackend):
+    """Stores objects as lists of content-defined chunks, each chunk once.
+
+    Objects under ``prefix`` of ``min_object`` bytes or more are cut with
+    ``chunking.split`` as they are written, every chunk not already stored
+    goes to ``chunks/<sha256>`` in the backend, and a manifest goes next to
+    the object at ``<key>.chunks``: the chunks' digests and lengths, behind
+    a header with the object's size, whether it is UTF-8 text, and a CRC-32
+    of the list. The object's own key is left empty, and holds whatever
+    ``options`` (xattrs) the caller passed. Two pastes that share most of
+    their lines share most of their chunks. Readers see the object, not the
+    manifest: ``get`` puts it back together, ``open`` streams it a chunk at
+    a time and ``get_range`` reads only the chunks the range covers.
+
+    Only an empty object with a manifest beside it is chunked. What an
+    object contains never decides how it is read, so a paste that looks
+    like a manifest reads back as itself. Smaller objects and keys outside
+    ``prefix`` are stored as they are, and so were objects written before
+    chunking was turned on. Chunks are never deleted, since any number of
+    objects may share one; ppb does not delete pastes.
+    """
+
+    HEADER = struct.Struct("<8sBIQI")  # magic, flags, chunk count, object size, crc32 of the entries
+    ENTRY = struct.Struct("<32sI")  # sha256, length
+    MAGIC = b"PPBCHUNK"
+    TEXT = 1
+    CHUNK_DIR = "chunks"
+    SUFFIX = ".chunks"  # the manifest of ``key`` is at ``key + SUFFIX``
+    PROBE_SIZE = 64 * 1024  # first read of an object, which is all of most plain ones
+
+    def __init__(
+        self,
+        backend: StorageBackend,
+        prefix: str = "raw/",
+        avg_size: int = 64 * 1024,
+        min_object: int | None = None,
+    ):
+        self.backend = backend
+        self.prefix = prefix
+        self.min_size = avg_size // 4
+        self.avg_size = avg_size
+        self.max_size = avg_size * 4
+        self.min_object = avg_size if min_object is None else min_object
+
+    def chunk_key(self, digest: bytes) -> str:
+        name = digest.hex()
+        return f"{self.CHUNK_DIR}/{name[:2]}/{name}"
+
+    def put(self, key: str, data, **options) -> int:
+        if not key.startswith(self.prefix):
+            return self.backend.put(key, data, **options)
+        blocks = iter_chunks(data)
+        if isinstance(data, (bytes, bytearray, memoryview)):
+            if len(data) < self.min_object:
+                return self.backend.put(key, data, **options)
+        else:
+            head = []
+            size = 0
+            for block in blocks:
+                head.append(block)
+                size += len(block)
+                if size >= self.min_object:
+                    break
+            if size < self.min_object:
+                return self.backend.put(key, b"".join(head), **options)
+            blocks = itertools.chain(head, blocks)
+
+        entries = []
+        size = 0
+        decoder = codecs.getincrementaldecoder("utf-8")()
+        text = True
+        for chunk in chunking.split(blocks, self.min_size, self.avg_size, self.max_size):
+            digest = hashlib.sha256(chunk).digest()
+            chunk_key = self.chunk_key(digest)
+            # Chunk keys are content hashes: one already there is this chunk
+            if not self.backend.exists(chunk_key):
+                self.backend.put(chunk_key, chunk)
+            entries.append(self.ENTRY.pack(digest, len(chunk)))
+            size += len(chunk)
+            if text:
+                try:
+                    decoder.decode(chunk)
+                except UnicodeDecodeError:
+                    text = False
+        if text:
+            try:
+                decoder.decode(b"", final=True)
+            except UnicodeDecodeError:
+                text = False
+
+        listing = b"".join(entries)
+        header = self.HEADER.pack(self.MAGIC, self.TEXT if text else 0, len(entries), size, zlib.crc32(listing))
+        # Chunks, then the manifest, then the object: whatever exists lists
+        # only what is stored
+        self.backend.put(key + self.SUFFIX, header + listing)
+        self.backend.put(key, b"", **options)
+        return size
+
+    def manifest(self, key: str) -> tuple[ChunkManifest | None, bytes]:
+        """The object's manifest, or None and the start of a plain object."""
+        head = self.backend.get_range(key, 0, self.PROBE_SIZE)
+        if head or not key.startswith(self.prefix):
+            return None, head
+        try:
+            data = self.backend.get(key + self.SUFFIX)
+        except FileNotFoundError:
+            return None, head
+        return self.parse_manifest(key, data), head
+
+    def parse_manifest(self, key: str, data: bytes) -> ChunkManifest:
+        if len(data) < self.HEADER.size:
+            raise OSError(errno.EIO, f"manifest of {key} is truncated")
+        magic, flags, count, size, crc = self.HEADER.unpack_from(data)
+        listing = data[self.HEADER.size :]
+        if magic != self.MAGIC or len(listing) != count * self.ENTRY.size or zlib.crc32(listing) != crc:
+            raise OSError(errno.EIO, f"manifest of {key} is corrupt")
+        entries = list(self.ENTRY.iter_unpack(listing))
+        if sum(length for _, length in entries) != size:
+            raise OSError(errno.EIO, f"manifest of {key} lists {size} bytes in chunks of another total")
+        return ChunkManifest(bool(flags & self.TEXT), size, entries)
+
+    def read_chunk(self, manifest: ChunkManifest, index: int) -> bytes:
+        key = self.chunk_key(manifest.digests[index])
+        chunk = self.backend.get(key)
+        if len(chunk) != manifest.lengths[index]:
+            raise OSError(errno.EIO, f"chunk {key} is {len(chunk)} bytes, expected {manifest.lengths[index]}")
+        return chunk
+
+    def stream(self, manifest: ChunkManifest) -> ChunkStream:
+        read = functools.partial(self.read_chunk, manifest)
+        return ChunkStream(read, len(manifest.digests), manifest.size, manifest.text)
+
+    def get(self, key: str) -> bytes:
+        manifest, head = self.manifest(key)
+        if manifest is not None:
+            return self.stream(manifest).readall()
+        if len(head) < self.PROBE_SIZE:
+            return head
+        return head + self.backend.get_range(key, len(head))
+
+    def open(self, key: str) -> BinaryIO:
+        manifest, _ = self.manifest(key)
+        if manifest is None:
+            return self.backend.open(key)
+        return self.stream(manifest)
+
+    def get_range(self, key: str, start: int, end: int | None = None) -> bytes:
+        manifest, head = self.manifest(key)
+        if manifest is None:
+            if len(head) < self.PROBE_SIZE or (end is not None and end <= len(head)):
+                return head[start:end]
+            return self.backend.get_range(key, start, end)
+        end = manifest.size if end is None else min(end, manifest.size)
+        if start >= end:
+            return b""
+        first = bisect.bisect_right(manifest.offsets, start) - 1
+        parts = []
+        for index in range(first, len(manifest.digests)):
+            offset = manifest.offsets[index]
+            if offset >= end:
+                break
+            chunk = self.read_chunk(manifest, index)
+            parts.append(chunk[max(0, start - offset) : end - offset])
+        return b"".join(parts)
+
+    def size(self, key: str) -> int:
+        manifest, _ = self.manifest(key)
+        return manifest.size if manifest is not None else self.backend.size(key)
+
+    def exists(self, key: str) -> bool:
+        return self.backend.exists(key)
+
+    def delete(self, key: str) -> None:
+        self.backend.delete(key)
+        if key.startswith(self.prefix):
+            try:
+                self.backend.delete(key + self.SUFFIX)
+            except FileNotFoundError:
+                pass
+
+    def list(self, prefix: str = "") -> Iterator[str]:
+        for key in self.backend.list(prefix):
+            if key.startswith(f"{self.CHUNK_DIR}/"):
+                if prefix.startswith(f"{self.CHUNK_DIR}/"):
+                    yield key
+            elif not (key.startswith(self.prefix) and key.endswith(self.SUFFIX)):
+                yield key
+
+    def usage(self) -> tuple[int, int, int]:
+        """Bytes of chunked objects, bytes of the chunks they use, and objects."""
+        logical = 0
+        used = {}
+        objects = 0
+        for key in self.backend.list(self.prefix):
+            if not key.endswith(self.SUFFIX):
+                continue
+            manifest = self.parse_manifest(key, self.backend.get(key))
+            objects += 1
+            logical += manifest.size
+            used.update(zip(manifest.digests, manifest.lengths))
+        return logical, sum(used.values()), objects
+
+
+class SeekTable:
+    """Where the frames of a compressed object are, in both coordinates."""
+
+    def __init__(self, text: bool, entries: list[tuple[int, int]]):
+        self.text = text  # the object is valid UTF-8
+        self.compressed = list(itertools.accumulate((c for c, _ in entries), initial=0))
+        self.offsets = list(itertools.accumulate((d for _, d in entries), initial=0))
+        self.lengths = [d for _, d in entries]
+        self.size = self.offsets[-1]
+
+
+class CompressedStorage(StorageBackend):
+    """Stores objects compressed with zstd, in frames that decompress alone.
+
+    Objects under ``prefixes`` of ``min_object`` bytes or more are cut into
+    ``frame_size`` pieces, each compressed into its own zstd frame, followed
+    by a seek table giving every frame's compressed and decompressed length.
+    The frames go to ``<key>.zst`` and the key itself is left empty, holding
+    whatever ``options`` (xattrs) the caller passed. This is zstd's seekable
+    format: the table sits in a skippable frame, so ``<key>.zst`` is also a
+    plain .zst file that ``zstd -d`` reads whole. Every frame carries zstd's
+    checksum of its content, so a damaged frame fails to decompress instead
+    of reading back wrong. Bit 0 of the table descriptor, which the format
+    leaves unused, records whether the object is UTF-8 text.
+
+    ``get_range`` reads the table from the end of the frames, then reads and
+    decompresses only the frames the range overlaps, so the last lines of a
+    100 MB log cost one frame, not the whole object. Tables of recently read
+    objects are kept, since objects never change, and so is the last frame
+    decompressed, which a line scan and the slice it finds both need.
+
+    Only an empty object with frames beside it is compressed. What an object
+    contains never decides how it is read, so a paste that is itself a
+    seekable .zst file reads back as it was uploaded. Smaller objects and
+    objects stored before compression was turned on are read as they are,
+    and keys outside ``prefixes`` go straight to the backend.
+    """
+
+    SKIPPABLE = struct.Struct("<II")  # skippable frame magic, content size
+    ENTRY = struct.Struct("<II")  # compressed size, decompressed size
+    FOOTER = struct.Struct("<IBI")  # frame count, descriptor, seekable magic
+    SKIPPABLE_MAGIC = 0x184D2A5E
+    SEEKABLE_MAGIC = 0x8F92EAB1
+    TEXT = 1
+    SUFFIX = ".zst"  # the frames of ``key`` are at ``key + SUFFIX``
+    PROBE_SIZE = 8 * 1024  # first read of the frames' end: the footer and the table of up to 256 MB
+    CACHED_TABLES = 256
+
+    def __init__(
+        self,
+        backend: StorageBackend,
+        prefixes: tuple[str, ...] = ("raw/", f"{ChunkedStorage.CHUNK_DIR}/"),
+        level: int = 3,
+        frame_size: int = FRAME_SIZE,
+        min_object: int = 4096,
+    ):
+        if zstd is None:
+            raise RuntimeError("compressed storage needs a Python built with zstd (compression.zstd)")
+        self.backend = backend
+        self.prefixes = prefixes
+        self.options = {zstd.CompressionParameter.compression_level: level, zstd.CompressionParameter.checksum_flag: 1}
+        self.frame_size = frame_size
+        self.min_object = min_object
+        self.tables = OrderedDict()
+        self.lock = threading.Lock()
+        self.last_frame = (None, None, b"")  # key, index, data
+
+    def frames(self, blocks: Iterator[bytes]) -> Iterator[bytes]:
+        """The compressed frames and seek table of an object read as blocks."""
+        entries = []
+        decoder = codecs.getincrementaldecoder("utf-8")()
+        text = True
+        for piece in reblock(blocks, self.frame_size):
+            frame = zstd.compress(piece, options=self.options)
+            entries.append(self.ENTRY.pack(len(frame), len(piece)))
+            if text:
+                try:
+                    decoder.decode(piece)
+                except UnicodeDecodeError:
+                    text = False
+            yield frame
+        if text:
+            try:
+                decoder.decode(b"", final=True)
+            except UnicodeDecodeError:
+                text = False
+        table = b"".join(entries) + self.FOOTER.pack(len(entries), self.TEXT if text else 0, self.SEEKABLE_MAGIC)
+        yield self.SKIPPABLE.pack(self.SKIPPABLE_MAGIC, len(table)) + table
+
+    def put(self, key: str, data, **options) -> int:
+        if not key.startswith(self.prefixes):
+            return self.backend.put(key, data, **options)
+        blocks = iter_chunks(data)
+        if isinstance(data, (bytes, bytearray, memoryview)):
+            if len(data) < self.min_object:
+                return self.backend.put(key, data, **options)
+        else:
+            head = []
+            size = 0
+            for block in blocks:
+                head.append(block)
+                size += len(block)
+                if size >= self.min_object:
+                    break
+            if size < self.min_object:
+                return self.backend.put(key, b"".join(head), **options)
+            blocks = itertools.chain(head, blocks)
+        written = self.backend.put(key + self.SUFFIX, self.frames(blocks))
+        # Written after the frames, so an object that exists is complete
+        self.backend.put(key, b"", **options)
+        with self.lock:
+            self.tables.pop(key, None)
+        return written
+
+    def seek_table(self, key: str) -> tuple[SeekTable | None, int | None]:
+        """The object's seek table, or None; and its stored size, if read."""
+        if not key.startswith(self.prefixes):
+            return None, None
+        with self.lock:
+            cached = self.tables.get(key)
+            if cached is not None:
+                self.tables.move_to_end(key)
+                return cached
+        cached = self._read_seek_table(key)
+        with self.lock:
+            self.tables[key] = cached
+            if len(self.tables) > self.CACHED_TABLES:
+                self.tables.popitem(last=False)
+        return cached
+
+    def _read_seek_table(self, key: str) -> tuple[SeekTable | None, int]:
+        stored = self.backend.size(key)
+        if stored:
+            return None, stored
+        frames_key = key + self.SUFFIX
+        try:
+            stored = self.backend.size(frames_key)
+        except FileNotFoundError:
+            return None, 0
+        least = self.SKIPPABLE.size + self.FOOTER.size
+        if stored < least:
+            raise OSError(errno.EIO, f"{frames_key} is too short for a seek table")
+        tail = self.backend.get_range(frames_key, max(0, stored - self.PROBE_SIZE), stored)
+        count, flags, magic = self.FOOTER.unpack_from(tail, len(tail) - self.FOOTER.size)
+        table_size = self.SKIPPABLE.size + count * self.ENTRY.size + self.FOOTER.size
+        if magic != self.SEEKABLE_MAGIC or table_size > stored:
+            raise OSError(errno.EIO, f"{frames_key} has no seek table")
+        if table_size > len(tail):
+            tail = self.backend.get_range(frames_key, stored - table_size, stored)
+        table = tail[len(tail) - table_size :]
+        skippable, content = self.SKIPPABLE.unpack_from(table)
+        if skippable != self.SKIPPABLE_MAGIC or content != table_size - self.SKIPPABLE.size:
+            raise OSError(errno.EIO, f"{frames_key} has a corrupt seek table")
+        entries = list(self.ENTRY.iter_unpack(table[self.SKIPPABLE.size : -self.FOOTER.size]))
+        seek = SeekTable(bool(flags & self.TEXT), entries)
+        # The frames and the table are the whole file
+        covered = seek.compressed[-1] + table_size
+        if covered != stored:
+            raise OSError(errno.EIO, f"{frames_key} is {stored} bytes, its seek table covers {covered}")
+        return seek, stored
+
+    def decompress(self, seek: SeekTable, index: int, frame) -> bytes:
+        try:
+            data = zstd.decompress(frame)
+        except zstd.ZstdError as e:
+            raise OSError(errno.EIO, f"frame {index} does not decompress: {e}") from e
+        if len(data) != seek.lengths[index]:
+            raise OSError(errno.EIO, f"frame {index} is {len(data)} bytes, expected {seek.lengths[index]}")
+        return data
+
+    def read_frames(self, key: str, seek: SeekTable, first: int, last: int) -> Iterator[bytes]:
+        """Frames ``first`` to ``last`` (inclusive) decompressed, from one read."""
+        cached_key, cached_index, cached = self.last_frame
+        if cached_key == key and cached_index == first:
+            yield cached
+            first += 1
+            if first > last:
+                return
+        start = seek.compressed[first]
+        raw = memoryview(self.backend.get_range(key + self.SUFFIX, start, seek.compressed[last + 1]))
+        for index in range(first, last + 1):
+            data = self.decompress(seek, index, raw[seek.compressed[index] - start : seek.compressed[index + 1] - start])
+            if index == last:
+                self.last_frame = (key, index, data)
+            yield data
+
+    def stream(self, key: str, seek: SeekTable) -> ChunkStream:
+        def read(index):
+            return next(self.read_frames(key, seek, index, index))
+
+        return ChunkStream(read, len(seek.lengths), seek.size, seek.text)
+
+    def get(self, key: str) -> bytes:
+        seek, _ = self.seek_table(key)
+        if seek is None:
+            return self.backend.get(key)
+        if not seek.lengths:
+            return b""
+        return b"".join(self.read_frames(key, seek, 0, len(seek.lengths) - 1))
+
+    def open(self, key: str) -> BinaryIO:
+        seek, _ = self.seek_table(key)
+        if seek is None:
+            return self.backend.open(key)
+        return self.stream(key, seek)
+
+    def get_range(self, key: str, start: int, end: int | None = None) -> bytes:
+        seek, _ = self.seek_table(key)
+        if seek is None:
+            return self.backend.get_range(key, start, end)
+        end = seek.size if end is None else min(end, seek.size)
+        if start >= end:
+            return b""
+        first = bisect.bisect_right(seek.offsets, start) - 1
+        last = bisect.bisect_left(seek.offsets, end) - 1
+        data = b"".join(self.read_frames(key, seek, first, last))
+        return data[start - seek.offsets[first] : end - seek.offsets[first]]
+
+    def size(self, key: str) -> int:
+        seek, stored = self.seek_table(key)
+        if seek is not None:
+            return seek.size
+        return stored if stored is not None else self.backend.size(key)
+
+    def exists(self, key: str) -> bool:
+        return self.backend.exists(key)
+
+    def delete(self, key: str) -> None:
+        with self.lock:
+            self.tables.pop(key, None)
+        self.last_frame = (None, None, b"")
+        self.backend.delete(key)
+        if key.startswith(self.prefixes):
+            try:
+                self.backend.delete(key + self.SUFFIX)
+            except FileNotFoundError:
+                pass
+
+    def list(self, prefix: str = "") -> Iterator[str]:
+        for key in self.backend.list(prefix):
+            if not (key.startswith(self.prefixes) and key.endswith(self.SUFFIX)):
+                yield key
+
+
+class FaultyStorage(StorageBackend):
+    """Wraps a backend and injects latency and failures, for testing.
+
+    Configured with a spec such as
+    ``latency_ms=200,jitter_ms=100,error_rate=0.05,enospc_rate=0.01,ops=put+get``.
+    ``error_rate`` raises EIO and ``enospc_rate`` raises ENOSPC (writes
+    only). ``ops`` limits which operations are affected (default: all).
+    """
+
+    OPS = ("put", "get", "open", "get_range", "size", "exists", "delete", "list")
+    WRITE_OPS = ("put",)
+
+    def __init__(self, backend: StorageBackend, spec: str, seed: int | None = None):
+        self.backend = backend
+        self.latency = 0.0
+        self.jitter = 0.0
+        self.error_rate = 0.0
+        self.enospc_rate = 0.0
+        self.ops = set(self.OPS)
+        self.random = random.Random(seed)
+        for item in filter(None, (part.strip() for part in spec.split(","))):
+            name, _, value = item.partition("=")
+            if name == "latency_ms":
+                self.latency = float(value) / 1000
+            elif name == "jitter_ms":
+                self.jitter = float(value) / 1000
+            elif name == "error_rate":
+                self.error_rate = float(value)
+            elif name == "enospc_rate":
+                self.enospc_rate = float(value)
+            elif name == "ops":
+                self.ops = set(value.split("+"))
+                unknown = self.ops - set(self.OPS)
+                if unknown:
+                    raise ValueError(f"unknown storage ops in fault spec: {sorted(unknown)}")
+            else:
+                raise ValueError(f"unknown fault setting: {name}")
+
+    def _inject(self, op: str) -> None:
+        if op not in self.ops:
+            return
+        delay = self.latency + self.random.uniform(0, self.jitter)
+        if delay:
+            time.sleep(delay)
+        if op in self.WRITE_OPS and self.random.random() < self.enospc_rate:
+            raise OSError(errno.ENOSPC, os.strerror(errno.ENOSPC))
+        if self.random.random() < self.error_rate:
+            raise OSError(errno.EIO, os.strerror(errno.EIO))
+
+    def put(self, key: str, data, **options) -> int:
+        self._inject("put")
+        return self.backend.put(key, data, **options)
+
+    def get(self, key: str) -> bytes:
+        self._inject("get")
+        return self.backend.get(key)
+
+    def open(self, key: str) -> BinaryIO:
+        self._inject("open")
+        return self.backend.open(key)
+
+    def get_range(self, key: str, start: int, end: int | None = None) -> bytes:
+        self._inject("get_range")
+        return self.backend.get_range(key, start, end)
+
+    def size(self, key: str) -> int:
+        self._inject("size")
+        return self.backend.size(key)
+
+    def exists(self, key: str) -> bool:
+        self._inject("exists")
+        return self.backend.exists(key)
+
+    def delete(self, key: str) -> None:
+        self._inject("delete")
+        self.backend.delete(key)
+
+    def list(self, prefix: str = "") -> Iterator[str]:
+        self._inject("list")
+        return self.backend.list(prefix)
+
+
+class ObjectCache:
+    """Byte-bounded LRU cache of object contents.
+
+    Objects are immutable (keys are content hashes), so entries never need
+    invalidation, only eviction.
+    """
+
+    def __init__(self, max_bytes: int, max_object: int):
+        self.max_bytes = max_bytes
+        self.max_object = max_object
+        self.size = 0
+        self.entries = OrderedDict()
+        self.lock = threading.Lock()
+
+    def get(self, key: str) -> bytes | None:
+        with self.lock:
+            data = self.entries.get(key)
+            if data is not None:
+                self.entries.move_to_end(key)
+            return data
+
+    def put(self, key: str, data: bytes) -> None:
+        if len(data) > self.max_object or len(data) > self.max_bytes:
+            return
+        with self.lock:
+            if key in self.entries:
+                return
+            self.entries[key] = data
+            self.size += len(data)
+            while self.size > self.max_bytes:
+                _, evicted = self.entries.popitem(last=False)
+                self.size -= len(evicted)
+
+
+def _forward(store: StorageBackend, key: str, size: int, offset: int, count: int) -> int:
+    """Offset just past the ``count``-th newline from ``offset`` on, or ``size``."""
+    position = offset
+    while count > 0 and position < size:
+        end = min((position // LINE_BLOCK + 1) * LINE_BLOCK, size)
+        block = store.get_range(key, position, end)
+        found = block.count(b"\n")
+        if found < count:
+            count -= found
+            position = end
+            continue
+        at = -1
+        for _ in range(count):
+            at = block.find(b"\n", at + 1)
+        return position + at + 1
+    return position if count <= 0 else size
+
+
+def _backward(store: StorageBackend, key: str, end: int, count: int) -> int:
+    """Start of the ``count``-th line before ``end`` (a line start), or 0."""
+    if count <= 0:
+        return end
+    # A newline just before end is the end of the line before it
+    limit = end - 1
+    while limit > 0:
+        start = (limit - 1) // LINE_BLOCK * LINE_BLOCK
+        block = store.get_range(key, start, limit)
+        found = block.count(b"\n")
+        if found < count:
+            count -= found
+            limit = start
+            continue
+        at = len(block)
+        for _ in range(count):
+            at = block.rfind(b"\n", 0, at)
+        return start + at + 1
+    return 0
+
+
+def get_lines(store: StorageBackend, key: str, start: int | None = None, stop: int | None = None) -> bytes:
+    """Lines ``[start:stop]`` of an object, as slicing a list of its lines would.
+
+    A line ends after each newline, and a last line may have none. The
+    object is read a block at a time from whichever end each index counts
+    from, so the first or last lines of a large object cost a few blocks.
+    """
+    size = store.size(key)
+    if stop is not None and stop < 0:
+        finish = _backward(store, key, size, -stop)
+        if start is not None and start < 0:
+            begin = _backward(store, key, finish, stop - start)
+        else:
+            begin = _forward(store, key, size, 0, start or 0)
+    elif start is not None and start < 0:
+        begin = _backward(store, key, size, -start)
+        finish = size if stop is None else _forward(store, key, size, 0, stop)
+    else:
+        begin = _forward(store, key, size, 0, start or 0)
+        finish = size if stop is None else _forward(store, key, size, begin, stop - (start or 0))
+    return store.get_range(key, begin, finish) if finish > begin else b""
+
+
+def find_backend(store: StorageBackend, kind: type) -> StorageBackend | None:
+    """The first backend of type ``kind`` down a chain of wrappers, if any."""
+    while store is not None:
+        if isinstance(store, kind):
+            return store
+        store = getattr(store, "backend", None)
+    return None
+
+
+def from_env(data_dir: Path, permissions: int = 0o600) -> StorageBackend:
+    """Build the backend selected by the PPB_STORAGE environment variable.
+
+    If PPB_COMPRESS is set, raw objects are compressed (CompressedStorage).
+    If PPB_DEDUP is set, raw objects are stored as chunks (ChunkedStorage),
+    and with both, the chunks are what gets compressed.
+    If PPB_FAULTS is set, the backend is wrapped in FaultyStorage.
+    """
+    kind = os.environ.get("PPB_STORAGE", "local").lower()
+    if kind == "local":
+        backend = LocalStorage(data_dir, permissions)
+    elif kind == "erasure":
+        volumes = [Path(v) for v in os.environ.get("PPB_EC_VOLUMES", "").split(",") if v.strip()]
+        if not volumes:
+            raise RuntimeError("PPB_STORAGE=erasure requires PPB_EC_VOLUMES")
+        backend = ErasureStorage(
+            volumes,
+            data_shards=int(os.environ.get("PPB_EC_DATA", 4)),
+            parity_shards=int(os.environ.get("PPB_EC_PARITY", 2)),
+            min_size=int(os.environ.get("PPB_EC_MIN_KB", 1024)) * 1024,
+            permissions=permissions,
+        )
+    elif kind == "s3":
+        bucket = os.environ.get("PPB_S3_BUCKET")
+        if not bucket:
+            raise RuntimeError("PPB_STORAGE=s3 requires PPB_S3_BUCKET")
+        backend = S3Storage(
+            bucket,
+            prefix=os.environ.get("PPB_S3_PREFIX", ""),
+            endpoint_url=os.environ.get("PPB_S3_ENDPOINT") or None,
+            region=os.environ.get("PPB_S3_REGION") or None,
+        )
+    else:
+        raise RuntimeError(f"Unknown PPB_STORAGE backend: {kind}")
+
+    if os.environ.get("PPB_COMPRESS", "0") not in ("", "0"):
+        backend = CompressedStorage(backend, level=int(os.environ.get("PPB_COMPRESS_LEVEL", 3)))
+
+    if os.environ.get("PPB_DEDUP", "0") not in ("", "0"):
+        backend = ChunkedStorage(backend, avg_size=int(os.environ.get("PPB_DEDUP_AVG_KB", 64)) * 1024)
+
+    faults = os.environ.get("PPB_FAULTS")
+    if faults:
+        logger.warning(f"Injecting storage faults: {faults}")
+        backend = FaultyStorage(backend, faults)
+    return backend